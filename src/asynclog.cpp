@@ -0,0 +1,305 @@
+#include "asynclog.h"
+#include "hexutil.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The number of slots in the log ring, a power of two
+#define LOG_RING_SLOTS 4096
+// How long the logger thread sleeps when the ring is empty, writers only wake it when it is asleep
+#define LOG_IDLE_WAIT_MS 100
+// The longest formatted log line
+#define LOG_LINE_SIZE 1024
+
+namespace {
+
+/**
+ * A slot of the log ring. The sequence is the position the slot is next written at, and that position + 1 once
+ * the record written there is ready to be read.
+ */
+typedef struct log_slot {
+    std::atomic<uint64_t> sequence;
+    uint64_t position;
+    log_record record;
+} log_slot;
+
+static_assert(sizeof(log_slot) == LOG_SLOT_SIZE, "LOG_TEXT_SIZE does not fill the log slot");
+
+static const char *levelNames[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+/**
+ * A bounded multiple producer, single consumer ring of log records and the thread that formats and writes them.
+ * A writer claims a slot with a compare and swap of the write position and takes no lock, and when the ring is
+ * full the record is dropped and counted rather than blocking the writer.
+ */
+class async_logger {
+public:
+    async_logger() : slots(LOG_RING_SLOTS), write_position(0), read_position(0), drops(0), sleeping(false),
+                     stopping(false) {
+        for (uint64_t n = 0; n < LOG_RING_SLOTS; n ++)
+            slots[n].sequence.store(n, std::memory_order_relaxed);
+        thread = std::thread(&async_logger::run, this);
+    }
+
+    ~async_logger() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+    log_record* reserve() {
+        uint64_t position = write_position.load(std::memory_order_relaxed);
+        while (true) {
+            log_slot& slot = slots[position & (LOG_RING_SLOTS - 1)];
+            int64_t diff = (int64_t) slot.sequence.load(std::memory_order_acquire) - (int64_t) position;
+            if (diff == 0) {
+                if (write_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.position = position;
+                    return &slot.record;
+                }
+            } else if (diff < 0) {
+                drops.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            } else
+                position = write_position.load(std::memory_order_relaxed);
+        }
+    }
+
+    void commit(log_record *record) {
+        log_slot *slot = (log_slot *) ((uint8_t *) record - offsetof(log_slot, record));
+        slot->sequence.store(slot->position + 1, std::memory_order_release);
+        if (sleeping.load(std::memory_order_relaxed) || record->level >= LOG_LEVEL_WARN)
+            wake.notify_one();
+    }
+
+    void flush() {
+        uint64_t target = write_position.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (read_position.load(std::memory_order_acquire) < target && !stopping) {
+            wake.notify_one();
+            drained.wait_for(lock, std::chrono::milliseconds(LOG_IDLE_WAIT_MS));
+        }
+    }
+
+private:
+    /**
+     * Write the records that are ready
+     * @return false if there were none
+     */
+    bool drain() {
+        bool written = false;
+        uint64_t reported = drops.exchange(0, std::memory_order_relaxed);
+        if (reported > 0) {
+            fprintf(stderr, "%lu log records dropped, the log ring was full\n", reported);
+            written = true;
+        }
+        while (true) {
+            uint64_t position = read_position.load(std::memory_order_relaxed);
+            log_slot& slot = slots[position & (LOG_RING_SLOTS - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+                break;
+            writeRecord(slot.record);
+            slot.sequence.store(position + LOG_RING_SLOTS, std::memory_order_release);
+            read_position.store(position + 1, std::memory_order_release);
+            written = true;
+        }
+        if (written) {
+            fflush(stdout);
+            fflush(stderr);
+        }
+        return written;
+    }
+
+    void run() {
+        while (true) {
+            if (drain()) {
+                drained.notify_all();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            if (stopping)
+                break;
+            sleeping.store(true, std::memory_order_relaxed);
+            wake.wait_for(lock, std::chrono::milliseconds(LOG_IDLE_WAIT_MS));
+            sleeping.store(false, std::memory_order_relaxed);
+        }
+        drain();
+        drained.notify_all();
+    }
+
+    static void writeRecord(const log_record& record) {
+        char line[LOG_LINE_SIZE];
+        time_t seconds = record.time_ns / 1000000000;
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        int length = strftime(line, sizeof(line), "%H:%M:%S", &tm);
+        length += snprintf(line + length, sizeof(line) - length, ".%06ld %-5s ",
+                           (long) (record.time_ns % 1000000000) / 1000, levelNames[record.level]);
+        length += formatRecord(record, line + length, sizeof(line) - length - 1);
+        line[length++] = '\n';
+        fwrite(line, 1, length, record.level >= LOG_LEVEL_WARN ? stderr : stdout);
+    }
+
+    /**
+     * Expand the printf conversions of the record format with its args. The length modifiers of the format are
+     * ignored, each conversion is applied to the arg as the type it was recorded as.
+     * @return the length of the text written to buffer, at most size - 1
+     */
+    static int formatRecord(const log_record& record, char *buffer, int size) {
+        int length = 0;
+        uint32_t next = 0;
+        const char *f = record.format;
+        while (*f && length < size - 1) {
+            if (*f != '%') {
+                buffer[length++] = *f++;
+                continue;
+            }
+            if (f[1] == '%') {
+                buffer[length++] = '%';
+                f += 2;
+                continue;
+            }
+            // Copy the flags, width and precision of the conversion, and drop its length modifiers
+            char spec[32];
+            int specLength = 0;
+            const char *start = f;
+            spec[specLength++] = *f++;
+            while (*f && strchr("-+ #0123456789.", *f) && specLength < (int) sizeof(spec) - 4)
+                spec[specLength++] = *f++;
+            while (*f && strchr("hlLqjzt", *f))
+                f++;
+            if (*f == 0 || next >= record.count) {
+                // A malformed conversion or one without an arg is written as is
+                int n = (*f ? f + 1 : f) - start;
+                n = n < size - 1 - length ? n : size - 1 - length;
+                memcpy(buffer + length, start, n);
+                length += n;
+                f = *f ? f + 1 : f;
+                continue;
+            }
+            char conversion = *f++;
+            uint64_t arg = record.args[next];
+            uint8_t type = record.types[next++];
+            int available = size - length;
+            int n = 0;
+            switch (type) {
+                case LOG_ARG_STRING: {
+                    // The text of a string arg is not null terminated in the record
+                    char text[LOG_TEXT_SIZE + 1];
+                    memcpy(text, record.text + (arg >> 16), arg & 0xffff);
+                    text[arg & 0xffff] = 0;
+                    spec[specLength++] = 's';
+                    spec[specLength] = 0;
+                    n = snprintf(buffer + length, available, spec, text);
+                    break;
+                }
+                case LOG_ARG_HEX: {
+                    const uint8_t *data = (const uint8_t *) record.text + (arg >> 16);
+                    uint32_t count = arg & 0xffff;
+                    // The hex of a record text always fits in the line, only the bytes that fit are written
+                    if (3 * count > (uint32_t) available)
+                        count = available / 3;
+                    n = hexEncodeSeparated(data, count, ' ', buffer + length);
+                    break;
+                }
+                case LOG_ARG_POINTER:
+                    spec[specLength++] = 'p';
+                    spec[specLength] = 0;
+                    n = snprintf(buffer + length, available, spec, (void *) (uintptr_t) arg);
+                    break;
+                case LOG_ARG_DOUBLE: {
+                    double d;
+                    memcpy(&d, &arg, sizeof(d));
+                    if (strchr("fFeEgGaA", conversion)) {
+                        spec[specLength++] = conversion;
+                        spec[specLength] = 0;
+                        n = snprintf(buffer + length, available, spec, d);
+                    } else {
+                        spec[specLength++] = 'l';
+                        spec[specLength++] = 'l';
+                        spec[specLength++] = 'd';
+                        spec[specLength] = 0;
+                        n = snprintf(buffer + length, available, spec, (long long) d);
+                    }
+                    break;
+                }
+                default:
+                    if (conversion == 'c') {
+                        spec[specLength++] = 'c';
+                        spec[specLength] = 0;
+                        n = snprintf(buffer + length, available, spec, (int) arg);
+                    } else if (strchr("fFeEgGaA", conversion)) {
+                        spec[specLength++] = conversion;
+                        spec[specLength] = 0;
+                        n = snprintf(buffer + length, available, spec,
+                                     type == LOG_ARG_INT ? (double) (int64_t) arg : (double) arg);
+                    } else {
+                        // Integers are written with their recorded signedness unless the conversion is unsigned
+                        bool isSigned = type == LOG_ARG_INT && strchr("di", conversion) != nullptr;
+                        spec[specLength++] = 'l';
+                        spec[specLength++] = 'l';
+                        spec[specLength++] = strchr("diouxX", conversion) ? conversion : 'd';
+                        spec[specLength] = 0;
+                        if (isSigned)
+                            n = snprintf(buffer + length, available, spec, (long long) (int64_t) arg);
+                        else
+                            n = snprintf(buffer + length, available, spec, (unsigned long long) arg);
+                    }
+                    break;
+            }
+            if (n > 0)
+                length += n < available ? n : available - 1;
+        }
+        return length;
+    }
+
+    std::vector<log_slot> slots;
+    uint8_t pad0[64];
+    std::atomic<uint64_t> write_position;
+    uint8_t pad1[56];
+    std::atomic<uint64_t> read_position;
+    std::atomic<uint64_t> drops;
+    std::atomic<bool> sleeping;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::thread thread;
+};
+
+/**
+ * The process wide logger, started by the first record written
+ */
+static async_logger& logger() {
+    static async_logger instance;
+    return instance;
+}
+
+}
+
+log_record* logReserve(int level) {
+    log_record *record = logger().reserve();
+    if (record != nullptr) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        record->time_ns = now.tv_sec * 1000000000ll + now.tv_nsec;
+        record->level = level;
+    }
+    return record;
+}
+
+void logCommit(log_record *record) {
+    logger().commit(record);
+}
+
+void logFlush() {
+    logger().flush();
+}
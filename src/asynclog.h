@@ -0,0 +1,183 @@
+#ifndef asynclog_H
+#define asynclog_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+// The log levels, a record is written when its level is at least both the compiled and the runtime level
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+/*
+ * The lowest level compiled in. Log sites below it are eliminated by the compiler, so a build with
+ * -DSCANNER_LOG_LEVEL=1 has no debug logging code at all. Debug records are written at runtime only while
+ * hcidumpDebugMode is set.
+ */
+#ifndef SCANNER_LOG_LEVEL
+#define SCANNER_LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// The maximum number of arguments of a log record
+#define LOG_MAX_ARGS 8
+// The size of a log ring slot
+#define LOG_SLOT_SIZE 256
+// The space for the string and hex arguments of a record, what the other fields leave of a slot
+#define LOG_TEXT_SIZE 144
+
+// The log_record.types values
+#define LOG_ARG_INT 0
+#define LOG_ARG_UINT 1
+#define LOG_ARG_DOUBLE 2
+#define LOG_ARG_POINTER 3
+// A string copied into the record text, the arg is its offset << 16 | length
+#define LOG_ARG_STRING 4
+// Bytes copied into the record text and formatted as hex, the arg is their offset << 16 | length
+#define LOG_ARG_HEX 5
+
+extern bool hcidumpDebugMode;
+
+/**
+ * A log record as it is queued to the logger thread. The format must be a string literal, as only the pointer is
+ * copied, and is formatted with the printf conversions, but without a trailing newline, when the logger thread
+ * writes the record.
+ */
+typedef struct log_record {
+    const char *format;
+    /** The wall clock time in ns the record was written */
+    int64_t time_ns;
+    uint8_t level;
+    /** The count of args */
+    uint8_t count;
+    /** The bytes of text in use */
+    uint16_t text_length;
+    uint8_t types[LOG_MAX_ARGS];
+    uint64_t args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_SIZE];
+} log_record;
+
+/**
+ * Bytes to be logged as hex, see logHex
+ */
+typedef struct log_hex {
+    const void *data;
+    uint32_t length;
+} log_hex;
+
+/**
+ * Wrap length bytes of data as a log argument formatted as space separated hex, for a %s conversion
+ */
+static inline log_hex logHex(const void *data, uint32_t length) {
+    log_hex hex;
+    hex.data = data;
+    hex.length = length;
+    return hex;
+}
+
+/**
+ * Reserve a record in the log ring, called by the log macros
+ * @return the record to fill in, nullptr if the ring is full and the record was dropped
+ */
+log_record* logReserve(int level);
+
+/**
+ * Queue a reserved record to the logger thread
+ */
+void logCommit(log_record *record);
+
+/**
+ * Wait until the logger thread has written all the records queued before the call
+ */
+void logFlush();
+
+/**
+ * Check if records of level are written, a compile time false below SCANNER_LOG_LEVEL
+ */
+static inline bool logEnabled(int level) {
+    return level >= SCANNER_LOG_LEVEL && (level > LOG_LEVEL_DEBUG || hcidumpDebugMode);
+}
+
+static inline void logPut(log_record& record, uint8_t type, uint64_t value) {
+    record.types[record.count] = type;
+    record.args[record.count++] = value;
+}
+
+/**
+ * Copy length bytes of data to the record text, truncated to the space left
+ */
+static inline void logPutText(log_record& record, uint8_t type, const void *data, uint32_t length) {
+    uint32_t offset = record.text_length;
+    if (length > LOG_TEXT_SIZE - offset)
+        length = LOG_TEXT_SIZE - offset;
+    memcpy(record.text + offset, data, length);
+    record.text_length += length;
+    logPut(record, type, ((uint64_t) offset << 16) | length);
+}
+
+template<typename T>
+static inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+logArg(log_record& record, T value) {
+    if (std::is_signed<T>::value)
+        logPut(record, LOG_ARG_INT, (uint64_t) (int64_t) value);
+    else
+        logPut(record, LOG_ARG_UINT, (uint64_t) value);
+}
+
+template<typename T>
+static inline typename std::enable_if<std::is_floating_point<T>::value>::type logArg(log_record& record, T value) {
+    double d = value;
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    logPut(record, LOG_ARG_DOUBLE, bits);
+}
+
+template<typename T>
+static inline void logArg(log_record& record, const T *value) {
+    logPut(record, LOG_ARG_POINTER, (uint64_t) (uintptr_t) value);
+}
+
+static inline void logArg(log_record& record, const char *value) {
+    if (value == nullptr)
+        value = "(null)";
+    logPutText(record, LOG_ARG_STRING, value, strlen(value));
+}
+
+static inline void logArg(log_record& record, const log_hex& value) {
+    logPutText(record, LOG_ARG_HEX, value.data, value.length);
+}
+
+static inline void logArgs(log_record&) {}
+
+template<typename T, typename... Rest>
+static inline void logArgs(log_record& record, T value, Rest... rest) {
+    logArg(record, value);
+    logArgs(record, rest...);
+}
+
+/**
+ * Copy the format pointer and args into a record for the logger thread to format, so the calling thread does no
+ * formatting or I/O. The args are taken by value so fields of packed structs can be logged.
+ */
+template<typename... Args>
+static inline void logWrite(int level, const char *format, Args... args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    log_record *record = logReserve(level);
+    if (record == nullptr)
+        return;
+    record->format = format;
+    record->count = 0;
+    record->text_length = 0;
+    logArgs(*record, args...);
+    logCommit(record);
+}
+
+#define LOG_AT(level, ...) do { if (logEnabled(level)) logWrite(level, __VA_ARGS__); } while (0)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif
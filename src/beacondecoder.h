@@ -0,0 +1,357 @@
+#ifndef beacondecoder_H
+#define beacondecoder_H
+
+#include <stdint.h>
+#include <string.h>
+#include "hcidumpinternal.h"
+
+/*
+ * The registry of the beacon formats the scanner decodes natively. Each format is keyed by the AD type, the company
+ * id of manufacturer data or the 16 bit service uuid of service data, and a subtype, the beacon code or the frame
+ * type, that follows the id. The keys are a constexpr table, so findBeaconDecoder folds to a constant for a known
+ * key and is a short scan of the table otherwise. Each format has a beacon_decoder specialization that fills in its
+ * member of the beacon_record union. The decodeBeacons of signatureclassifier.h classifies and decodes every AD
+ * structure of an event in one pass.
+ */
+
+// The beacon_record.format values
+#define BEACON_FORMAT_NONE 0
+#define BEACON_FORMAT_IBEACON 1
+#define BEACON_FORMAT_ALTBEACON 2
+#define BEACON_FORMAT_EDDYSTONE_UID 3
+#define BEACON_FORMAT_EDDYSTONE_URL 4
+#define BEACON_FORMAT_EDDYSTONE_TLM 5
+#define BEACON_FORMAT_EDDYSTONE_EID 6
+#define BEACON_FORMAT_RHIOTTAG_TLM 7
+#define BEACON_FORMAT_RHIOTTAG_MISC 8
+#define BEACON_FORMATS 9
+
+// The AD types beacons are carried in
+#define AD_TYPE_SERVICE_DATA_16 0x16
+#define AD_TYPE_MANUFACTURER_DATA 0xff
+// The company id of the iBeacon manufacturer data
+#define APPLE_COMPANY_ID 0x004c
+// The 16 bit service uuid of the Eddystone service data
+#define EDDYSTONE_SERVICE_UUID 0xfeaa
+// The beacon_decoder_key.id that matches any company id or service uuid
+#define BEACON_ANY_ID 0x10000
+// The maximum length of the encoded url of an Eddystone URL frame
+#define EDDYSTONE_URL_MAX 17
+
+/**
+ * The key and minimum AD structure data length of a beacon format. The id is the little endian uint16_t at the
+ * start of the AD structure data, and the subtype the sub_length bytes after it read big endian.
+ */
+typedef struct beacon_decoder_key {
+    uint8_t ad_type;
+    uint32_t id;
+    uint8_t sub_length;
+    uint16_t sub;
+    uint8_t min_length;
+    uint8_t format;
+} beacon_decoder_key;
+
+/*
+ * The registry, in match order. The RHIoTTag TLM frame is the Eddystone TLM frame with keys and lux appended, so it
+ * is matched by its length before the plain TLM frame. AltBeacon manufacturer data has any company id.
+ * https://github.com/google/eddystone/blob/master/protocol-specification.md
+ * https://github.com/AltBeacon/spec
+ */
+static constexpr beacon_decoder_key beaconDecoderKeys[] = {
+    {AD_TYPE_MANUFACTURER_DATA, APPLE_COMPANY_ID, 2, 0x0215, MIN_MANUFACTURER_DATA_SIZE, BEACON_FORMAT_IBEACON},
+    {AD_TYPE_MANUFACTURER_DATA, BEACON_ANY_ID, 2, 0xbeac, MIN_MANUFACTURER_DATA_SIZE + 1, BEACON_FORMAT_ALTBEACON},
+    {AD_TYPE_SERVICE_DATA_16, EDDYSTONE_SERVICE_UUID, 1, 0x00, 2 + 18, BEACON_FORMAT_EDDYSTONE_UID},
+    {AD_TYPE_SERVICE_DATA_16, EDDYSTONE_SERVICE_UUID, 1, 0x10, 2 + 3, BEACON_FORMAT_EDDYSTONE_URL},
+    {AD_TYPE_SERVICE_DATA_16, EDDYSTONE_SERVICE_UUID, 1, 0x20, 2 + 17, BEACON_FORMAT_RHIOTTAG_TLM},
+    {AD_TYPE_SERVICE_DATA_16, EDDYSTONE_SERVICE_UUID, 1, 0x20, 2 + 14, BEACON_FORMAT_EDDYSTONE_TLM},
+    {AD_TYPE_SERVICE_DATA_16, EDDYSTONE_SERVICE_UUID, 1, 0x30, 2 + 10, BEACON_FORMAT_EDDYSTONE_EID},
+    {AD_TYPE_SERVICE_DATA_16, EDDYSTONE_SERVICE_UUID, 1, 0x21, 2 + 16, BEACON_FORMAT_RHIOTTAG_MISC},
+};
+#define BEACON_DECODER_KEYS (sizeof(beaconDecoderKeys) / sizeof(beaconDecoderKeys[0]))
+
+static constexpr bool beaconKeyMatches(const beacon_decoder_key& key, uint8_t adType, uint32_t id, uint32_t sub1,
+                                       uint32_t sub2, uint8_t length) {
+    return key.ad_type == adType && (key.id == BEACON_ANY_ID || key.id == id)
+           && key.sub == (key.sub_length == 1 ? sub1 : sub2) && length >= key.min_length;
+}
+
+/**
+ * The format of an AD structure given its type, id, the one and two byte subtypes and its data length
+ * @return the BEACON_FORMAT_* of the first matching registry key, BEACON_FORMAT_NONE if there is none
+ */
+static constexpr uint8_t findBeaconDecoder(uint8_t adType, uint32_t id, uint32_t sub1, uint32_t sub2, uint8_t length,
+                                           uint32_t index = 0) {
+    return index == BEACON_DECODER_KEYS ? BEACON_FORMAT_NONE
+           : beaconKeyMatches(beaconDecoderKeys[index], adType, id, sub1, sub2, length)
+             ? beaconDecoderKeys[index].format
+             : findBeaconDecoder(adType, id, sub1, sub2, length, index + 1);
+}
+
+static_assert(findBeaconDecoder(AD_TYPE_MANUFACTURER_DATA, APPLE_COMPANY_ID, 0x02, 0x0215, 25)
+              == BEACON_FORMAT_IBEACON, "iBeacon key");
+static_assert(findBeaconDecoder(AD_TYPE_MANUFACTURER_DATA, 0x0118, 0xbe, 0xbeac, 26) == BEACON_FORMAT_ALTBEACON,
+              "AltBeacon key");
+static_assert(findBeaconDecoder(AD_TYPE_SERVICE_DATA_16, EDDYSTONE_SERVICE_UUID, 0x20, 0x2000, 19)
+              == BEACON_FORMAT_RHIOTTAG_TLM, "RHIoTTag TLM key");
+static_assert(findBeaconDecoder(AD_TYPE_SERVICE_DATA_16, EDDYSTONE_SERVICE_UUID, 0x20, 0x2000, 16)
+              == BEACON_FORMAT_EDDYSTONE_TLM, "Eddystone TLM key");
+
+static inline uint16_t beUint16(const uint8_t *data) {
+    return (uint16_t) (data[0] << 8 | data[1]);
+}
+
+static inline uint32_t beUint32(const uint8_t *data) {
+    return (uint32_t) data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+/**
+ * An Eddystone UID frame
+ */
+typedef struct eddystone_uid {
+    /** The calibrated tx power at 0m in dBm */
+    int8_t tx_power;
+    uint8_t namespace_id[10];
+    uint8_t instance_id[6];
+} eddystone_uid;
+
+/**
+ * An Eddystone URL frame, the url is left encoded, see eddystoneUrlExpand
+ */
+typedef struct eddystone_url {
+    /** The calibrated tx power at 0m in dBm */
+    int8_t tx_power;
+    /** The url scheme prefix code */
+    uint8_t scheme;
+    /** The length of the encoded url */
+    uint8_t length;
+    uint8_t url[EDDYSTONE_URL_MAX];
+} eddystone_url;
+
+/**
+ * An unencrypted Eddystone TLM frame
+ */
+typedef struct eddystone_tlm {
+    /** The TLM version, 0 */
+    uint8_t version;
+    /** The battery voltage in mV, 0 if not supported */
+    uint16_t battery_mv;
+    /** The temperature in C as signed 8.8 fixed point, 0x8000 if not supported */
+    int16_t temperature;
+    /** The count of advertisements since power up */
+    uint32_t adv_count;
+    /** The time since power up in 0.1s */
+    uint32_t sec_count;
+} eddystone_tlm;
+
+/**
+ * An Eddystone EID frame
+ */
+typedef struct eddystone_eid {
+    /** The calibrated tx power at 0m in dBm */
+    int8_t tx_power;
+    uint8_t eid[8];
+} eddystone_eid;
+
+/**
+ * The RHIoTTag extended Eddystone TLM frame, frame type 0x20 with the key state and raw light sensor reading
+ * appended
+ */
+typedef struct rhiottag_tlm {
+    eddystone_tlm tlm;
+    /** Bit 0: left key (user button), Bit 1: right key (power button), Bit 2: reed relay */
+    uint8_t keys;
+    /** The raw OPT3001 light sensor reading */
+    uint16_t lux_raw;
+} rhiottag_tlm;
+
+/**
+ * The RHIoTTag misc frame, frame type 0x21, with the raw motion sensor readings, which are big endian in the frame
+ * like the other fields
+ */
+typedef struct rhiottag_misc {
+    /** Bit 0: left key (user button), Bit 1: right key (power button), Bit 2: reed relay */
+    uint8_t keys;
+    /** The raw OPT3001 light sensor reading */
+    uint16_t lux_raw;
+    int16_t gyro[3];
+    int16_t accel[3];
+} rhiottag_misc;
+
+/**
+ * A decoded beacon AD structure, the member of the union in use is given by format
+ */
+typedef struct beacon_record {
+    /** The BEACON_FORMAT_* */
+    uint8_t format;
+    /** The index of the AD structure in the ad_data_view.data[] */
+    uint8_t ad_index;
+    union {
+        /** BEACON_FORMAT_IBEACON and BEACON_FORMAT_ALTBEACON, with the rssi and time of the event */
+        beacon_info_v2 beacon;
+        eddystone_uid uid;
+        eddystone_url url;
+        eddystone_tlm tlm;
+        eddystone_eid eid;
+        rhiottag_tlm rhiot_tlm;
+        rhiottag_misc rhiot_misc;
+    };
+} beacon_record;
+
+/**
+ * The decoder of each format, decode is passed AD structure data of at least the registry min_length for the
+ * format. The Eddystone decoders are passed the data after the service uuid and frame type.
+ * decode returns false for a frame the signature matched but that can't be decoded, such as an encrypted TLM frame.
+ */
+template<int FORMAT> struct beacon_decoder;
+
+template<> struct beacon_decoder<BEACON_FORMAT_IBEACON> {
+    static inline bool decode(const uint8_t *data, uint8_t, beacon_record& record) {
+        extractBeaconInfoV2(data, &record.beacon);
+        return true;
+    }
+};
+
+// The AltBeacon beacon id is laid out as the iBeacon uuid, major and minor, and extractBeaconInfoV2 flags it
+template<> struct beacon_decoder<BEACON_FORMAT_ALTBEACON> : beacon_decoder<BEACON_FORMAT_IBEACON> {};
+
+template<> struct beacon_decoder<BEACON_FORMAT_EDDYSTONE_UID> {
+    static inline bool decode(const uint8_t *data, uint8_t, beacon_record& record) {
+        record.uid.tx_power = (int8_t) data[0];
+        memcpy(record.uid.namespace_id, data + 1, sizeof(record.uid.namespace_id));
+        memcpy(record.uid.instance_id, data + 11, sizeof(record.uid.instance_id));
+        return true;
+    }
+};
+
+template<> struct beacon_decoder<BEACON_FORMAT_EDDYSTONE_URL> {
+    static inline bool decode(const uint8_t *data, uint8_t length, beacon_record& record) {
+        record.url.tx_power = (int8_t) data[0];
+        record.url.scheme = data[1];
+        record.url.length = length - 2 < EDDYSTONE_URL_MAX ? length - 2 : EDDYSTONE_URL_MAX;
+        memcpy(record.url.url, data + 2, record.url.length);
+        return true;
+    }
+};
+
+template<> struct beacon_decoder<BEACON_FORMAT_EDDYSTONE_TLM> {
+    static inline bool decode(const uint8_t *data, uint8_t, beacon_record& record) {
+        // Only the version 0 frame is plain telemetry, the version 1 ETLM frame shares the signature but is encrypted
+        record.tlm.version = data[0];
+        if (record.tlm.version != 0)
+            return false;
+        record.tlm.battery_mv = beUint16(data + 1);
+        record.tlm.temperature = (int16_t) beUint16(data + 3);
+        record.tlm.adv_count = beUint32(data + 5);
+        record.tlm.sec_count = beUint32(data + 9);
+        return true;
+    }
+};
+
+template<> struct beacon_decoder<BEACON_FORMAT_EDDYSTONE_EID> {
+    static inline bool decode(const uint8_t *data, uint8_t, beacon_record& record) {
+        record.eid.tx_power = (int8_t) data[0];
+        memcpy(record.eid.eid, data + 1, sizeof(record.eid.eid));
+        return true;
+    }
+};
+
+template<> struct beacon_decoder<BEACON_FORMAT_RHIOTTAG_TLM> {
+    static inline bool decode(const uint8_t *data, uint8_t length, beacon_record& record) {
+        if (!beacon_decoder<BEACON_FORMAT_EDDYSTONE_TLM>::decode(data, length, record))
+            return false;
+        record.rhiot_tlm.keys = data[13];
+        record.rhiot_tlm.lux_raw = beUint16(data + 14);
+        return true;
+    }
+};
+
+template<> struct beacon_decoder<BEACON_FORMAT_RHIOTTAG_MISC> {
+    static inline bool decode(const uint8_t *data, uint8_t, beacon_record& record) {
+        record.rhiot_misc.keys = data[0];
+        record.rhiot_misc.lux_raw = beUint16(data + 1);
+        for (int n = 0; n < 3; n ++) {
+            record.rhiot_misc.gyro[n] = (int16_t) beUint16(data + 3 + 2*n);
+            record.rhiot_misc.accel[n] = (int16_t) beUint16(data + 9 + 2*n);
+        }
+        return true;
+    }
+};
+
+/**
+ * Look up the format of the length bytes of data of an AD structure of type adType
+ */
+static inline uint8_t classifyAdStructure(uint8_t adType, const uint8_t *data, uint8_t length) {
+    if (length < 3)
+        return BEACON_FORMAT_NONE;
+    uint32_t id = data[0] | data[1] << 8;
+    uint32_t sub2 = length >= 4 ? (uint32_t) beUint16(data + 2) : BEACON_ANY_ID;
+    return findBeaconDecoder(adType, id, data[2], sub2, length);
+}
+
+/**
+ * Decode the data of an AD structure of the given format into record
+ * @return false if the structure could not be decoded, and the record format is then BEACON_FORMAT_NONE
+ */
+static inline bool decodeAdStructure(uint8_t format, const uint8_t *data, uint8_t length, beacon_record& record) {
+    record.format = format;
+    // The Eddystone frames are decoded from the byte after the service uuid and frame type
+    const uint8_t *frame = data + 3;
+    uint8_t frameLength = length - 3;
+    bool decoded = false;
+    switch (format) {
+        case BEACON_FORMAT_IBEACON:
+            decoded = beacon_decoder<BEACON_FORMAT_IBEACON>::decode(data, length, record);
+            break;
+        case BEACON_FORMAT_ALTBEACON:
+            decoded = beacon_decoder<BEACON_FORMAT_ALTBEACON>::decode(data, length, record);
+            break;
+        case BEACON_FORMAT_EDDYSTONE_UID:
+            decoded = beacon_decoder<BEACON_FORMAT_EDDYSTONE_UID>::decode(frame, frameLength, record);
+            break;
+        case BEACON_FORMAT_EDDYSTONE_URL:
+            decoded = beacon_decoder<BEACON_FORMAT_EDDYSTONE_URL>::decode(frame, frameLength, record);
+            break;
+        case BEACON_FORMAT_EDDYSTONE_TLM:
+            decoded = beacon_decoder<BEACON_FORMAT_EDDYSTONE_TLM>::decode(frame, frameLength, record);
+            break;
+        case BEACON_FORMAT_EDDYSTONE_EID:
+            decoded = beacon_decoder<BEACON_FORMAT_EDDYSTONE_EID>::decode(frame, frameLength, record);
+            break;
+        case BEACON_FORMAT_RHIOTTAG_TLM:
+            decoded = beacon_decoder<BEACON_FORMAT_RHIOTTAG_TLM>::decode(frame, frameLength, record);
+            break;
+        case BEACON_FORMAT_RHIOTTAG_MISC:
+            decoded = beacon_decoder<BEACON_FORMAT_RHIOTTAG_MISC>::decode(frame, frameLength, record);
+            break;
+    }
+    if (!decoded)
+        record.format = BEACON_FORMAT_NONE;
+    return decoded;
+}
+
+// The size of the eddystoneUrlExpand buffer that holds any url
+#define EDDYSTONE_URL_TEXT_SIZE (12 + 7 * EDDYSTONE_URL_MAX + 1)
+
+/**
+ * Expand the scheme prefix and the expansion codes of an Eddystone URL frame into text, which must hold
+ * EDDYSTONE_URL_TEXT_SIZE chars
+ * @return text
+ */
+static inline const char* eddystoneUrlExpand(const eddystone_url& url, char *text) {
+    static const char *schemes[] = {"http://www.", "https://www.", "http://", "https://"};
+    static const char *expansions[] = {".com/", ".org/", ".edu/", ".net/", ".info/", ".biz/", ".gov/", ".com",
+                                       ".org", ".edu", ".net", ".info", ".biz", ".gov"};
+    char *loc = text;
+    if (url.scheme < 4)
+        loc = stpcpy(loc, schemes[url.scheme]);
+    for (int n = 0; n < url.length; n ++) {
+        if (url.url[n] < 14)
+            loc = stpcpy(loc, expansions[url.url[n]]);
+        else if (url.url[n] > 0x20 && url.url[n] < 0x7f)
+            *loc++ = url.url[n];
+    }
+    *loc = 0;
+    return text;
+}
+
+#endif
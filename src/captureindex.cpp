@@ -0,0 +1,305 @@
+#include "captureindex.h"
+#include "framesource.h"
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <sys/stat.h>
+
+extern "C" {
+#ifdef LEGACY_BLUEZ
+// The bluetooth.h header uses an invalid syntax for c++-std11 to map it to __typeof__
+#define typeof __typeof__
+#endif
+#include "parser.h"
+#include <bluetooth.h>
+#include <hci.h>
+}
+
+namespace {
+
+/**
+ * The sort key of an address, the order of the capture_index_address array
+ */
+static inline uint64_t addressKey(const uint8_t *bdaddr) {
+    uint64_t key = 0;
+    for (int n = 5; n >= 0; n --)
+        key = (key << 8) | bdaddr[n];
+    return key;
+}
+
+/**
+ * A frame source over a list of record aligned ranges of a mapped archive
+ */
+class range_frame_source : public frame_source {
+public:
+    range_frame_source(const mmap_frame_source& archive, const std::vector<std::pair<uint64_t, uint64_t>>& ranges)
+            : archive(archive), ranges(ranges) {}
+
+    int pollfd() const { return -1; }
+    int64_t delay_ms() { return 0; }
+    int read_frame(struct frame *frm, uint32_t capacity) {
+        while (true) {
+            if (!current) {
+                if (next >= ranges.size())
+                    return FRAME_SOURCE_END;
+                current.reset(new mmap_frame_source(archive, ranges[next].first, ranges[next].second));
+                next ++;
+            }
+            int status = current->read_frame(frm, capacity);
+            if (status != FRAME_SOURCE_END)
+                return status;
+            current.reset();
+        }
+    }
+
+private:
+    const mmap_frame_source& archive;
+    const std::vector<std::pair<uint64_t, uint64_t>>& ranges;
+    size_t next = 0;
+    std::unique_ptr<mmap_frame_source> current;
+};
+
+static inline int64_t frameTime(const struct frame& frm) {
+    return frm.ts.tv_sec * 1000ll + frm.ts.tv_usec / 1000;
+}
+
+}
+
+void resetCaptureIndex(capture_index_builder& builder, uint32_t interval) {
+    builder.interval = interval > 0 ? interval : CAPTURE_INDEX_INTERVAL;
+    builder.records = 0;
+    builder.blocks.clear();
+    builder.postings.clear();
+}
+
+void addCaptureIndexRecord(capture_index_builder& builder, uint64_t offset, int64_t time, const uint8_t *data,
+                           uint32_t len) {
+    if (builder.records % builder.interval == 0) {
+        capture_index_block block;
+        block.offset = offset;
+        block.min_time = block.max_time = time;
+        builder.blocks.push_back(block);
+    } else {
+        capture_index_block& block = builder.blocks.back();
+        block.min_time = std::min(block.min_time, time);
+        block.max_time = std::max(block.max_time, time);
+    }
+    builder.records ++;
+
+    // Walk the reports of an LE advertising report event, the type, meta event header, subevent and report count
+    if (len < 5 || data[0] != HCI_EVENT_PKT || data[1] != EVT_LE_META_EVENT || data[3] != EVT_LE_ADVERTISING_REPORT)
+        return;
+    uint32_t block = builder.blocks.size() - 1;
+    uint32_t pos = 5;
+    for (uint8_t reports = data[4]; reports > 0; reports --) {
+        // A report cut short of its data and rssi ends the walk, as it ends the parse
+        if (pos + LE_ADVERTISING_INFO_SIZE > len)
+            break;
+        const le_advertising_info *info = (const le_advertising_info *) (data + pos);
+        pos += LE_ADVERTISING_INFO_SIZE + info->length + 1;
+        if (pos > len)
+            break;
+        std::vector<uint32_t>& list = builder.postings[addressKey(info->bdaddr.b)];
+        if (list.empty() || list.back() != block)
+            list.push_back(block);
+    }
+}
+
+int32_t buildCaptureIndex(const char *capturePath, uint32_t interval) {
+    mmap_frame_source archive;
+    if (archive.open(capturePath) != 0)
+        return -1;
+
+    capture_index_builder builder;
+    resetCaptureIndex(builder, interval);
+    std::vector<uint8_t> buf(HCI_MAX_FRAME_SIZE);
+    struct frame frm;
+    memset(&frm, 0, sizeof(frm));
+    while (true) {
+        uint64_t offset = archive.getOffset();
+        frm.data = buf.data();
+        int status = archive.read_frame(&frm, HCI_MAX_FRAME_SIZE);
+        if (status == FRAME_SOURCE_NONE)
+            continue;
+        if (status < 0)
+            break;
+        addCaptureIndexRecord(builder, offset, frameTime(frm), frm.data, frm.data_len);
+    }
+    return writeCaptureIndex(capturePath, builder);
+}
+
+int32_t writeCaptureIndex(const char *capturePath, const capture_index_builder& builder) {
+    struct stat st;
+    if (stat(capturePath, &st) < 0) {
+        LOG_ERROR("Can't stat capture file: %s", strerror(errno));
+        return -1;
+    }
+    // Write to a temporary file and rename it so a reader never sees a partial index
+    std::string path = std::string(capturePath) + CAPTURE_INDEX_SUFFIX;
+    std::string tmpPath = path + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (!file) {
+        LOG_ERROR("Can't create capture index %s, %s(%d)", tmpPath.c_str(), strerror(errno), errno);
+        return -1;
+    }
+
+    struct capture_index_hdr hdr;
+    memcpy(hdr.id, capture_index_id, sizeof(capture_index_id));
+    hdr.version = htole32(CAPTURE_INDEX_VERSION);
+    hdr.interval = htole32(builder.interval);
+    hdr.capture_size = htole64(st.st_size);
+    hdr.records = htole64(builder.records);
+    hdr.blocks = htole32(builder.blocks.size());
+    hdr.addresses = htole32(builder.postings.size());
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, file) == 1;
+    for (capture_index_block block : builder.blocks) {
+        block.offset = htole64(block.offset);
+        block.min_time = htole64(block.min_time);
+        block.max_time = htole64(block.max_time);
+        ok = ok && fwrite(&block, sizeof(block), 1, file) == 1;
+    }
+    uint32_t first = 0;
+    for (const std::pair<const uint64_t, std::vector<uint32_t>>& entry : builder.postings) {
+        capture_index_address address;
+        uint64_t key = entry.first;
+        for (int n = 0; n < 6; n ++, key >>= 8)
+            address.bdaddr[n] = key & 0xff;
+        address.pad = 0;
+        address.first = htole32(first);
+        address.count = htole32(entry.second.size());
+        ok = ok && fwrite(&address, sizeof(address), 1, file) == 1;
+        first += entry.second.size();
+    }
+    for (const std::pair<const uint64_t, std::vector<uint32_t>>& entry : builder.postings) {
+        for (uint32_t block : entry.second) {
+            block = htole32(block);
+            ok = ok && fwrite(&block, sizeof(block), 1, file) == 1;
+        }
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) < 0) {
+        LOG_ERROR("Can't write capture index %s, %s(%d)", path.c_str(), strerror(errno), errno);
+        remove(tmpPath.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int32_t loadCaptureIndex(const char *capturePath, capture_index& index) {
+    std::string path = std::string(capturePath) + CAPTURE_INDEX_SUFFIX;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        LOG_ERROR("Can't open capture index %s, %s(%d)", path.c_str(), strerror(errno), errno);
+        return -1;
+    }
+    struct capture_index_hdr hdr;
+    struct stat indexStat;
+    bool ok = fstat(fileno(file), &indexStat) == 0 && fread(&hdr, sizeof(hdr), 1, file) == 1
+              && memcmp(hdr.id, capture_index_id, sizeof(hdr.id)) == 0 && le32toh(hdr.version) == CAPTURE_INDEX_VERSION;
+    // The counts are only trusted once the index file is large enough to hold the arrays they size
+    uint64_t remaining = ok ? indexStat.st_size - sizeof(hdr) : 0;
+    if (ok) {
+        uint64_t blocks = le32toh(hdr.blocks);
+        uint64_t addresses = le32toh(hdr.addresses);
+        ok = blocks * sizeof(capture_index_block) + addresses * sizeof(capture_index_address) <= remaining;
+        if (ok) {
+            remaining -= blocks * sizeof(capture_index_block) + addresses * sizeof(capture_index_address);
+            index.interval = le32toh(hdr.interval);
+            index.capture_size = le64toh(hdr.capture_size);
+            index.records = le64toh(hdr.records);
+            index.blocks.resize(blocks);
+            index.addresses.resize(addresses);
+            ok = fread(index.blocks.data(), sizeof(capture_index_block), blocks, file) == blocks
+                 && fread(index.addresses.data(), sizeof(capture_index_address), addresses, file) == addresses;
+        }
+    }
+    if (ok) {
+        uint64_t postings = 0;
+        for (capture_index_address& address : index.addresses) {
+            address.first = le32toh(address.first);
+            address.count = le32toh(address.count);
+            postings += address.count;
+        }
+        ok = postings <= remaining / sizeof(uint32_t);
+        if (ok) {
+            index.postings.resize(postings);
+            ok = fread(index.postings.data(), sizeof(uint32_t), postings, file) == postings;
+        }
+    }
+    fclose(file);
+    if (!ok) {
+        LOG_ERROR("%s is not a valid capture index", path.c_str());
+        return -1;
+    }
+    for (capture_index_block& block : index.blocks) {
+        block.offset = le64toh(block.offset);
+        block.min_time = le64toh(block.min_time);
+        block.max_time = le64toh(block.max_time);
+    }
+    for (uint32_t& block : index.postings)
+        block = le32toh(block);
+
+    struct stat st;
+    if (stat(capturePath, &st) < 0 || (uint64_t) st.st_size != index.capture_size) {
+        LOG_ERROR("Capture index %s is stale, rebuild it", path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> queryCaptureRanges(const capture_index& index, const capture_query& query) {
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    const uint32_t *candidates = nullptr;
+    uint32_t count = index.blocks.size();
+    if (query.match_bdaddr) {
+        uint64_t key = addressKey(query.bdaddr);
+        std::vector<capture_index_address>::const_iterator it = std::lower_bound(index.addresses.begin(),
+                index.addresses.end(), key, [](const capture_index_address& address, uint64_t key) {
+                    return addressKey(address.bdaddr) < key;
+                });
+        if (it == index.addresses.end() || addressKey(it->bdaddr) != key
+            || it->first + (uint64_t) it->count > index.postings.size())
+            return ranges;
+        candidates = index.postings.data() + it->first;
+        count = it->count;
+    }
+
+    for (uint32_t n = 0; n < count; n ++) {
+        uint32_t block = candidates ? candidates[n] : n;
+        if (block >= index.blocks.size())
+            continue;
+        const capture_index_block& b = index.blocks[block];
+        if (b.max_time < query.from_time || b.min_time > query.to_time)
+            continue;
+        uint64_t begin = b.offset;
+        uint64_t end = block + 1 < index.blocks.size() ? index.blocks[block + 1].offset : index.capture_size;
+        if (!ranges.empty() && ranges.back().second == begin)
+            ranges.back().second = end;
+        else
+            ranges.push_back(std::make_pair(begin, end));
+    }
+    return ranges;
+}
+
+int32_t queryCapture(const char *capturePath, const capture_query& query, std::function<bool(ad_data&)> callback) {
+    capture_index index;
+    if (loadCaptureIndex(capturePath, index) != 0)
+        return -1;
+    mmap_frame_source archive;
+    if (archive.open(capturePath) != 0)
+        return -1;
+
+    std::vector<std::pair<uint64_t, uint64_t>> ranges = queryCaptureRanges(index, query);
+    range_frame_source source(archive, ranges);
+    scan_options options;
+    // The blocks hold other addresses and times too, so the events are filtered exactly here
+    return scan_for_ad_events(source, [&](ad_data& event) {
+        if (event.time < query.from_time || event.time > query.to_time)
+            return false;
+        if (query.match_bdaddr && memcmp(event.bdaddr, query.bdaddr, sizeof(event.bdaddr)) != 0)
+            return false;
+        return callback(event);
+    }, options);
+}
@@ -0,0 +1,142 @@
+#ifndef captureindex_H
+#define captureindex_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "hcidumpinternal.h"
+
+/*
+    The sidecar index of a btsnoop capture, written to the capture path plus CAPTURE_INDEX_SUFFIX. All fields are
+    little endian. The file is the capture_index_hdr, followed by the capture_index_block array, the
+    capture_index_address array sorted by bdaddr, and then the uint32_t block numbers of the address posting lists.
+ */
+#define CAPTURE_INDEX_SUFFIX ".idx"
+#define CAPTURE_INDEX_VERSION 1
+// The default number of capture records covered by each index block
+#define CAPTURE_INDEX_INTERVAL 1024
+
+static const uint8_t capture_index_id[] = { 'r', 'h', 'i', 'o', 't', 'i', 'd', 'x' };
+
+struct capture_index_hdr {
+    uint8_t id[8];
+    uint32_t version;
+    /** The number of records in each block */
+    uint32_t interval;
+    /** The size of the capture when it was indexed, a capture of any other size has a stale index */
+    uint64_t capture_size;
+    uint64_t records;
+    uint32_t blocks;
+    uint32_t addresses;
+} __attribute__ ((packed));
+
+/**
+ * A sparse checkpoint every interval records, the block runs to the offset of the next block or the capture end
+ */
+struct capture_index_block {
+    /** The file offset of the first record of the block */
+    uint64_t offset;
+    /** The range of record times in the block in milliseconds, captures are not strictly in time order */
+    int64_t min_time;
+    int64_t max_time;
+} __attribute__ ((packed));
+
+/**
+ * The posting list of the blocks holding advertising reports from one address
+ */
+struct capture_index_address {
+    uint8_t bdaddr[6];
+    uint16_t pad;
+    /** The index of the first block number of the list in the posting lists */
+    uint32_t first;
+    uint32_t count;
+} __attribute__ ((packed));
+
+/**
+ * A loaded capture index
+ */
+typedef struct capture_index {
+    uint32_t interval = 0;
+    uint64_t capture_size = 0;
+    uint64_t records = 0;
+    std::vector<capture_index_block> blocks;
+    std::vector<capture_index_address> addresses;
+    std::vector<uint32_t> postings;
+} capture_index;
+
+/**
+ * A capture query for the advertising events in a time range, optionally from a single address
+ */
+typedef struct capture_query {
+    /** The inclusive range of event times in milliseconds */
+    int64_t from_time = LLONG_MIN;
+    int64_t to_time = LLONG_MAX;
+    /** Only match events from bdaddr */
+    bool match_bdaddr = false;
+    /** The address in the ad_data.bdaddr order, least significant byte first */
+    uint8_t bdaddr[6];
+} capture_query;
+
+/**
+ * An index accumulated record by record as a capture is read or written, and then written with writeCaptureIndex
+ */
+typedef struct capture_index_builder {
+    uint32_t interval = CAPTURE_INDEX_INTERVAL;
+    uint64_t records = 0;
+    std::vector<capture_index_block> blocks;
+    /** The posting lists by address key, ordered as they are written */
+    std::map<uint64_t, std::vector<uint32_t>> postings;
+} capture_index_builder;
+
+/**
+ * Empty builder to start the index of a new capture
+ * @param interval the number of records in each index block, 0 = CAPTURE_INDEX_INTERVAL
+ */
+void resetCaptureIndex(capture_index_builder& builder, uint32_t interval);
+
+/**
+ * Add the next record of the capture to the index, posting its block under the address of every advertising report
+ * in the frame
+ * @param offset the file offset of the record
+ * @param time the record time in milliseconds
+ * @param data the raw HCI frame, starting with its packet type byte
+ */
+void addCaptureIndexRecord(capture_index_builder& builder, uint64_t offset, int64_t time, const uint8_t *data,
+                           uint32_t len);
+
+/**
+ * Write the index accumulated by builder as the sidecar of the complete capture at capturePath
+ * @return 0 on success, -1 if the capture could not be read or the index written
+ */
+int32_t writeCaptureIndex(const char *capturePath, const capture_index_builder& builder);
+
+/**
+ * Build the sidecar index of the btsnoop capture at capturePath
+ * @param interval the number of records in each index block
+ * @return 0 on success, -1 if the capture could not be read or the index written
+ */
+int32_t buildCaptureIndex(const char *capturePath, uint32_t interval = CAPTURE_INDEX_INTERVAL);
+
+/**
+ * Load the sidecar index of the btsnoop capture at capturePath into index
+ * @return 0 on success, -1 if the index is missing, invalid or stale
+ */
+int32_t loadCaptureIndex(const char *capturePath, capture_index& index);
+
+/**
+ * Find the ranges of the capture that can hold events matching query
+ * @return the [begin, end) file offsets of the matching blocks, with adjacent blocks merged
+ */
+std::vector<std::pair<uint64_t, uint64_t>> queryCaptureRanges(const capture_index& index, const capture_query& query);
+
+/**
+ * Pass the advertising events of the btsnoop capture at capturePath that match query to the callback, reading only
+ * the blocks of the capture the index shows can hold them.
+ * @return 0 on success, -1 if the capture could not be mapped or its index loaded
+ */
+int32_t queryCapture(const char *capturePath, const capture_query& query, std::function<bool(ad_data&)> callback);
+
+#endif
@@ -0,0 +1,169 @@
+#include "capturewriter.h"
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+
+// The size of the FILE buffer, so the writer thread makes few large writes
+#define CAPTURE_FILE_BUFFER_SIZE (256 * 1024)
+// The largest frame queued to the writer, the HCI_MAX_FRAME_SIZE of a raw HCI socket
+#define CAPTURE_MAX_FRAME_SIZE 1028
+// How long the writer thread waits for frames before checking for time based rotation
+#define CAPTURE_IDLE_WAIT_MS 1000
+
+static std::string captureFileName(const capture_options& options, uint32_t sequence) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-%06u.btsnoop", sequence);
+    return options.prefix + suffix;
+}
+
+/**
+ * The sequence number to start a writer at, one past the highest of any capture files already written with the
+ * prefix, so a restarted writer never reuses the name of an earlier capture
+ */
+static uint32_t firstCaptureSequence(const capture_options& options) {
+    size_t slash = options.prefix.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : options.prefix.substr(0, slash);
+    std::string base = (slash == std::string::npos ? options.prefix : options.prefix.substr(slash + 1)) + "-";
+    DIR *entries = opendir(dir.c_str());
+    if (!entries)
+        return 0;
+    uint32_t first = 0;
+    while (struct dirent *entry = readdir(entries)) {
+        if (strncmp(entry->d_name, base.c_str(), base.size()) != 0)
+            continue;
+        const char *digits = entry->d_name + base.size();
+        char *end;
+        unsigned long sequence = strtoul(digits, &end, 10);
+        if (end != digits && isdigit(*digits) && strcmp(end, ".btsnoop") == 0 && sequence < UINT32_MAX
+            && sequence >= first)
+            first = sequence + 1;
+    }
+    closedir(entries);
+    return first;
+}
+
+static void closeCaptureFile(capture_writer *writer) {
+    if (writer->file) {
+        fclose(writer->file);
+        writer->file = nullptr;
+        // The index was accumulated as the records were written, so the file is not read back here
+        if (writer->options.index_interval > 0)
+            writeCaptureIndex(captureFileName(writer->options, writer->sequence - 1).c_str(), writer->index);
+    }
+}
+
+/**
+ * Start the next capture file with the btsnoop header, deleting the oldest file if max_files are kept
+ */
+static bool openCaptureFile(capture_writer *writer) {
+    closeCaptureFile(writer);
+    const capture_options& options = writer->options;
+    uint32_t sequence = writer->sequence ++;
+    if (options.max_files > 0 && sequence >= options.max_files) {
+        std::string oldest = captureFileName(options, sequence - options.max_files);
+        remove(oldest.c_str());
+        if (options.index_interval > 0)
+            remove((oldest + CAPTURE_INDEX_SUFFIX).c_str());
+    }
+
+    // Create the file exclusively, an existing capture of the same name, say from another writer, is never truncated
+    std::string path = captureFileName(options, sequence);
+    writer->file = fopen(path.c_str(), "wbx");
+    if (!writer->file) {
+        LOG_ERROR("Can't create capture file %s, %s(%d)", path.c_str(), strerror(errno), errno);
+        return false;
+    }
+    setvbuf(writer->file, nullptr, _IOFBF, CAPTURE_FILE_BUFFER_SIZE);
+
+    struct btsnoop_hdr hdr;
+    memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
+    hdr.version = htobe32(1);
+    hdr.type = htobe32(BTSNOOP_TYPE_UART);
+    fwrite(&hdr, BTSNOOP_HDR_SIZE, 1, writer->file);
+    writer->fileBytes = BTSNOOP_HDR_SIZE;
+    writer->fileStart = std::chrono::steady_clock::now();
+    if (options.index_interval > 0)
+        resetCaptureIndex(writer->index, options.index_interval);
+    return true;
+}
+
+static bool rotationDue(capture_writer *writer, uint64_t nextBytes) {
+    const capture_options& options = writer->options;
+    if (options.max_file_bytes > 0 && writer->fileBytes > BTSNOOP_HDR_SIZE
+        && writer->fileBytes + nextBytes > options.max_file_bytes)
+        return true;
+    return options.max_file_seconds > 0
+           && std::chrono::steady_clock::now() - writer->fileStart >= std::chrono::seconds(options.max_file_seconds);
+}
+
+/**
+ * The writer thread, which drains the ring into the capture file until the writer is freed
+ */
+static void runCaptureWriter(capture_writer *writer) {
+    spsc_ring_header *header = writer->ring.header;
+    while (true) {
+        // Taken before the empty and running checks, so the ringWake of freeCaptureWriter can't be missed between them
+        uint32_t wakeSeq = ringWakeSeq(header);
+        const spsc_ring_record *record = ringNext(header);
+        if (record == nullptr) {
+            // Check running only once the ring is empty, so the frames queued before freeCaptureWriter are written
+            if (!writer->running.load())
+                break;
+            // Push the buffered frames to the file while idle so the capture is readable during a quiet period
+            if (writer->file)
+                fflush(writer->file);
+            if (!ringWait(header, CAPTURE_IDLE_WAIT_MS, wakeSeq) && writer->file && rotationDue(writer, 0)
+                && writer->fileBytes > BTSNOOP_HDR_SIZE)
+                openCaptureFile(writer);
+            continue;
+        }
+
+        const struct btsnoop_pkt *pkt = (const struct btsnoop_pkt *) record->data;
+        uint64_t size = BTSNOOP_PKT_SIZE + be32toh(pkt->len);
+        if (writer->file == nullptr || rotationDue(writer, size))
+            openCaptureFile(writer);
+        if (writer->file && fwrite(pkt, size, 1, writer->file) == 1) {
+            if (writer->options.index_interval > 0) {
+                struct timeval ts;
+                btsnoopToTimeval(be64toh(pkt->ts), &ts);
+                addCaptureIndexRecord(writer->index, writer->fileBytes, ts.tv_sec * 1000ll + ts.tv_usec / 1000,
+                                      pkt->data, be32toh(pkt->len));
+            }
+            writer->fileBytes += size;
+            writer->written ++;
+        }
+        ringRelease(header, record);
+    }
+    closeCaptureFile(writer);
+}
+
+capture_writer* allocCaptureWriter(const capture_options& options) {
+    capture_writer *writer = new capture_writer;
+    writer->options = options;
+    writer->ringBuffer.resize((SPSC_RING_HEADER_SIZE + options.queue_bytes) / sizeof(uint64_t) + 1);
+    if (!ringInit(writer->ring, writer->ringBuffer.data(), writer->ringBuffer.size() * sizeof(uint64_t),
+                  BTSNOOP_PKT_SIZE + CAPTURE_MAX_FRAME_SIZE)) {
+        LOG_ERROR("Capture queue_bytes(%u) is too small", options.queue_bytes);
+        delete writer;
+        return nullptr;
+    }
+    writer->sequence = firstCaptureSequence(options);
+    if (!openCaptureFile(writer)) {
+        delete writer;
+        return nullptr;
+    }
+    writer->running = true;
+    writer->thread = std::thread(runCaptureWriter, writer);
+    return writer;
+}
+
+void freeCaptureWriter(capture_writer *writer) {
+    writer->running = false;
+    ringWake(writer->ring.header);
+    if (writer->thread.joinable())
+        writer->thread.join();
+    LOG_INFO("capture %s closed, written=%lu, drops=%lu", writer->options.prefix.c_str(), writer->written,
+             captureDrops(writer));
+    delete writer;
+}
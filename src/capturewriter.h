@@ -0,0 +1,108 @@
+#ifndef capturewriter_H
+#define capturewriter_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <sys/time.h>
+#include "dumpfile.h"
+#include "spscring.h"
+#include "captureindex.h"
+
+/**
+ * The settings of a capture_writer
+ */
+typedef struct capture_options {
+    /** The path prefix of the capture files, each file is named prefix-NNNNNN.btsnoop */
+    std::string prefix;
+    /** Start a new file once the current one reaches this size, 0 = no size limit */
+    uint64_t max_file_bytes = 64 * 1024 * 1024;
+    /** Start a new file once the current one has been open this many seconds, 0 = no time limit */
+    uint32_t max_file_seconds = 0;
+    /** The number of files to keep, older files are deleted as new ones are started, 0 = keep all */
+    uint32_t max_files = 0;
+    /** The size in bytes of the queue between the scan thread and the writer thread */
+    uint32_t queue_bytes = 1024 * 1024;
+    /**
+     * Write a sidecar index with this many records per block for each capture file as it is closed, see
+     * captureindex.h, 0 = no index. The index is accumulated as the records are written, so closing a file only
+     * writes out the index and never reads the capture back.
+     */
+    uint32_t index_interval = 0;
+} capture_options;
+
+/**
+ * An asynchronous writer that tees the raw frames seen by a scan loop into rotating btsnoop files. The scan thread
+ * copies each frame into a single producer/single consumer ring, and a background thread writes the ring records
+ * to disk through a buffered FILE. The scan thread never blocks on disk, when the ring is full the frame is dropped
+ * and counted, and the count is recorded in the btsnoop drops field of the following records.
+ */
+typedef struct capture_writer {
+    capture_options options;
+    /** The ring storage and its producer side, the writer thread is the consumer */
+    std::vector<uint64_t> ringBuffer;
+    spsc_ring_producer ring;
+    std::thread thread;
+    std::atomic<bool> running;
+    /** The current file, its sequence number, size and when it was started */
+    FILE *file = nullptr;
+    uint32_t sequence = 0;
+    uint64_t fileBytes = 0;
+    std::chrono::steady_clock::time_point fileStart;
+    /** The index of the current file, when options.index_interval is set */
+    capture_index_builder index;
+    /** The count of frames written to disk */
+    uint64_t written = 0;
+
+    capture_writer() : running(false) {}
+} capture_writer;
+
+/**
+ * Allocate a capture writer and start its writer thread
+ * @return the writer, nullptr if the first capture file could not be created
+ */
+capture_writer* allocCaptureWriter(const capture_options& options);
+
+/**
+ * Write any queued frames, stop the writer thread and release the writer
+ */
+void freeCaptureWriter(capture_writer *writer);
+
+/**
+ * Called on the scan thread to queue a raw HCI frame, starting with its packet type byte, for the writer thread.
+ * Only one thread may queue frames to a writer.
+ * @return false if the queue was full and the frame was dropped
+ */
+static inline bool captureFrame(capture_writer *writer, const uint8_t *data, uint32_t len, uint8_t in,
+                                const struct timeval& ts) {
+    uint8_t *record = ringReserve(writer->ring, SPSC_RING_BTSNOOP_PKT, BTSNOOP_PKT_SIZE + len);
+    if (record == nullptr)
+        return false;
+    // The record is the btsnoop packet header and data exactly as it is written to the file
+    struct btsnoop_pkt *pkt = (struct btsnoop_pkt *) record;
+    uint32_t flags = in ? BTSNOOP_FLAG_RECEIVED : 0;
+    // The HCI_COMMAND_PKT and HCI_EVENT_PKT packet types
+    if (len > 0 && (data[0] == 0x01 || data[0] == 0x04))
+        flags |= BTSNOOP_FLAG_COMMAND_EVENT;
+    pkt->size = htobe32(len);
+    pkt->len = htobe32(len);
+    pkt->flags = htobe32(flags);
+    pkt->drops = htobe32((uint32_t) __atomic_load_n(&writer->ring.header->drops, __ATOMIC_RELAXED));
+    pkt->ts = htobe64(timevalToBtsnoop(&ts));
+    memcpy(pkt->data, data, len);
+    ringPublish(writer->ring);
+    return true;
+}
+
+/**
+ * The count of frames dropped because the writer fell behind
+ */
+static inline uint64_t captureDrops(capture_writer *writer) {
+    return __atomic_load_n(&writer->ring.header->drops, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef dumpfile_H
+#define dumpfile_H
+
+/*
+ *  The capture file record layouts from the bluez tools/hcidump.c
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2000-2002  Maxim Krasnyansky <maxk@qualcomm.com>
+ *  Copyright (C) 2003-2011  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <stdint.h>
+#include <endian.h>
+#include <sys/time.h>
+
+// The capture file formats understood by the file frame sources
+enum dump_format {
+    // Detect the format from the start of the file
+    DUMP_FORMAT_AUTO,
+    // The native hcidump -w format
+    DUMP_FORMAT_HCIDUMP,
+    // The btsnoop format written by hcidump -w -b and the android snoop log
+    DUMP_FORMAT_BTSNOOP,
+    // The Apple PacketLogger format
+    DUMP_FORMAT_PKTLOG
+};
+
+struct hcidump_hdr {
+    uint16_t	len;
+    uint8_t		in;
+    uint8_t		pad;
+    uint32_t	ts_sec;
+    uint32_t	ts_usec;
+} __attribute__ ((packed));
+#define HCIDUMP_HDR_SIZE (sizeof(struct hcidump_hdr))
+
+struct btsnoop_hdr {
+    uint8_t		id[8];		/* Identification Pattern */
+    uint32_t	version;	/* Version Number = 1 */
+    uint32_t	type;		/* Datalink Type */
+} __attribute__ ((packed));
+#define BTSNOOP_HDR_SIZE (sizeof(struct btsnoop_hdr))
+
+struct btsnoop_pkt {
+    uint32_t	size;		/* Original Length */
+    uint32_t	len;		/* Included Length */
+    uint32_t	flags;		/* Packet Flags */
+    uint32_t	drops;		/* Cumulative Drops */
+    uint64_t	ts;		/* Timestamp microseconds */
+    uint8_t		data[0];	/* Packet Data */
+} __attribute__ ((packed));
+#define BTSNOOP_PKT_SIZE (sizeof(struct btsnoop_pkt))
+
+static const uint8_t btsnoop_id[] = { 0x62, 0x74, 0x73, 0x6e, 0x6f, 0x6f, 0x70, 0x00 };
+
+// The btsnoop datalink types, unencapsulated HCI and HCI UART(H4) which prefixes each packet with its type
+#define BTSNOOP_TYPE_HCI 1001
+#define BTSNOOP_TYPE_UART 1002
+
+// The btsnoop_pkt.flags bits
+#define BTSNOOP_FLAG_RECEIVED 0x01
+#define BTSNOOP_FLAG_COMMAND_EVENT 0x02
+
+// The btsnoop timestamp of 2000-01-01 in microseconds since 0AD, and that date in seconds since the unix epoch
+#define BTSNOOP_EPOCH_2000 0x00E03AB44A676000ll
+#define UNIX_EPOCH_2000 946684800ll
+
+struct pktlog_hdr {
+    uint32_t	len;
+    uint64_t	ts;
+    uint8_t		type;
+} __attribute__ ((packed));
+#define PKTLOG_HDR_SIZE (sizeof(struct pktlog_hdr))
+
+/**
+ * Convert a host order btsnoop_pkt.ts to a timeval
+ */
+static inline void btsnoopToTimeval(uint64_t ts, struct timeval *tv) {
+    ts -= BTSNOOP_EPOCH_2000;
+    tv->tv_sec = (ts / 1000000ll) + UNIX_EPOCH_2000;
+    tv->tv_usec = ts % 1000000ll;
+}
+
+/**
+ * Convert a timeval to a host order btsnoop_pkt.ts
+ */
+static inline uint64_t timevalToBtsnoop(const struct timeval *tv) {
+    return (tv->tv_sec - UNIX_EPOCH_2000) * 1000000ll + tv->tv_usec + BTSNOOP_EPOCH_2000;
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef eventbatch_H
+#define eventbatch_H
+
+#include <stdint.h>
+#include <chrono>
+
+// The maximum number of records in a batch delivered to java
+#define EVENT_BATCH_MAX_RECORDS 64
+// The alignment of each record in the batch so the int64_t time fields are naturally aligned
+#define EVENT_BATCH_RECORD_ALIGN 8
+
+/**
+ * The header written at the start of the direct ByteBuffer when events are delivered to java in batches. The
+ * ad_data_inline or beacon_info records follow the header, and java walks them using the offsets[] without
+ * any further native calls.
+ */
+typedef struct event_batch_header {
+    /** The count of records in the batch */
+    uint32_t count;
+    /** The number of bytes of the buffer in use, including this header */
+    uint32_t length;
+    /** The offset of each record from the start of the header */
+    uint32_t offsets[EVENT_BATCH_MAX_RECORDS];
+} event_batch_header;
+
+/**
+ * The native side state of a batch being built in a direct ByteBuffer. A batch is ready to be handed to java once
+ * it holds max_records records, or its first record has waited window_ms.
+ */
+typedef struct event_batch {
+    event_batch_header *header;
+    /** The capacity in bytes of the buffer the header points to */
+    uint64_t capacity;
+    uint32_t max_records;
+    uint32_t window_ms;
+    /** When the first record of the current batch was added */
+    std::chrono::steady_clock::time_point first_time;
+} event_batch;
+
+static inline void batchReset(event_batch& batch) {
+    batch.header->count = 0;
+    batch.header->length = sizeof(event_batch_header);
+}
+
+/**
+ * Setup a batch over buffer.
+ * @return false if the buffer is too small to hold the header and a record of max_record_size
+ */
+static inline bool batchInit(event_batch& batch, void *buffer, uint64_t capacity, uint32_t max_records,
+                             uint32_t window_ms, uint32_t max_record_size) {
+    if (capacity < sizeof(event_batch_header) + max_record_size)
+        return false;
+    if (max_records < 1)
+        max_records = 1;
+    else if (max_records > EVENT_BATCH_MAX_RECORDS)
+        max_records = EVENT_BATCH_MAX_RECORDS;
+    batch.header = (event_batch_header *) buffer;
+    batch.capacity = capacity;
+    batch.max_records = max_records;
+    batch.window_ms = window_ms;
+    batchReset(batch);
+    return true;
+}
+
+/**
+ * Get the location to write the next record of size bytes
+ * @return the record location, nullptr if the batch has no room for the record
+ */
+static inline uint8_t* batchReserve(event_batch& batch, uint32_t size) {
+    event_batch_header *header = batch.header;
+    uint32_t offset = (header->length + EVENT_BATCH_RECORD_ALIGN - 1) & ~(EVENT_BATCH_RECORD_ALIGN - 1);
+    if (header->count >= batch.max_records || offset + size > batch.capacity)
+        return nullptr;
+    return ((uint8_t *) header) + offset;
+}
+
+/**
+ * Add the record of size bytes written to the location returned by batchReserve to the batch
+ */
+static inline void batchCommit(event_batch& batch, uint8_t *record, uint32_t size) {
+    event_batch_header *header = batch.header;
+    uint32_t offset = (uint32_t) (record - (uint8_t *) header);
+    if (header->count == 0)
+        batch.first_time = std::chrono::steady_clock::now();
+    header->offsets[header->count] = offset;
+    header->length = offset + size;
+    header->count ++;
+}
+
+/**
+ * The time in milliseconds until the window of a partial batch expires, counted from its first record, or idleMS for
+ * an empty batch
+ */
+static inline int batchDueMS(const event_batch& batch, uint32_t idleMS) {
+    if (batch.header->count == 0)
+        return (int) idleMS;
+    if (batch.header->count >= batch.max_records)
+        return 0;
+    // The wait so far is rounded down, so the batch is always ready once the returned time has passed
+    int64_t waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()
+                                                                           - batch.first_time).count();
+    return waited >= batch.window_ms ? 0 : (int) (batch.window_ms - waited);
+}
+
+/**
+ * Check whether the batch should be handed to java
+ */
+static inline bool batchReady(const event_batch& batch) {
+    if (batch.header->count == 0)
+        return false;
+    if (batch.header->count >= batch.max_records)
+        return true;
+    return std::chrono::steady_clock::now() - batch.first_time >= std::chrono::milliseconds(batch.window_ms);
+}
+
+#endif
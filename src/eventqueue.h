@@ -0,0 +1,127 @@
+#ifndef eventqueue_H
+#define eventqueue_H
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "hcidumpinternal.h"
+#include "eventbatch.h"
+
+// The size of a queue slot, the maximum ad_data_inline size rounded up to the batch record alignment
+#define EVENT_QUEUE_SLOT_SIZE ((AD_DATA_INLINE_MAX_SIZE + EVENT_BATCH_RECORD_ALIGN - 1) & ~(EVENT_BATCH_RECORD_ALIGN - 1))
+
+/**
+ * A bounded queue of ad_data_inline records that the scanner thread feeds and callers of pollEvents drain. When
+ * the queue is full new events are dropped and counted so the scanner thread never blocks on a slow consumer.
+ */
+typedef struct event_queue {
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    /** Signalled when the last consumer leaves queuePoll of a closed queue */
+    std::condition_variable idle;
+    /** The count of consumers in queuePoll */
+    uint32_t consumers = 0;
+    /** The preallocated slots, capacity * EVENT_QUEUE_SLOT_SIZE bytes */
+    std::vector<uint8_t> slots;
+    uint32_t capacity = 0;
+    /** The index of the oldest record */
+    uint32_t head = 0;
+    /** The count of records in the queue */
+    uint32_t count = 0;
+    /** The count of events dropped because the queue was full */
+    uint64_t drops = 0;
+    bool open = false;
+} event_queue;
+
+/**
+ * Allocate the slots and open the queue for use
+ */
+static inline void queueOpen(event_queue& queue, uint32_t capacity) {
+    std::lock_guard<std::mutex> guard(queue.mutex);
+    if (capacity < 1)
+        capacity = 1;
+    queue.slots.assign((size_t) capacity * EVENT_QUEUE_SLOT_SIZE, 0);
+    queue.capacity = capacity;
+    queue.head = 0;
+    queue.count = 0;
+    queue.drops = 0;
+    queue.open = true;
+}
+
+/**
+ * Close the queue, discarding queued records, and wait for any consumers in queuePoll to return so that the
+ * queue can be released
+ */
+static inline void queueClose(event_queue& queue) {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    queue.open = false;
+    queue.count = 0;
+    std::vector<uint8_t>().swap(queue.slots);
+    queue.notEmpty.notify_all();
+    queue.idle.wait(lock, [&queue] { return queue.consumers == 0; });
+}
+
+/**
+ * Add the ad_data_inline form of an event to the queue
+ * @return false if the queue is closed or full and the event was dropped
+ */
+static inline bool queuePush(event_queue& queue, const ad_data_view& event) {
+    {
+        std::lock_guard<std::mutex> guard(queue.mutex);
+        if (!queue.open)
+            return false;
+        if (queue.count == queue.capacity) {
+            queue.drops ++;
+            return false;
+        }
+        uint32_t tail = (queue.head + queue.count) % queue.capacity;
+        uint8_t *slot = &queue.slots[(size_t) tail * EVENT_QUEUE_SLOT_SIZE];
+        if (writeInline(event, slot, EVENT_QUEUE_SLOT_SIZE) == 0) {
+            queue.drops ++;
+            return false;
+        }
+        queue.count ++;
+    }
+    queue.notEmpty.notify_one();
+    return true;
+}
+
+/**
+ * Move the queued records into batch, waiting up to timeoutMS for at least one record to be available.
+ * @param timeoutMS - the maximum time to wait, 0 = do not wait, < 0 = wait until a record arrives
+ * @return the number of records added to the batch, -1 if the queue is closed
+ */
+static inline int queuePoll(event_queue& queue, event_batch& batch, int64_t timeoutMS) {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    auto available = [&queue] { return queue.count > 0 || !queue.open; };
+    queue.consumers ++;
+    if (timeoutMS < 0)
+        queue.notEmpty.wait(lock, available);
+    else if (timeoutMS > 0)
+        queue.notEmpty.wait_for(lock, std::chrono::milliseconds(timeoutMS), available);
+    queue.consumers --;
+    if (!queue.open) {
+        if (queue.consumers == 0)
+            queue.idle.notify_all();
+        return -1;
+    }
+
+    int count = 0;
+    while (queue.count > 0) {
+        uint8_t *slot = &queue.slots[(size_t) queue.head * EVENT_QUEUE_SLOT_SIZE];
+        uint32_t length = ((ad_data_inline *) slot)->total_length;
+        uint8_t *record = batchReserve(batch, length);
+        if (record == nullptr)
+            break;
+        memcpy(record, slot, length);
+        batchCommit(batch, record, length);
+        queue.head = (queue.head + 1) % queue.capacity;
+        queue.count --;
+        count ++;
+    }
+    return count;
+}
+
+#endif
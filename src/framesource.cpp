@@ -0,0 +1,303 @@
+#include "framesource.h"
+#include "asynclog.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern "C" {
+#ifdef LEGACY_BLUEZ
+// The bluetooth.h header uses an invalid syntax for c++-std11 to map it to __typeof__
+#define typeof __typeof__
+#endif
+#include "parser.h"
+#include <bluetooth.h>
+#include <hci.h>
+}
+
+/*
+    The file reading logic follows the read_dump function from the bluez tools/hcidump.c
+ */
+
+file_frame_source::~file_frame_source() {
+    if (file)
+        fclose(file);
+}
+
+int file_frame_source::open(const char *path, dump_format format) {
+    file = fopen(path, "rb");
+    if (!file) {
+        LOG_ERROR("Can't open dump file: %s", strerror(errno));
+        return -1;
+    }
+    // Records are small, so read the file in large blocks
+    setvbuf(file, nullptr, _IOFBF, 64 * 1024);
+
+    if (format == DUMP_FORMAT_AUTO || format == DUMP_FORMAT_BTSNOOP) {
+        struct btsnoop_hdr hdr;
+        if (fread(&hdr, BTSNOOP_HDR_SIZE, 1, file) == 1 && !memcmp(hdr.id, btsnoop_id, sizeof(btsnoop_id))) {
+            uint32_t version = be32toh(hdr.version);
+            btsnoop_type = be32toh(hdr.type);
+            LOG_INFO("btsnoop version: %d datalink type: %d", version, btsnoop_type);
+            if (version != 1) {
+                LOG_ERROR("Unsupported BTSnoop version: %d", version);
+                return -1;
+            }
+            if (btsnoop_type != BTSNOOP_TYPE_HCI && btsnoop_type != BTSNOOP_TYPE_UART) {
+                LOG_ERROR("Unsupported BTSnoop datalink type: %d", btsnoop_type);
+                return -1;
+            }
+            this->format = DUMP_FORMAT_BTSNOOP;
+            return 0;
+        }
+        if (format == DUMP_FORMAT_BTSNOOP) {
+            LOG_ERROR("%s is not a btsnoop file", path);
+            return -1;
+        }
+        rewind(file);
+    }
+
+    if (format == DUMP_FORMAT_AUTO) {
+        // A pktlog record starts with a big endian length, whose high bytes are zero for any HCI frame, while an
+        // hcidump record starts with the non-zero little endian length
+        uint8_t start[2] = {0xff, 0xff};
+        size_t n = fread(start, 1, sizeof(start), file);
+        format = n == sizeof(start) && start[0] == 0 && start[1] == 0 ? DUMP_FORMAT_PKTLOG : DUMP_FORMAT_HCIDUMP;
+        rewind(file);
+    }
+    this->format = format;
+    return 0;
+}
+
+int file_frame_source::read_header() {
+    switch (format) {
+        case DUMP_FORMAT_BTSNOOP: {
+            struct btsnoop_pkt dp;
+            if (fread(&dp, BTSNOOP_PKT_SIZE, 1, file) != 1)
+                return ferror(file) ? FRAME_SOURCE_ERROR : FRAME_SOURCE_END;
+            uint32_t flags = be32toh(dp.flags);
+            pending_len = be32toh(dp.len);
+            pending_in = flags & BTSNOOP_FLAG_RECEIVED;
+            pending_type = -1;
+            if (btsnoop_type == BTSNOOP_TYPE_HCI) {
+                if (flags & BTSNOOP_FLAG_COMMAND_EVENT)
+                    pending_type = pending_in ? HCI_EVENT_PKT : HCI_COMMAND_PKT;
+                else
+                    pending_type = HCI_ACLDATA_PKT;
+            }
+            btsnoopToTimeval(be64toh(dp.ts), &pending_ts);
+            break;
+        }
+        case DUMP_FORMAT_PKTLOG: {
+            struct pktlog_hdr ph;
+            while (true) {
+                if (fread(&ph, PKTLOG_HDR_SIZE, 1, file) != 1)
+                    return ferror(file) ? FRAME_SOURCE_ERROR : FRAME_SOURCE_END;
+                // The length covers the timestamp and type, which are read with the header
+                uint32_t len = be32toh(ph.len);
+                if (len < PKTLOG_HDR_SIZE - sizeof(ph.len))
+                    return FRAME_SOURCE_ERROR;
+                pending_len = len - (PKTLOG_HDR_SIZE - sizeof(ph.len));
+                switch (ph.type) {
+                    case 0x00:
+                        pending_type = HCI_COMMAND_PKT;
+                        pending_in = 0;
+                        break;
+                    case 0x01:
+                        pending_type = HCI_EVENT_PKT;
+                        pending_in = 1;
+                        break;
+                    case 0x02:
+                        pending_type = HCI_ACLDATA_PKT;
+                        pending_in = 0;
+                        break;
+                    case 0x03:
+                        pending_type = HCI_ACLDATA_PKT;
+                        pending_in = 1;
+                        break;
+                    default:
+                        // Skip the notes and other non-HCI records
+                        skipped ++;
+                        fseek(file, pending_len, SEEK_CUR);
+                        continue;
+                }
+                break;
+            }
+            uint64_t ts = be64toh(ph.ts);
+            pending_ts.tv_sec = ts >> 32;
+            pending_ts.tv_usec = ts & 0xffffffff;
+            break;
+        }
+        default: {
+            struct hcidump_hdr dh;
+            if (fread(&dh, HCIDUMP_HDR_SIZE, 1, file) != 1)
+                return ferror(file) ? FRAME_SOURCE_ERROR : FRAME_SOURCE_END;
+            pending_len = le16toh(dh.len);
+            pending_in = dh.in;
+            pending_type = -1;
+            pending_ts.tv_sec = le32toh(dh.ts_sec);
+            pending_ts.tv_usec = le32toh(dh.ts_usec);
+            break;
+        }
+    }
+    return 1;
+}
+
+int64_t file_frame_source::delay_ms() {
+    if (pending == FRAME_SOURCE_NONE)
+        pending = read_header();
+    if (pending != 1 || pacing == REPLAY_MAX_SPEED)
+        return 0;
+
+    // Schedule each frame relative to the first so the pacing does not drift
+    int64_t ts = pending_ts.tv_sec * 1000000ll + pending_ts.tv_usec;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (first_ts < 0) {
+        first_ts = ts;
+        first_time = now;
+    }
+    double scale = pacing == REPLAY_SCALED && speed > 0 ? speed : 1.0;
+    int64_t dueUS = (int64_t) ((ts - first_ts) / scale);
+    int64_t elapsedUS = std::chrono::duration_cast<std::chrono::microseconds>(now - first_time).count();
+    int64_t delayUS = dueUS - elapsedUS;
+    // Round up so the scan loop does not spin on zero length waits
+    return delayUS > 0 ? (delayUS + 999) / 1000 : 0;
+}
+
+int file_frame_source::read_frame(struct frame *frm, uint32_t capacity) {
+    if (pending == FRAME_SOURCE_NONE)
+        pending = read_header();
+    if (pending != 1)
+        return pending;
+    pending = FRAME_SOURCE_NONE;
+
+    uint8_t *data = frm->data;
+    uint32_t data_len = pending_len;
+    if (pending_type >= 0) {
+        data_len ++;
+        if (data_len <= capacity)
+            *data++ = (uint8_t) pending_type;
+    }
+    if (data_len > capacity) {
+        skipped ++;
+        fseek(file, pending_len, SEEK_CUR);
+        return FRAME_SOURCE_NONE;
+    }
+    if (fread(data, 1, pending_len, file) != pending_len)
+        return ferror(file) ? FRAME_SOURCE_ERROR : FRAME_SOURCE_END;
+
+    frm->data_len = data_len;
+    frm->dev_id = dev;
+    frm->in = pending_in;
+    frm->ts = pending_ts;
+    return 1;
+}
+
+mmap_frame_source::mmap_frame_source(const mmap_frame_source& archive, size_t begin, size_t end, int dev)
+        : dev(dev), base(archive.base), size(archive.size), owner(false), offset(begin), end(end),
+          btsnoop_type(archive.btsnoop_type) {
+}
+
+mmap_frame_source::~mmap_frame_source() {
+    if (base && owner)
+        munmap(base, size);
+}
+
+int mmap_frame_source::open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("Can't open dump file: %s", strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < BTSNOOP_HDR_SIZE) {
+        LOG_ERROR("%s is not a btsnoop file", path);
+        ::close(fd);
+        return -1;
+    }
+    size = st.st_size;
+    // A private writable mapping so the parser may treat the frame data as its own, pages are only copied if written
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR("Can't map dump file: %s", strerror(errno));
+        size = 0;
+        return -1;
+    }
+    base = (uint8_t *) addr;
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    const struct btsnoop_hdr *hdr = (const struct btsnoop_hdr *) base;
+    if (memcmp(hdr->id, btsnoop_id, sizeof(btsnoop_id)) != 0) {
+        LOG_ERROR("%s is not a btsnoop file", path);
+        return -1;
+    }
+    uint32_t version = be32toh(hdr->version);
+    btsnoop_type = be32toh(hdr->type);
+    if (version != 1 || (btsnoop_type != BTSNOOP_TYPE_HCI && btsnoop_type != BTSNOOP_TYPE_UART)) {
+        LOG_ERROR("Unsupported BTSnoop version: %d, datalink type: %d", version, btsnoop_type);
+        return -1;
+    }
+    offset = BTSNOOP_HDR_SIZE;
+    end = size;
+    return 0;
+}
+
+std::vector<size_t> mmap_frame_source::split(size_t chunk_bytes) const {
+    std::vector<size_t> chunks;
+    size_t pos = offset;
+    size_t chunkStart = pos;
+    chunks.push_back(chunkStart);
+    while (end - pos >= BTSNOOP_PKT_SIZE) {
+        const struct btsnoop_pkt *dp = (const struct btsnoop_pkt *) (base + pos);
+        size_t next = pos + BTSNOOP_PKT_SIZE + be32toh(dp->len);
+        // A truncated last record is left in the last chunk for read_frame to count as skipped
+        if (next > end)
+            break;
+        pos = next;
+        if (pos - chunkStart >= chunk_bytes && pos < end) {
+            chunkStart = pos;
+            chunks.push_back(chunkStart);
+        }
+    }
+    chunks.push_back(end);
+    return chunks;
+}
+
+int mmap_frame_source::read_frame(struct frame *frm, uint32_t capacity) {
+    if (end - offset < BTSNOOP_PKT_SIZE)
+        return FRAME_SOURCE_END;
+    const struct btsnoop_pkt *dp = (const struct btsnoop_pkt *) (base + offset);
+    uint32_t len = be32toh(dp->len);
+    if (end - offset - BTSNOOP_PKT_SIZE < len) {
+        // A capture cut off in the middle of its last record
+        skipped ++;
+        offset = end;
+        return FRAME_SOURCE_END;
+    }
+    uint8_t *data = base + offset + BTSNOOP_PKT_SIZE;
+    offset += BTSNOOP_PKT_SIZE + len;
+
+    uint32_t flags = be32toh(dp->flags);
+    frm->in = flags & BTSNOOP_FLAG_RECEIVED;
+    if (btsnoop_type == BTSNOOP_TYPE_UART) {
+        frm->data = data;
+        frm->data_len = len;
+    } else {
+        if (len + 1 > capacity) {
+            skipped ++;
+            return FRAME_SOURCE_NONE;
+        }
+        if (flags & BTSNOOP_FLAG_COMMAND_EVENT)
+            frm->data[0] = frm->in ? HCI_EVENT_PKT : HCI_COMMAND_PKT;
+        else
+            frm->data[0] = HCI_ACLDATA_PKT;
+        memcpy(frm->data + 1, data, len);
+        frm->data_len = len + 1;
+    }
+    frm->dev_id = dev;
+    btsnoopToTimeval(be64toh(dp->ts), &frm->ts);
+    return 1;
+}
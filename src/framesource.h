@@ -0,0 +1,169 @@
+#ifndef framesource_H
+#define framesource_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include "dumpfile.h"
+
+struct frame;
+
+// The frame_source::read_frame results other than a frame being read
+#define FRAME_SOURCE_NONE 0
+#define FRAME_SOURCE_END -1
+#define FRAME_SOURCE_ERROR -2
+
+/**
+ * A source of raw HCI frames for the scan loop, so the same parsing path runs over a live HCI socket or a capture
+ * file. The scan loop polls the pollfd() of a source along with its scan_control, and waits delay_ms() before
+ * reading from a source without a descriptor.
+ */
+class frame_source {
+public:
+    virtual ~frame_source() {}
+
+    /** The descriptor that becomes readable when a frame is available, -1 if the source is paced by delay_ms() */
+    virtual int pollfd() const = 0;
+
+    /** The time in milliseconds until the next frame is due to be read, 0 if it can be read now */
+    virtual int64_t delay_ms() = 0;
+
+    /**
+     * Read the next frame into frm. On entry frm->data points to a buffer of capacity bytes, a source may either
+     * copy the frame into it or point frm->data at the frame in its own storage.
+     * @return 1 when a frame was read, FRAME_SOURCE_NONE if none is available yet, FRAME_SOURCE_END at the end of
+     * the source or FRAME_SOURCE_ERROR on a read failure
+     */
+    virtual int read_frame(struct frame *frm, uint32_t capacity) = 0;
+};
+
+/**
+ * The live frame source that receives frames from a raw HCI socket opened on device dev
+ */
+class socket_frame_source : public frame_source {
+public:
+    socket_frame_source(int dev, int sock) : dev(dev), sock(sock) {}
+
+    int pollfd() const { return sock; }
+    int64_t delay_ms() { return 0; }
+    int read_frame(struct frame *frm, uint32_t capacity);
+
+private:
+    int dev;
+    int sock;
+    uint8_t ctrl[100];
+};
+
+// The pacing of a file_frame_source replay
+enum replay_pacing {
+    // Replay frames as fast as they can be parsed
+    REPLAY_MAX_SPEED,
+    // Replay frames with the gaps between their capture timestamps
+    REPLAY_REAL_TIME,
+    // Replay frames with the gaps between their capture timestamps divided by the replay speed
+    REPLAY_SCALED
+};
+
+/**
+ * A frame source that replays an hcidump, btsnoop or pktlog capture file. The frames keep their capture timestamps,
+ * so the events parsed from them carry the original times regardless of the pacing.
+ */
+class file_frame_source : public frame_source {
+public:
+    file_frame_source(replay_pacing pacing = REPLAY_MAX_SPEED, double speed = 1.0, int dev = 0)
+            : pacing(pacing), speed(speed), dev(dev) {}
+    ~file_frame_source();
+
+    /**
+     * Open the capture file at path, detecting its format from its header when format is DUMP_FORMAT_AUTO
+     * @return 0 on success, -1 if the file could not be opened or is not a supported format
+     */
+    int open(const char *path, dump_format format = DUMP_FORMAT_AUTO);
+
+    int pollfd() const { return -1; }
+    int64_t delay_ms();
+    int read_frame(struct frame *frm, uint32_t capacity);
+
+    dump_format getFormat() const { return format; }
+    /** The count of records skipped because they were of an unknown type or larger than the frame buffer */
+    long getSkipped() const { return skipped; }
+
+private:
+    /** Read the header of the next record into the pending fields */
+    int read_header();
+
+    replay_pacing pacing;
+    double speed;
+    int dev;
+    FILE *file = nullptr;
+    dump_format format = DUMP_FORMAT_AUTO;
+    uint32_t btsnoop_type = 0;
+    long skipped = 0;
+
+    /** The state of the next record, FRAME_SOURCE_NONE until its header has been read */
+    int pending = FRAME_SOURCE_NONE;
+    /** The HCI packet type byte to prefix the record data with, or -1 if the data includes it */
+    int pending_type = -1;
+    uint32_t pending_len = 0;
+    uint8_t pending_in = 0;
+    struct timeval pending_ts;
+
+    /** The capture time of the first frame in microseconds, and when it was replayed */
+    int64_t first_ts = -1;
+    std::chrono::steady_clock::time_point first_time;
+};
+
+/**
+ * A frame source for fast offline analysis that maps a btsnoop capture file into memory and hands out its records
+ * in place. Frames of the HCI UART datalink type are not copied at all, frm->data points into the mapping, so the
+ * scan loop reads the archive with no system calls per record. The unencapsulated HCI datalink type lacks the packet
+ * type byte the parser expects, so those frames are copied behind a type byte. Frames are read as fast as they can
+ * be parsed and the whole file is mapped, so a 64 bit process is needed for multi-gigabyte captures.
+ */
+class mmap_frame_source : public frame_source {
+public:
+    mmap_frame_source(int dev = 0) : dev(dev) {}
+    /**
+     * A source over the records in [begin, end) of the already open archive, sharing its mapping. The offsets must
+     * be record aligned, for example as returned by split(), and the archive must outlive this source.
+     */
+    mmap_frame_source(const mmap_frame_source& archive, size_t begin, size_t end, int dev = 0);
+    ~mmap_frame_source();
+
+    /**
+     * Map the btsnoop capture file at path
+     * @return 0 on success, -1 if the file could not be mapped or is not a supported btsnoop file
+     */
+    int open(const char *path);
+
+    int pollfd() const { return -1; }
+    int64_t delay_ms() { return 0; }
+    int read_frame(struct frame *frm, uint32_t capacity);
+
+    /**
+     * Split the records of the archive into consecutive chunks of about chunk_bytes. This walks the record headers,
+     * so it touches every page of the mapping, but does not parse the records.
+     * @return the record aligned offsets of the start of each chunk followed by the end offset
+     */
+    std::vector<size_t> split(size_t chunk_bytes) const;
+
+    /** The count of records skipped because they were truncated or larger than the frame buffer */
+    long getSkipped() const { return skipped; }
+    /** The file offset of the next record */
+    size_t getOffset() const { return offset; }
+
+private:
+    int dev;
+    uint8_t *base = nullptr;
+    size_t size = 0;
+    /** Whether this source mapped base and so unmaps it */
+    bool owner = true;
+    /** The offset of the next record in the mapping, and the offset its records end at */
+    size_t offset = 0;
+    size_t end = 0;
+    uint32_t btsnoop_type = 0;
+    long skipped = 0;
+};
+
+#endif
@@ -1,4 +1,7 @@
 #include "hcidumpinternal.h"
+#include "framesource.h"
+#include "capturewriter.h"
+#include "signatureclassifier.h"
 
 /*
  *  Code from the bluez tools/hcidump.c
@@ -34,12 +37,18 @@
 #include <string.h>
 #include <getopt.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <linux/filter.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <ctype.h>
+#include <mutex>
 #include <condition_variable>
+#include <chrono>
 
 extern "C" {
 #ifdef LEGACY_BLUEZ
@@ -55,6 +64,10 @@ extern "C" {
 }
 
 #define SNAP_LEN	HCI_MAX_FRAME_SIZE
+/* Size of the control message buffer that receives the direction and timestamp */
+#define CTRL_LEN	100
+/* Upper bound on the number of frames drained by a single recvmmsg() */
+#define MAX_BATCH_SIZE	64
 
 /* Modes */
 enum {
@@ -65,10 +78,8 @@ enum {
     AUDIO
 };
 
-// A stop flag
-bool stop_scan_frames = false;
-std::mutex exitLoopMutex;
-std::condition_variable exitLoopCV;
+// The stop signal of scan loops that are not given their own scan_control
+static scan_control legacyControl;
 
 // Debug mode flag
 bool hcidumpDebugMode = false;
@@ -76,45 +87,23 @@ bool hcidumpDebugMode = false;
 /* Default options */
 static int  snap_len = SNAP_LEN;
 
-struct hcidump_hdr {
-    uint16_t	len;
-    uint8_t		in;
-    uint8_t		pad;
-    uint32_t	ts_sec;
-    uint32_t	ts_usec;
-} __attribute__ ((packed));
-#define HCIDUMP_HDR_SIZE (sizeof(struct hcidump_hdr))
-
-struct btsnoop_hdr {
-    uint8_t		id[8];		/* Identification Pattern */
-    uint32_t	version;	/* Version Number = 1 */
-    uint32_t	type;		/* Datalink Type */
-} __attribute__ ((packed));
-#define BTSNOOP_HDR_SIZE (sizeof(struct btsnoop_hdr))
-
-struct btsnoop_pkt {
-    uint32_t	size;		/* Original Length */
-    uint32_t	len;		/* Included Length */
-    uint32_t	flags;		/* Packet Flags */
-    uint32_t	drops;		/* Cumulative Drops */
-    uint64_t	ts;		/* Timestamp microseconds */
-    uint8_t		data[0];	/* Packet Data */
-} __attribute__ ((packed));
-#define BTSNOOP_PKT_SIZE (sizeof(struct btsnoop_pkt))
-
-static uint8_t btsnoop_id[] = { 0x62, 0x74, 0x73, 0x6e, 0x6f, 0x6f, 0x70, 0x00 };
-
-static uint32_t btsnoop_version = 0;
-static uint32_t btsnoop_type = 0;
-
-struct pktlog_hdr {
-    uint32_t	len;
-    uint64_t	ts;
-    uint8_t		type;
-} __attribute__ ((packed));
-#define PKTLOG_HDR_SIZE (sizeof(struct pktlog_hdr))
-
-static int open_socket(int dev)
+/*
+ * Classic BPF program run by the kernel on each frame queued to the raw HCI socket. The frame starts with the HCI
+ * packet type, followed by the event code, parameter length and, for an LE meta event, the subevent code. LE meta
+ * events other than advertising reports are dropped, everything else is passed up.
+ */
+static struct sock_filter le_adv_report_insns[] = {
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, HCI_EVENT_PKT, 0, 5),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 1),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, EVT_LE_META_EVENT, 0, 3),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 1 + HCI_EVENT_HDR_SIZE),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, EVT_LE_ADVERTISING_REPORT, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+};
+
+static int open_socket(int dev, const scan_options& options)
 {
     struct sockaddr_hci addr;
     struct hci_filter flt;
@@ -123,38 +112,51 @@ static int open_socket(int dev)
     /* Create HCI socket */
     sk = socket(AF_BLUETOOTH, SOCK_RAW, BTPROTO_HCI);
     if (sk < 0) {
-        perror("Can't create raw socket");
+        LOG_ERROR("Can't create raw socket: %s", strerror(errno));
         return -1;
     }
 
     opt = 1;
     if (setsockopt(sk, SOL_HCI, HCI_DATA_DIR, &opt, sizeof(opt)) < 0) {
-        perror("Can't enable data direction info");
+        LOG_ERROR("Can't enable data direction info: %s", strerror(errno));
         return -1;
     }
 
     opt = 1;
     if (setsockopt(sk, SOL_HCI, HCI_TIME_STAMP, &opt, sizeof(opt)) < 0) {
-        perror("Can't enable time stamp");
+        LOG_ERROR("Can't enable time stamp: %s", strerror(errno));
         return -1;
     }
 
     /* Setup filter */
     hci_filter_clear(&flt);
-    hci_filter_all_ptypes(&flt);
-    hci_filter_all_events(&flt);
+    if (options.le_meta_only) {
+        hci_filter_set_ptype(HCI_EVENT_PKT, &flt);
+        hci_filter_set_event(EVT_LE_META_EVENT, &flt);
+    } else {
+        hci_filter_all_ptypes(&flt);
+        hci_filter_all_events(&flt);
+    }
     if (setsockopt(sk, SOL_HCI, HCI_FILTER, &flt, sizeof(flt)) < 0) {
-        perror("Can't set filter");
+        LOG_ERROR("Can't set filter: %s", strerror(errno));
         return -1;
     }
 
+    /* The socket filter is only an optimization, so scanning continues without it */
+    if (options.adv_reports_only) {
+        struct sock_fprog prog;
+        prog.len = sizeof(le_adv_report_insns) / sizeof(le_adv_report_insns[0]);
+        prog.filter = le_adv_report_insns;
+        if (setsockopt(sk, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+            LOG_ERROR("Can't attach advertising report socket filter: %s", strerror(errno));
+    }
+
     /* Bind socket to the HCI device */
     memset(&addr, 0, sizeof(addr));
     addr.hci_family = AF_BLUETOOTH;
     addr.hci_dev = dev;
     if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
-        printf("Can't attach to device hci%d. %s(%d)\n",
-                dev, strerror(errno), errno);
+        LOG_ERROR("Can't attach to device hci%d. %s(%d)", dev, strerror(errno), errno);
         return -1;
     }
 
@@ -283,81 +285,33 @@ static const char *evttype2str(uint8_t type)
     }
 }
 
-char toHexChar(int b) {
-    char c = '0';
-    if(b < 10)
-        c = '0' + b;
-    else
-        c = 'A' + b - 10;
-    return c;
-}
-static inline void print_bytes(uint8_t *data, u_int8_t len) {
-    int n;
-    printf("{");
-    for(n = 0; n < len; n ++) {
-        printf("0x%x,", data[n]);
-    }
-    printf("};\n");
-}
-static inline void hex_debug(int level, struct frame *frm)
-{
-    unsigned char *buf = (unsigned char*) frm->ptr;
-    register int i, n;
-    int num = frm->len;
-
-    for (i = 0, n = 1; i < num; i++, n++) {
-        if (n == 1)
-            p_indent(level, frm);
-        printf("%2.2X ", buf[i]);
-        if (n == DUMP_WIDTH) {
-            printf("\n");
-            n = 0;
-        }
-    }
-    if (i && n != 1)
-        printf("\n");
-}
-
-static inline void dump_ads(ad_structure& ads) {
-    printf("ADS(%x:%d): ", ads.type, ads.length);
-    for(int n = 0; n < ads.length; n ++)
-        printf("%.02x", ads.data[n]);
-    printf("\n");
-}
-
 /**
-* Parse the AD Structure values found in the AD payload
+* Parse the AD Structure values found in the AD payload into views of the frame buffer
 */
-static inline void ext_inquiry_data_dump(int level, struct frame *frm, uint8_t *data, ad_data& info) {
-    ad_structure *adsPtr;
-    char *str;
-    int i;
-
+static inline void ext_inquiry_data_dump(int level, struct frame *frm, uint8_t *data, ad_data_view& info) {
     int length = data[0];
-    adsPtr = (ad_structure *) malloc(length+2);
-    adsPtr->type = data[1];
-    // Do not include the checksum
-    adsPtr->length = length-1;
-    info.data.push_back(adsPtr);
+    // A zero length marks the end of the significant part of the payload
+    if (length == 0)
+        return;
+    if (info.count >= MAX_AD_STRUCTURES) {
+        LOG_DEBUG("Dropping AD structure, more than %d in event", MAX_AD_STRUCTURES);
+        return;
+    }
+    ad_structure_view& ads = info.data[info.count++];
+    ads.type = data[1];
+    // The length includes the type field
+    ads.length = length-1;
+    data += 2;
+    ads.offset = (uint16_t) (data - info.buffer);
     if (length <= 1)
         return;
 
-    ad_structure& ads = *adsPtr;
-    data += 2;
-    memcpy(ads.data, data, ads.length);
-    if(hcidumpDebugMode)
-        dump_ads(ads);
+    LOG_DEBUG("ADS(%x:%d): %s", ads.type, ads.length, logHex(data, ads.length));
 
     // Just for debugging
     switch (ads.type) {
         case 0x01:
-        if(hcidumpDebugMode) {
-            p_indent(level, frm);
-            printf("Flags:");
-            for (i = 0; i < ads.length; i++)
-                printf(" 0x%2.2x", data[i]);
-            printf("\n");
-        }
+            LOG_DEBUG("Flags: %s", logHex(data, ads.length));
             break;
 
         case 0x02:
@@ -368,111 +322,83 @@ static inline void ext_inquiry_data_dump(int level, struct frame *frm, uint8_t *
             // incomplete/complete List of 32-bit Service Class UUIDs
         case 0x06:
         case 0x07:
-            if(hcidumpDebugMode) {
-                // incomplete/complete List of 128-bit Service Class UUIDs
-                p_indent(level, frm);
-                printf("%s service classes:", ads.type == 0x06 ? "Incomplete" : "Complete");
-                for (i = 0; i < ads.length / 2; i++)
-                    printf(" 0x%4.4x", bt_get_le16(data + i * 2));
-                printf("\n");
-            }
+            // incomplete/complete List of 128-bit Service Class UUIDs
+            LOG_DEBUG("%s service classes: %s", ads.type % 2 == 0 ? "Incomplete" : "Complete",
+                      logHex(data, ads.length));
             break;
 
         case 0x08:
         case 0x09:
-            if(hcidumpDebugMode) {
-                str = (char *) malloc(ads.length + 1);
-                if (str) {
-                    snprintf(str, ads.length + 1, "%s", (char *) data);
-                    for (i = 0; i < ads.length; i++)
-                        if (!isprint(str[i]))
-                            str[i] = '.';
-                    p_indent(level, frm);
-                    printf("%s local name: \'%s\'",
-                           ads.type == 0x08 ? "Shortened" : "Complete", str);
-                    for (i = 0; i < ads.length; i++)
-                        printf(" 0x%2.2x", data[i]);
-                    printf("\n");
-                    free(str);
-                }
+            if(logEnabled(LOG_LEVEL_DEBUG)) {
+                // An AD structure holds at most 255 bytes, so the name is copied to the stack
+                char name[256];
+                int i;
+                for (i = 0; i < ads.length && data[i] != 0; i++)
+                    name[i] = isprint(data[i]) ? data[i] : '.';
+                name[i] = 0;
+                LOG_DEBUG("%s local name: '%s' %s", ads.type == 0x08 ? "Shortened" : "Complete", name,
+                          logHex(data, ads.length));
             }
             break;
 
         case 0x0a: {
             uint8_t power = *data;
-            if (hcidumpDebugMode) {
-                p_indent(level, frm);
-                printf("TX power level: %d\n", power);
-            }
+            LOG_DEBUG("TX power level: %d", power);
         }
             break;
         case 0x12:
             //  Slave Connection Interval Range sent by Gimbals
-            if(hcidumpDebugMode) {
-                p_indent(level, frm);
-                printf("Slave Connection Interval Range %d bytes data\n", ads.length);
-            }
+            LOG_DEBUG("Slave Connection Interval Range %d bytes data", ads.length);
             break;
 
         case 0x16:
-            if(hcidumpDebugMode) {
-                    printf("ServiceData16(%x %x), len=%d", data[0], data[1], ads.length);
-                for (i = 2; i < ads.length; i++)
-                    printf(" 0x%2.2x", data[i]);
-                printf("\n");
-            }
+            LOG_DEBUG("ServiceData16(%x %x), len=%d %s", data[0], data[1], ads.length,
+                      logHex(data + 2, ads.length > 2 ? ads.length - 2 : 0));
             break;
         case 0xff:
-
-            if(hcidumpDebugMode) {
-                p_indent(level, frm);
-                printf("ManufacturerData(%d bytes), valid=%d:", ads.length, ads.length >= MIN_MANUFACTURER_DATA_SIZE);
-                print_bytes(data, ads.length);
-                hex_debug(level, frm);
-            }
+            LOG_DEBUG("ManufacturerData(%d bytes), valid=%d: %s", ads.length, ads.length >= MIN_MANUFACTURER_DATA_SIZE,
+                      logHex(data, ads.length));
             break;
 
         default:
-            p_indent(level, frm);
-            printf("Unknown type 0x%02x with %d bytes data\n", ads.type, ads.length);
-            if(hcidumpDebugMode) {
-                print_bytes(data, ads.length);
-                hex_debug(level, frm);
-            }
+            LOG_DEBUG("Unknown type 0x%02x with %d bytes data: %s", ads.type, ads.length, logHex(data, ads.length));
             break;
     }
 }
 
-static inline void evt_le_advertising_report_dump(int level, struct frame *frm, ad_data& packet)
+static inline int evt_le_advertising_report_dump(int level, struct frame *frm, ad_data_view& packet)
 {
-    uint8_t num_reports = get_u8(frm);
     const uint8_t RSSI_SIZE = 1;
+    if (frm->len < 1)
+        return PARSE_ERROR;
+    uint8_t num_reports = get_u8(frm);
 
     while (num_reports--) {
         char addr[18];
         le_advertising_info *info = (le_advertising_info *) frm->ptr;
         int offset = 0;
 
-        p_ba2str(&info->bdaddr, addr);
+        // A report cut short of its data and rssi
+        if (frm->len < LE_ADVERTISING_INFO_SIZE
+            || frm->len < (uint32_t) (LE_ADVERTISING_INFO_SIZE + info->length + RSSI_SIZE))
+            return PARSE_ERROR;
+
         packet.bdaddr_type = info->bdaddr_type;
         memcpy(packet.bdaddr, &info->bdaddr, sizeof(packet.bdaddr));
 
-        if(hcidumpDebugMode) {
-            p_indent(level, frm);
-            printf("%s (%d)\n", evttype2str(info->evt_type), info->evt_type);
-
-            p_indent(level, frm);
-            printf("bdaddr %s (%s)\n", addr, bdaddrtype2str(info->bdaddr_type));
+        if(logEnabled(LOG_LEVEL_DEBUG)) {
+            p_ba2str(&info->bdaddr, addr);
+            LOG_DEBUG("%s (%d)", evttype2str(info->evt_type), info->evt_type);
+            LOG_DEBUG("bdaddr %s (%s)", addr, bdaddrtype2str(info->bdaddr_type));
         }
 #ifdef FULL_DEBUG
-        printf("Debug(%d): [", info->length);
-        for(int n = 0; n < info->length; n ++) {
-            printf("%x", info->data[n]);
-        }
-        printf("]\n");
+        LOG_DEBUG("Debug(%d): [%s]", info->length, logHex(info->data, info->length));
 #endif
         while (offset < info->length) {
             int eir_data_len = info->data[offset];
+            // Stop on an AD structure that claims more data than is in the report
+            if (offset + eir_data_len + 1 > info->length)
+                break;
 
             ext_inquiry_data_dump(level, frm, &info->data[offset], packet);
 
@@ -486,17 +412,17 @@ static inline void evt_le_advertising_report_dump(int level, struct frame *frm,
         packet.time *= 1000;
         packet.time += frm->ts.tv_usec/1000;
         packet.rssi = ((int8_t *) frm->ptr)[frm->len - 1];
-        if(hcidumpDebugMode) {
-            p_indent(level, frm);
-            printf("RSSI: %d\n", packet.rssi);
-        }
+        LOG_DEBUG("RSSI: %d", packet.rssi);
         frm->ptr += RSSI_SIZE;
         frm->len -= RSSI_SIZE;
     }
+    return PARSE_ADV_REPORT;
 }
 
-static inline void le_meta_ev_dump(int level, struct frame *frm, ad_data& info)
+static inline int le_meta_ev_dump(int level, struct frame *frm, ad_data_view& info)
 {
+    if (frm->len < EVT_LE_META_EVENT_SIZE)
+        return PARSE_ERROR;
     evt_le_meta_event *mevt = (evt_le_meta_event *) frm->ptr;
     uint8_t subevent;
 
@@ -505,49 +431,46 @@ static inline void le_meta_ev_dump(int level, struct frame *frm, ad_data& info)
     frm->ptr += EVT_LE_META_EVENT_SIZE;
     frm->len -= EVT_LE_META_EVENT_SIZE;
 
-    if(hcidumpDebugMode) {
-        p_indent(level, frm);
-        printf("%s\n", ev_le_meta_str[subevent]);
-    }
+    if(subevent <= LE_EV_NUM)
+        LOG_DEBUG("%s", ev_le_meta_str[subevent]);
+    int status = PARSE_SKIPPED;
     switch (mevt->subevent) {
         case EVT_LE_CONN_COMPLETE:
             //evt_le_conn_complete_dump(level + 1, frm);
-            printf("Skipping EVT_LE_CONN_COMPLETE\n");
+            LOG_DEBUG("Skipping EVT_LE_CONN_COMPLETE");
             break;
         case EVT_LE_ADVERTISING_REPORT:
-            evt_le_advertising_report_dump(level + 1, frm, info);
+            status = evt_le_advertising_report_dump(level + 1, frm, info);
             break;
         case EVT_LE_CONN_UPDATE_COMPLETE:
             //evt_le_conn_update_complete_dump(level + 1, frm);
-            printf("Skipping EVT_LE_CONN_UPDATE_COMPLETE\n");
+            LOG_DEBUG("Skipping EVT_LE_CONN_UPDATE_COMPLETE");
             break;
         case EVT_LE_READ_REMOTE_USED_FEATURES_COMPLETE:
             //evt_le_read_remote_used_features_complete_dump(level + 1, frm);
-            printf("Skipping EVT_LE_READ_REMOTE_USED_FEATURES_COMPLETE\n");
+            LOG_DEBUG("Skipping EVT_LE_READ_REMOTE_USED_FEATURES_COMPLETE");
             break;
         default:
-            hex_debug(level, frm);
+            LOG_DEBUG("Skipping LE subevent 0x%2.2x: %s", subevent, logHex(frm->ptr, frm->len));
+            status = PARSE_UNKNOWN;
             break;
     }
+    return status;
 }
 
-static inline void event_dump(int level, struct frame *frm, ad_data& info)
+static inline int event_dump(int level, struct frame *frm, ad_data_view& info)
 {
+    if (frm->len < HCI_EVENT_HDR_SIZE)
+        return PARSE_ERROR;
     hci_event_hdr *hdr = (hci_event_hdr *)frm->ptr;
     uint8_t event = hdr->evt;
 
-    if (event <= EVENT_NUM) {
-        if(hcidumpDebugMode) {
-            p_indent(level, frm);
-            printf("HCI Event: %s (0x%2.2x) plen %d\n", event_str[hdr->evt], hdr->evt, hdr->plen);
-        }
-    } else if (hdr->evt == EVT_TESTING) {
-        p_indent(level, frm);
-        printf("HCI Event: Testing (0x%2.2x) plen %d\n", hdr->evt, hdr->plen);
-    } else {
-        p_indent(level, frm);
-        printf("HCI Event: code 0x%2.2x plen %d\n", hdr->evt, hdr->plen);
-    }
+    if (event <= EVENT_NUM)
+        LOG_DEBUG("HCI Event: %s (0x%2.2x) plen %d", event_str[hdr->evt], hdr->evt, hdr->plen);
+    else if (hdr->evt == EVT_TESTING)
+        LOG_DEBUG("HCI Event: Testing (0x%2.2x) plen %d", hdr->evt, hdr->plen);
+    else
+        LOG_DEBUG("HCI Event: code 0x%2.2x plen %d", hdr->evt, hdr->plen);
 
     frm->ptr += HCI_EVENT_HDR_SIZE;
     frm->len -= HCI_EVENT_HDR_SIZE;
@@ -561,287 +484,791 @@ static inline void event_dump(int level, struct frame *frm, ad_data& info)
 
     switch (event) {
         case EVT_LOOPBACK_COMMAND:
-            printf("Skipping EVT_LOOPBACK_COMMAND\n");
-            break;
+            LOG_DEBUG("Skipping EVT_LOOPBACK_COMMAND");
+            return PARSE_SKIPPED;
         case EVT_CMD_COMPLETE:
-            printf("Skipping EVT_CMD_COMPLETE\n");
-            break;
+            LOG_DEBUG("Skipping EVT_CMD_COMPLETE");
+            return PARSE_SKIPPED;
         case EVT_LE_META_EVENT:
-            le_meta_ev_dump(level + 1, frm, info);
-            break;
+            return le_meta_ev_dump(level + 1, frm, info);
 
         default:
-            printf("Skipping event=%d\n", event);
-            raw_dump(level+1, frm);
-            break;
+            LOG_DEBUG("Skipping event=%d: %s", event, logHex(frm->ptr, frm->len));
+            return PARSE_UNKNOWN;
     }
 }
 
-static inline void extractBeaconInfo(ad_structure& ads, beacon_info *info) {
+/*
+    The parse functions only use the frame and the ad_data_view they are passed, and their debug logging only
+    queues records to the logger, so frames may be parsed concurrently.
+ */
+static int do_parse(struct frame *frm, ad_data_view& info) {
+    if (frm->len < 1)
+        return PARSE_ERROR;
+    uint8_t type = *(uint8_t *)frm->ptr;
 
-    uint8_t *data = ads.data;
-    // Get the manufacturer code from the first two octets
-    int index = 0;
-    info->manufacturer = 256 * data[index++] + data[index++];
+    frm->ptr++; frm->len--;
+    switch (type) {
+        case HCI_EVENT_PKT:
+            return event_dump(0, frm, info);
 
-    // Get the first octet of the beacon code
-    info->code = 256 * data[index++] + data[index++];
+        default:
+            LOG_DEBUG("Unknown: type 0x%2.2x len %d: %s", type, frm->len, logHex(frm->ptr, frm->len));
+            return PARSE_UNKNOWN;
+    }
+}
+
+int parse_frame(struct frame *frm, ad_data_view& event) {
+    // Only the header fields are reset, the data[] views are filled in as the frame is parsed
+    event.dev_id = frm->dev_id;
+    event.buffer = frm->data;
+    event.count = 0;
+    event.time = 0;
+    frm->ptr = frm->data;
+    frm->len = frm->data_len;
+    int status = do_parse(frm, event);
+    // An advertising report is only complete once its time has been set
+    if (status == PARSE_ADV_REPORT && event.time <= 0)
+        status = PARSE_SKIPPED;
+    return status;
+}
 
-    // Get the proximity uuid
-    int n;
-    for(n = 0; n < 2*UUID_SIZE; n += 2, index ++) {
-        int b0 = (data[index] & 0xf0) >> 4;
-        int b1 = data[index] & 0x0f;
-        char c0 = toHexChar(b0);
-        char c1 = toHexChar(b1);
-        info->uuid[n] = c0;
-        info->uuid[n+1] = c1;
+/**
+ * Pull the packet direction and kernel timestamp out of the control messages of a received frame. A socket that
+ * delivers no timestamp, such as a socketpair carrying synthetic frames, has its frames stamped with the current time.
+ */
+static inline void process_cmsgs(struct msghdr *msg, struct frame *frm) {
+    bool stamped = false;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+    while (cmsg) {
+        int dir;
+        switch (cmsg->cmsg_type) {
+            case HCI_CMSG_DIR:
+                memcpy(&dir, CMSG_DATA(cmsg), sizeof(int));
+                frm->in = (uint8_t) dir;
+                break;
+            case HCI_CMSG_TSTAMP:
+                memcpy(&frm->ts, CMSG_DATA(cmsg), sizeof(struct timeval));
+                stamped = true;
+                break;
+        }
+        cmsg = CMSG_NXTHDR(msg, cmsg);
     }
-    // null terminate the 2*UUID_SIZE bytes that make up the uuid string
-    info->uuid[2*UUID_SIZE] = '\0';
-    // Get the beacon major id
-    int m0 = data[index++];
-    int m1 = data[index++];
-    info->major = 256 * m0 + m1;
-    printf("Major: %d\n", info->major);
-    // Get the beacon minor id
-    m0 = data[index++];
-    m1 = data[index++];
-    info->minor = 256 * m0 + m1;
-    // Get the transmitted power, which is encoded as the 2's complement of the calibrated Tx Power
-    info->calibrated_power = data[index] - 256;
+    if (!stamped)
+        gettimeofday(&frm->ts, nullptr);
 }
 
-static void do_parse(struct frame *frm, ad_data& info) {
-    uint8_t type = *(uint8_t *)frm->ptr;
+/**
+ * The poll timeout of a scan loop. The loop only needs to wake up on a timeout to run the idle_callback, stop and
+ * other requests wake it through the scan_control.wakefd.
+ */
+static inline int scan_timeout(const scan_options& options) {
+    if (!options.idle_callback)
+        return -1;
+    return options.idle_due_ms ? options.idle_due_ms() : (int) options.idle_timeout_ms;
+}
 
-    frm->ptr++; frm->len--;
-    switch (type) {
-        case HCI_EVENT_PKT:
-            event_dump(0, frm, info);
-            break;
+/**
+ * Called when the scan_control.wakefd is readable to handle the posted stop and SCAN_REQUEST_* requests
+ * @return true if the scan loop should exit
+ */
+static inline bool handle_requests(scan_control& control, const scan_options& options) {
+    uint32_t requests = takeRequests(control);
+    if (control.stop)
+        return true;
+    if (requests && options.request_callback)
+        return options.request_callback(requests);
+    return false;
+}
 
-        default:
-            p_indent(0, frm);
-            printf("Unknown: type 0x%2.2x len %d\n", type, frm->len);
-            hex_debug(0, frm);
-            break;
+/**
+ * Tee a received frame to the options.capture writer if there is one, and then parse it and pass any advertising
+ * event to the callback.
+ * @return the stop indicator returned by the callback
+ */
+static inline bool dispatch_frame(struct frame *frm, long frameNo, const scan_options& options,
+                                  std::function<bool(ad_data_view&)>& callback) {
+    bool stop = false;
+
+    if(options.capture)
+        captureFrame(options.capture, frm->data, frm->data_len, frm->in, frm->ts);
+
+    LOG_DEBUG("Begin do_parse(ts=%ld.%06ld)#%ld", frm->ts.tv_sec, frm->ts.tv_usec, frameNo);
+    scan_latency *latency = options.latency;
+    uint64_t parseStart = 0;
+    if(latency) {
+        // The kernel stamps frames with the wall clock to the us, so only this stage is measured against it
+        int64_t delay = latencyRealtimeNow() - (frm->ts.tv_sec * 1000000000ll + frm->ts.tv_usec * 1000ll);
+        latencyRecord(latency->histograms[LATENCY_KERNEL_TO_PARSE], delay > 0 ? delay : 0);
+        parseStart = statsNow();
     }
+    ad_data_view event;
+    int status = parse_frame(frm, event);
+    if(latency)
+        latencyRecord(latency->histograms[LATENCY_PARSE], statsNow() - parseStart);
+    if(options.stats) {
+        scan_stats& stats = *options.stats;
+        statsBeginUpdate(stats);
+        statsAdd(stats.frames, 1);
+        statsAdd(stats.bytes, frm->data_len);
+        if(status == PARSE_ADV_REPORT) {
+            statsAdd(stats.adv_reports, 1);
+            statsAdd(stats.ad_structures, event.count);
+        } else if(status == PARSE_ERROR)
+            statsAdd(stats.parse_errors, 1);
+        else if(status == PARSE_UNKNOWN)
+            statsAdd(stats.unknown_events, 1);
+        statsEndUpdate(stats);
+    }
+    if(status == PARSE_ADV_REPORT) {
+        if(options.stats || latency) {
+            uint64_t start = statsNow();
+            stop = callback(event);
+            uint64_t elapsed = statsNow() - start;
+            if(options.stats) {
+                // Updated after the callback so a slow callback never holds up readers
+                statsBeginUpdate(*options.stats);
+                statsAdd(options.stats->callback_ns, elapsed);
+                statsEndUpdate(*options.stats);
+            }
+            if(latency)
+                latencyRecord(latency->histograms[LATENCY_CALLBACK], elapsed);
+        } else
+            stop = callback(event);
+    }
+    LOG_DEBUG("End do_parse(info.time=%lld, ad.count=%d)", event.time, event.count);
+    return stop;
+}
+
+int socket_frame_source::read_frame(struct frame *frm, uint32_t capacity) {
+    struct msghdr msg;
+    struct iovec  iv;
+
+    memset(&msg, 0, sizeof(msg));
+    iv.iov_base = frm->data;
+    iv.iov_len  = capacity;
+
+    msg.msg_iov = &iv;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    int len = recvmsg(sock, &msg, MSG_DONTWAIT);
+    if (len < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return FRAME_SOURCE_NONE;
+        LOG_ERROR("Receive failed: %s", strerror(errno));
+        return FRAME_SOURCE_ERROR;
+    }
+
+    /* Process control message */
+    frm->data_len = len;
+    frm->dev_id = dev;
+    frm->in = 0;
+    process_cmsgs(&msg, frm);
+    return 1;
+}
+
+/**
+ * The poll timeout for the next frame of a source. A source without a descriptor is waited on until its next frame
+ * is due, but no longer than the idle timeout so that the idle_callback still runs during long gaps in a replay.
+ */
+static inline int source_timeout(frame_source& source, const scan_options& options) {
+    if (source.pollfd() >= 0)
+        return scan_timeout(options);
+    int64_t delay = source.delay_ms();
+    int idle = scan_timeout(options);
+    if (idle >= 0 && delay > idle)
+        return idle;
+    return delay > INT_MAX ? INT_MAX : (int) delay;
 }
 
 /*
-    This is the process_frames function from hcidump.c with the addition of the beacon_event callback
+    The scan loop over a generic frame_source, derived from the process_frames function from hcidump.c. A source
+    with a descriptor is polled along with the scan_control wakefd. A source without one is paced by waiting on the
+    wakefd until its next frame is due, and is read without any system calls when it is due immediately.
  */
-int process_frames(int dev, int sock, int fd, unsigned long flags, std::function<bool(ad_data&)> callback)
+int process_source(frame_source& source, const scan_options& options, std::function<bool(ad_data_view&)> callback)
 {
-    struct cmsghdr *cmsg;
-    struct msghdr msg;
-    struct iovec  iv;
-    struct hcidump_hdr *dh;
-    struct btsnoop_pkt *dp;
     struct frame frm;
     struct pollfd fds[2];
-    int nfds = 0;
-    uint8_t *buf, *ctrl;
-    int len, hdr_size = HCIDUMP_HDR_SIZE;
+    uint8_t *buf;
 
-    if (sock < 0)
-        return -1;
+    scan_control& control = options.control ? *options.control : legacyControl;
 
     if (snap_len < SNAP_LEN)
         snap_len = SNAP_LEN;
 
-    if (flags & DUMP_BTSNOOP)
-        hdr_size = BTSNOOP_PKT_SIZE;
-
-    buf = (uint8_t*) malloc(snap_len + hdr_size);
+    buf = (uint8_t*) malloc(snap_len);
     if (!buf) {
-        perror("Can't allocate data buffer");
+        LOG_ERROR("Can't allocate data buffer: %s", strerror(errno));
         return -1;
     }
+    memset(&frm, 0, sizeof(frm));
+
+    int sourcefd = source.pollfd();
+    // The scan_control eventfd that wakes the loop for stop and other requests
+    fds[0].fd = control.wakefd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = sourcefd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    int nfds = sourcefd >= 0 ? 2 : 1;
 
-    frm.data = buf + hdr_size;
+    long frameNo = 0;
+    bool stopped = control.stop;
+    int result = 0;
+    while (!stopped) {
+        if (sourcefd >= 0 || source.delay_ms() > 0) {
+            int n = poll(fds, nfds, source_timeout(source, options));
 
-    ctrl = (uint8_t *) malloc(100);
-    if (!ctrl) {
-        free(buf);
-        perror("Can't allocate control buffer");
-        return -1;
+            if (n < 0)
+                continue;
+            if (fds[0].revents & POLLIN) {
+                stopped = handle_requests(control, options);
+                continue;
+            }
+            if (n == 0) {
+                // Only a timeout before the next frame is due counts as idle time for a paced source
+                if (options.idle_callback && (sourcefd >= 0 || source.delay_ms() > 0))
+                    stopped = options.idle_callback();
+                continue;
+            }
+            if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+                LOG_ERROR("control: eventfd error");
+                break;
+            }
+            if (fds[1].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+                LOG_WARN("device: disconnected");
+                break;
+            }
+        } else if (control.stop || control.requests) {
+            stopped = handle_requests(control, options);
+            continue;
+        }
+
+        frm.data = buf;
+        int status = source.read_frame(&frm, snap_len);
+        if (status == FRAME_SOURCE_NONE)
+            continue;
+        if (status < 0) {
+            if (status == FRAME_SOURCE_ERROR)
+                result = -1;
+            break;
+        }
+
+        frm.ptr = frm.data;
+        frm.len = frm.data_len;
+
+        /* Parse and print */
+        frameNo ++;
+        stopped = dispatch_frame(&frm, frameNo, options, callback);
     }
+    LOG_INFO("Exiting hcidumpinternal scan loop");
+
+    free(buf);
+
+    return result;
+}
+
+/*
+    This is the process_frames function from hcidump.c with the addition of the beacon_event callback, it is now
+    the scan loop over a socket_frame_source.
+ */
+int process_frames(int dev, int sock, int fd, unsigned long flags, const scan_options& options,
+                   std::function<bool(ad_data_view&)> callback)
+{
+    if (sock < 0)
+        return -1;
+
+    if (snap_len < SNAP_LEN)
+        snap_len = SNAP_LEN;
 
     if (dev == HCI_DEV_NONE)
-        printf("system: ");
+        LOG_INFO("system: snap_len: %d filter: 0x%lx", snap_len, parser.filter);
     else
-        printf("device: hci%d ", dev);
+        LOG_INFO("device: hci%d snap_len: %d filter: 0x%lx", dev, snap_len, parser.filter);
 
-    printf("snap_len: %d filter: 0x%lx\n", snap_len, parser.filter);
+    socket_frame_source source(dev, sock);
+    return process_source(source, options, callback);
+}
 
-    memset(&msg, 0, sizeof(msg));
+/*
+    A variation of process_frames that drains the socket with recvmmsg() into a preallocated array of frame and
+    control buffers, and then parses the whole batch. A partial batch is held for at most options.max_latency_ms
+    waiting for more frames to arrive.
+ */
+int process_frames_batched(int dev, int sock, unsigned long flags, const scan_options& options,
+                           std::function<bool(ad_data_view&)> callback)
+{
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    struct frame frm;
+    struct pollfd fds[2];
+    uint8_t *bufs, *ctrls;
+    int i, batch_size, result = 0;
 
-    fds[nfds].fd = sock;
-    fds[nfds].events = POLLIN;
-    fds[nfds].revents = 0;
-    nfds++;
+    if (sock < 0)
+        return -1;
+
+    scan_control& control = options.control ? *options.control : legacyControl;
+
+    if (snap_len < SNAP_LEN)
+        snap_len = SNAP_LEN;
+
+    batch_size = options.batch_size;
+    if (batch_size < 1)
+        batch_size = 1;
+    else if (batch_size > MAX_BATCH_SIZE)
+        batch_size = MAX_BATCH_SIZE;
+
+    bufs = (uint8_t *) malloc(batch_size * snap_len);
+    ctrls = (uint8_t *) malloc(batch_size * CTRL_LEN);
+    msgs = (struct mmsghdr *) calloc(batch_size, sizeof(struct mmsghdr));
+    iovs = (struct iovec *) calloc(batch_size, sizeof(struct iovec));
+    if (!bufs || !ctrls || !msgs || !iovs) {
+        LOG_ERROR("Can't allocate batch buffers: %s", strerror(errno));
+        free(bufs);
+        free(ctrls);
+        free(msgs);
+        free(iovs);
+        return -1;
+    }
+
+    for (i = 0; i < batch_size; i++) {
+        iovs[i].iov_base = bufs + i * snap_len;
+        iovs[i].iov_len = snap_len;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    LOG_INFO("device: hci%d snap_len: %d batch_size: %d max_latency: %dms filter: 0x%lx", dev, snap_len, batch_size,
+             options.max_latency_ms, parser.filter);
+
+    memset(&frm, 0, sizeof(frm));
+    fds[0].fd = sock;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = control.wakefd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
 
     long frameNo = 0;
-    bool stopped = false;
+    bool stopped = control.stop;
     while (!stopped) {
-        int i, n = poll(fds, nfds, 5000);
+        int n = poll(fds, 2, scan_timeout(options));
 
         if (n <= 0) {
+            if (n == 0 && options.idle_callback)
+                stopped = options.idle_callback();
             continue;
         }
-        // Check for external stop flag
-        if(stop_scan_frames)
+        if (fds[1].revents & POLLIN) {
+            stopped = handle_requests(control, options);
+            if (stopped || !(fds[0].revents & POLLIN))
+                continue;
+        }
+
+        if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+            LOG_WARN("device: disconnected");
             break;
+        }
 
-        for (i = 0; i < nfds; i++) {
-            if (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
-                if (fds[i].fd == sock)
-                    printf("device: disconnected\n");
-                else
-                    printf("client: disconnect\n");
-                return 0;
+        // Drain up to batch_size frames, waiting up to max_latency_ms from the first frame for a partial batch to fill
+        int count = 0;
+        std::chrono::steady_clock::time_point deadline;
+        while (count < batch_size) {
+            for (i = count; i < batch_size; i++) {
+                msgs[i].msg_hdr.msg_control = ctrls + i * CTRL_LEN;
+                msgs[i].msg_hdr.msg_controllen = CTRL_LEN;
+            }
+            int received = recvmmsg(sock, msgs + count, batch_size - count, MSG_DONTWAIT, nullptr);
+            if (received < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    LOG_ERROR("Receive failed: %s", strerror(errno));
+                    result = -1;
+                    stopped = true;
+                    break;
+                }
+                received = 0;
             }
+            if (received > 0 && count == 0)
+                deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.max_latency_ms);
+            count += received;
+            if (count == 0 || count == batch_size || options.max_latency_ms == 0)
+                break;
+
+            int64_t remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            // A request on the wakefd ends the wait so a stop or flush is not held up by the latency window
+            if (remaining <= 0 || poll(fds, 2, (int) remaining) <= 0 || (fds[1].revents & POLLIN))
+                break;
         }
 
-        iv.iov_base = frm.data;
-        iv.iov_len  = snap_len;
+        for (i = 0; i < count && !stopped; i++) {
+            frm.data = (uint8_t *) iovs[i].iov_base;
+            frm.data_len = msgs[i].msg_len;
+            frm.dev_id = dev;
+            frm.in = 0;
+            process_cmsgs(&msgs[i].msg_hdr, &frm);
 
-        msg.msg_iov = &iv;
-        msg.msg_iovlen = 1;
-        msg.msg_control = ctrl;
-        msg.msg_controllen = 100;
+            frm.ptr = frm.data;
+            frm.len = frm.data_len;
 
-        len = recvmsg(sock, &msg, MSG_DONTWAIT);
-        if (len < 0) {
-            if (errno == EAGAIN || errno == EINTR)
-                continue;
-            perror("Receive failed");
-            return -1;
+            /* Parse and print */
+            frameNo ++;
+            stopped = dispatch_frame(&frm, frameNo, options, callback);
         }
+    }
+    LOG_INFO("Exiting hcidumpinternal batched scan loop");
 
-        /* Process control message */
-        frm.data_len = len;
-        frm.dev_id = dev;
-        frm.in = 0;
-
-        cmsg = CMSG_FIRSTHDR(&msg);
-        while (cmsg) {
-            int dir;
-            switch (cmsg->cmsg_type) {
-                case HCI_CMSG_DIR:
-                    memcpy(&dir, CMSG_DATA(cmsg), sizeof(int));
-                    frm.in = (uint8_t) dir;
-                    break;
-                case HCI_CMSG_TSTAMP:
-                    memcpy(&frm.ts, CMSG_DATA(cmsg), sizeof(struct timeval));
-                    break;
-            }
-            cmsg = CMSG_NXTHDR(&msg, cmsg);
+    free(bufs);
+    free(ctrls);
+    free(msgs);
+    free(iovs);
+
+    return result;
+}
+
+/*
+    A variation of process_frames_batched that services a socket per hci device from a single thread with one epoll
+    loop. Each wakeup drains up to options.batch_size frames from every ready socket with recvmmsg() so a busy device
+    cannot starve the others. A device that disconnects is dropped from the loop, which exits once no devices remain.
+ */
+int process_frames_epoll(const std::vector<int32_t>& devs, const std::vector<int>& socks, unsigned long flags,
+                         const scan_options& options, std::function<bool(ad_data_view&)> callback)
+{
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    struct epoll_event *events;
+    struct frame frm;
+    uint8_t *bufs, *ctrls;
+    int i, epfd, batch_size, active = 0, result = 0;
+    int nsocks = (int) socks.size();
+
+    scan_control& control = options.control ? *options.control : legacyControl;
+
+    if (snap_len < SNAP_LEN)
+        snap_len = SNAP_LEN;
+
+    batch_size = options.batch_size;
+    if (batch_size < 1)
+        batch_size = 1;
+    else if (batch_size > MAX_BATCH_SIZE)
+        batch_size = MAX_BATCH_SIZE;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        LOG_ERROR("Can't create epoll instance: %s", strerror(errno));
+        return -1;
+    }
+    for (i = 0; i < nsocks; i++) {
+        if (socks[i] < 0)
+            continue;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, socks[i], &ev) < 0) {
+            LOG_ERROR("Can't add hci%d to epoll set. %s(%d)", devs[i], strerror(errno), errno);
+            continue;
         }
+        active++;
+    }
+    if (active == 0) {
+        close(epfd);
+        return -1;
+    }
+    // The scan_control eventfd that wakes the loop for stop and other requests is tagged with the index nsocks
+    struct epoll_event wakeev;
+    wakeev.events = EPOLLIN;
+    wakeev.data.u32 = nsocks;
+    if (control.wakefd >= 0)
+        epoll_ctl(epfd, EPOLL_CTL_ADD, control.wakefd, &wakeev);
+
+    bufs = (uint8_t *) malloc(batch_size * snap_len);
+    ctrls = (uint8_t *) malloc(batch_size * CTRL_LEN);
+    msgs = (struct mmsghdr *) calloc(batch_size, sizeof(struct mmsghdr));
+    iovs = (struct iovec *) calloc(batch_size, sizeof(struct iovec));
+    events = (struct epoll_event *) calloc(nsocks + 1, sizeof(struct epoll_event));
+    if (!bufs || !ctrls || !msgs || !iovs || !events) {
+        LOG_ERROR("Can't allocate batch buffers: %s", strerror(errno));
+        free(bufs);
+        free(ctrls);
+        free(msgs);
+        free(iovs);
+        free(events);
+        close(epfd);
+        return -1;
+    }
 
-        frm.ptr = frm.data;
-        frm.len = frm.data_len;
+    for (i = 0; i < batch_size; i++) {
+        iovs[i].iov_base = bufs + i * snap_len;
+        iovs[i].iov_len = snap_len;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
 
-        /* Parse and print */
-        frameNo ++;
-        if(hcidumpDebugMode) {
-            printf("Begin do_parse(ts=%ld.%ld)#%ld\n", frm.ts.tv_sec, frm.ts.tv_usec, frameNo);
+    LOG_INFO("devices: %d snap_len: %d batch_size: %d filter: 0x%lx", active, snap_len, batch_size, parser.filter);
+
+    memset(&frm, 0, sizeof(frm));
+    long frameNo = 0;
+    bool stopped = control.stop;
+    while (!stopped && active > 0) {
+        int ready = epoll_wait(epfd, events, nsocks + 1, scan_timeout(options));
+
+        if (ready <= 0) {
+            if (ready == 0 && options.idle_callback)
+                stopped = options.idle_callback();
+            continue;
         }
-        ad_data event;
-        do_parse(&frm, event);
-        int64_t time = event.time;
-        if(time > 0) {
-            stopped = callback(event);
-            // Free the ad_structure.data
-            for(int n = 0; n < event.data.size(); n ++) {
-                ad_structure* ads = event.data[n];
-                free(ads);
+
+        for (int e = 0; e < ready && !stopped; e++) {
+            int index = events[e].data.u32;
+            if (index == nsocks) {
+                stopped = handle_requests(control, options);
+                continue;
+            }
+            int sock = socks[index];
+            int32_t dev = devs[index];
+            if (events[e].events & (EPOLLHUP | EPOLLERR)) {
+                LOG_WARN("device: hci%d disconnected", dev);
+                epoll_ctl(epfd, EPOLL_CTL_DEL, sock, nullptr);
+                active--;
+                continue;
+            }
+
+            for (i = 0; i < batch_size; i++) {
+                msgs[i].msg_hdr.msg_control = ctrls + i * CTRL_LEN;
+                msgs[i].msg_hdr.msg_controllen = CTRL_LEN;
+            }
+            int count = recvmmsg(sock, msgs, batch_size, MSG_DONTWAIT, nullptr);
+            if (count < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    continue;
+                LOG_ERROR("Receive failed on hci%d. %s(%d)", dev, strerror(errno), errno);
+                epoll_ctl(epfd, EPOLL_CTL_DEL, sock, nullptr);
+                active--;
+                result = -1;
+                continue;
+            }
+
+            for (i = 0; i < count && !stopped; i++) {
+                frm.data = (uint8_t *) iovs[i].iov_base;
+                frm.data_len = msgs[i].msg_len;
+                frm.dev_id = dev;
+                frm.in = 0;
+                process_cmsgs(&msgs[i].msg_hdr, &frm);
+
+                frm.ptr = frm.data;
+                frm.len = frm.data_len;
+
+                /* Parse and print */
+                frameNo ++;
+                stopped = dispatch_frame(&frm, frameNo, options, callback);
             }
-        }
-        if(hcidumpDebugMode) {
-            printf("End do_parse(info.time=%lld, ad.count=%ld)\n", time, event.data.size());
         }
     }
-    printf("Exiting hcidumpinternal scan loop\n");
-    std::lock_guard<std::mutex> exitGuard(exitLoopMutex);
-    exitLoopCV.notify_all();
+    LOG_INFO("Exiting hcidumpinternal epoll scan loop");
 
-    free(buf);
-    free(ctrl);
+    free(bufs);
+    free(ctrls);
+    free(msgs);
+    free(iovs);
+    free(events);
+    close(epfd);
 
-    return 0;
+    return result;
 }
 
 /**
  * The legacy iBeacon style of scanner
  */
 int scan_frames(int32_t device, beacon_event callback) {
+    scan_options options;
+    return scan_frames(device, callback, options);
+}
+
+int32_t scan_frames(int32_t device, std::function<bool(beacon_info *)> callback, const scan_options& options) {
 
     // Lambda wrapper around the legacy callback
-    std::function<bool(ad_data&)> wrapper = [&] (ad_data& event) {
-        beacon_info *info = nullptr;
-        // Check for a manufacturer specific data frame that looks like a beacon event
-        for (std::vector<ad_structure*>::iterator it = event.data.begin(); it != event.data.end(); ++it) {
-            ad_structure& ads = *(*it);
-            if (ads.type == 0xff) {
-                if(hcidumpDebugMode)
-                    printf("ManufacturerData(%d bytes): ", ads.length);
+    beacon_info info;
+    std::function<bool(ad_data_view&)> wrapper = [&] (ad_data_view& event) {
+        // Check for a manufacturer specific data frame that looks like a beacon event. This is not limited to the
+        // decoder registry formats, the beacon_info manufacturer and code let the callback filter any other layout.
+        for (int n = 0; n < event.count; n ++) {
+            ad_structure_view& ads = event.data[n];
+            const uint8_t *data = ad_view_data(event, n);
+            if (ads.type == AD_TYPE_MANUFACTURER_DATA) {
+                LOG_DEBUG("ManufacturerData(%d bytes): %s", ads.length, logHex(data, ads.length));
                 if (ads.length >= MIN_MANUFACTURER_DATA_SIZE) {
-                    if(hcidumpDebugMode) {
-                        for (int i = 0; i < ads.length; ++i) {
-                            printf("%x", ads.data[i]);
-                        }
-                        printf("\n");
-                    }
                     // Pull out the beacon info
-                    info = new beacon_info;
-                    extractBeaconInfo(ads, info);
-                    if(hcidumpDebugMode) {
-                        printf("Major:%d, Minor:%d\n", info->major, info->minor);
-                        printf("UUID(%ld):%s\n", strlen(info->uuid), info->uuid);
-                    }
-                    // Free the ad_structure.data
-                    for(int n = 0; n < event.data.size(); n ++) {
-                        ad_structure* ads = event.data[n];
-                        free(ads);
-                    }
-                    return (*callback)(info);
+                    extractBeaconInfo(data, &info);
+                    LOG_DEBUG("Major:%d, Minor:%d, UUID:%s", info.major, info.minor, info.uuid);
+                    return callback(&info);
                 }
-                if(hcidumpDebugMode)
-                    printf("\n");
             }
         }
         return false;
     };
-    return scan_for_ad_events(device, wrapper);
+    return scan_for_ad_events_view(device, wrapper, options);
+}
+
+int32_t scan_frames_v2(int32_t device, std::function<bool(beacon_info_v2 *)> callback, const scan_options& options) {
+    beacon_record record;
+    beacon_info_v2& info = record.beacon;
+    const signature_table& beacons = beaconSignatureTable();
+    const uint32_t beaconFormats = 1u << BEACON_FORMAT_IBEACON | 1u << BEACON_FORMAT_ALTBEACON;
+    uint32_t formats[MAX_AD_STRUCTURES];
+    uint32_t matches[MAX_AD_STRUCTURES];
+    std::function<bool(ad_data_view&)> wrapper = [&] (ad_data_view& event) {
+        // Classify every structure in one pass, so an event without a beacon is rejected without a per structure scan
+        if ((classifyAdStructures(beacons, event, formats, matches) & beaconFormats) == 0)
+            return false;
+        for (int n = 0; n < event.count; n ++) {
+            ad_structure_view& ads = event.data[n];
+            uint8_t format = firstSignatureFormat(beacons, matches[n]);
+            if (format == BEACON_FORMAT_IBEACON || format == BEACON_FORMAT_ALTBEACON) {
+                decodeAdStructure(format, ad_view_data(event, n), ads.length, record);
+                info.rssi = (int8_t) event.rssi;
+                info.time = event.time;
+                LOG_DEBUG("Major:%d, Minor:%d, UUID:%s", info.major, info.minor, logHex(info.uuid, UUID_SIZE));
+                return callback(&info);
+            }
+        }
+        return false;
+    };
+    return scan_for_ad_events_view(device, wrapper, options);
+}
+
+int32_t scan_for_ad_events_view(int32_t device, std::function<bool(ad_data_view&)> callback) {
+    scan_options options;
+    return scan_for_ad_events_view(device, callback, options);
+}
+
+int32_t scan_for_ad_events_view(int32_t device, std::function<bool(ad_data_view&)> callback,
+                                const scan_options& options) {
+    int socketfd = open_socket(device, options);
+    LOG_INFO("Scanning hci%d, socket=%d, hcidumpDebugMode=%d", device, socketfd, hcidumpDebugMode);
+    int result = scan_socket_for_ad_events_view(device, socketfd, callback, options);
+    if(socketfd >= 0)
+        close(socketfd);
+    return result;
+}
+
+int32_t scan_socket_for_ad_events_view(int32_t device, int sock, std::function<bool(ad_data_view&)> callback,
+                                       const scan_options& options) {
+    unsigned long flags = 0;
+
+    flags |= DUMP_TSTAMP;
+    flags |= DUMP_EXT;
+    flags |= DUMP_VERBOSE;
+    if(options.batch_size > 1)
+        return process_frames_batched(device, sock, flags, options, callback);
+    return process_frames(device, sock, -1, flags, options, callback);
 }
 
 int32_t scan_for_ad_events(int32_t device, std::function<bool(ad_data&)> callback) {
+    scan_options options;
+    return scan_for_ad_events(device, callback, options);
+}
+
+/**
+ * Run scan with an ad_data_view callback that adapts each event to the ad_data form expected by callback. The
+ * ad_structures are copied into a pool that is reused for every event, so they are only valid for the duration of
+ * the callback.
+ */
+static int32_t scan_as_ad_data(std::function<bool(ad_data&)>& callback,
+                               std::function<int32_t(std::function<bool(ad_data_view&)>&)> scan) {
+    ad_structure pool[MAX_AD_STRUCTURES];
+    ad_data event;
+    event.data.reserve(MAX_AD_STRUCTURES);
+    std::function<bool(ad_data_view&)> wrapper = [&](ad_data_view& view) {
+        event.dev_id = view.dev_id;
+        event.bdaddr_type = view.bdaddr_type;
+        memcpy(event.bdaddr, view.bdaddr, sizeof(event.bdaddr));
+        event.rssi = view.rssi;
+        event.time = view.time;
+        event.data.clear();
+        for (int n = 0; n < view.count; n ++) {
+            ad_structure& ads = pool[n];
+            ads.type = view.data[n].type;
+            ads.length = view.data[n].length;
+            if (ads.length > sizeof(ads.data))
+                ads.length = sizeof(ads.data);
+            memcpy(ads.data, ad_view_data(view, n), ads.length);
+            event.data.push_back(&ads);
+        }
+        return callback(event);
+    };
+    return scan(wrapper);
+}
+
+int32_t scan_for_ad_events(int32_t device, std::function<bool(ad_data&)> callback, const scan_options& options) {
+    return scan_as_ad_data(callback, [&](std::function<bool(ad_data_view&)>& wrapper) {
+        return scan_for_ad_events_view(device, wrapper, options);
+    });
+}
+
+int32_t scan_for_ad_events_view(const std::vector<int32_t>& devs, std::function<bool(ad_data_view&)> callback,
+                                const scan_options& options) {
     unsigned long flags = 0;
 
     flags |= DUMP_TSTAMP;
     flags |= DUMP_EXT;
     flags |= DUMP_VERBOSE;
-    int socketfd = open_socket(device);
-    printf("Scanning hci%d, socket=%d, hcidumpDebugMode=%d\n", device, socketfd, hcidumpDebugMode);
-    return process_frames(device, socketfd, -1, flags, callback);
+    std::vector<int> socks;
+    for (int32_t device : devs) {
+        int socketfd = open_socket(device, options);
+        LOG_INFO("Scanning hci%d, socket=%d, hcidumpDebugMode=%d", device, socketfd, hcidumpDebugMode);
+        socks.push_back(socketfd);
+    }
+    int result = process_frames_epoll(devs, socks, flags, options, callback);
+    for (int socketfd : socks) {
+        if(socketfd >= 0)
+            close(socketfd);
+    }
+    return result;
+}
+
+int32_t scan_for_ad_events(const std::vector<int32_t>& devs, std::function<bool(ad_data&)> callback,
+                           const scan_options& options) {
+    return scan_as_ad_data(callback, [&](std::function<bool(ad_data_view&)>& wrapper) {
+        return scan_for_ad_events_view(devs, wrapper, options);
+    });
+}
+
+int32_t scan_for_ad_events_view(frame_source& source, std::function<bool(ad_data_view&)> callback,
+                                const scan_options& options) {
+    return process_source(source, options, callback);
+}
+
+int32_t scan_for_ad_events(frame_source& source, std::function<bool(ad_data&)> callback, const scan_options& options) {
+    return scan_as_ad_data(callback, [&](std::function<bool(ad_data_view&)>& wrapper) {
+        return process_source(source, options, wrapper);
+    });
 }
 
 int32_t scan_for_ad_events_inline(int32_t device, std::function<bool(ad_data_inline&)> callback) {
-    // Lambda wrapper around the ad_data& based callback that inlines the vector<ad_structure*> data
-    std::function<bool(ad_data &)> wrapper = [&](ad_data &event) {
-        ad_data_inline* event_inline = toInline(event);
-        if(hcidumpDebugMode) {
-            printf("HCI:ad_data:{time=%ld, rssi=%d, count=%d}\n", event_inline->time, event_inline->rssi,
-                   event_inline->count);
-            printf("\tHCI:AD(%d:%d) vs inline(%d:%d)\n", event.data[0]->type, event.data[0]->length,
-                   event_inline->data[0].type, event_inline->data[0].length);
+    scan_options options;
+    return scan_for_ad_events_inline(device, callback, options);
+}
+
+int32_t scan_for_ad_events_inline(int32_t device, std::function<bool(ad_data_inline&)> callback,
+                                  const scan_options& options) {
+    // Lambda wrapper around the ad_data_view& based callback that writes the inline form into a reused buffer
+    alignas(ad_data_inline) uint8_t buffer[AD_DATA_INLINE_MAX_SIZE];
+    std::function<bool(ad_data_view &)> wrapper = [&](ad_data_view &event) {
+        if(writeInline(event, buffer, sizeof(buffer)) == 0)
+            return false;
+        ad_data_inline* event_inline = (ad_data_inline*) buffer;
+        if(event.count > 0) {
+            LOG_DEBUG("HCI:ad_data:{time=%ld, rssi=%d, count=%d}", event_inline->time, event_inline->rssi,
+                      event_inline->count);
+            LOG_DEBUG("HCI:AD(%d:%d) vs inline(%d:%d)", event.data[0].type, event.data[0].length,
+                      event_inline->data[0].type, event_inline->data[0].length);
         }
-        bool stop = callback(*event_inline);
-        free(event_inline);
-        return stop;
+        return callback(*event_inline);
     };
-    return scan_for_ad_events(device, wrapper);
+    return scan_for_ad_events_view(device, wrapper, options);
 }
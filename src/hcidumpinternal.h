@@ -5,10 +5,22 @@
 #include <stdint.h>
 #include <vector>
 #include <functional>
+#include <atomic>
 #include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "hexutil.h"
+#include "asynclog.h"
+#include "scanstats.h"
+#include "latencyhist.h"
 
 // The size of the uuid in the manufacturer data
 #define UUID_SIZE 16
+// The maximum number of AD structures tracked for a single advertising event
+#define MAX_AD_STRUCTURES 32
 // The minimum size of manufacturer data we are interested in. This consists of:
 // manufacturer(2), code(2), uuid(16), major(2), minor(2), calibrated power(1)
 #define MIN_MANUFACTURER_DATA_SIZE (2+2+UUID_SIZE+2+2+1)
@@ -30,6 +42,34 @@ typedef struct beacon_info {
     int64_t time;
 } beacon_info;
 
+// The beacon_info_v2.version value
+#define BEACON_INFO_VERSION_2 2
+// The beacon_info_v2.flags bits
+#define BEACON_FLAG_ALTBEACON 0x1
+
+/**
+ * The compact form of beacon_info, 32 bytes or half a cache line per record. The uuid is the 16 binary bytes in the
+ * order they were transmitted, so java reads it as two big endian longs and only formats it as text when asked. The
+ * other fields are native endian. Every field is at its natural alignment, so the packed layout adds no unaligned
+ * accesses and matches the BEACON_V2_*_OFFSET constants of the JNI headers on every ABI.
+ *
+ * The manufacturer id, count and power of beacon_info are not carried. The beacon code is reduced to the
+ * BEACON_FLAG_ALTBEACON bit, and the count and power were never filled in by the scanner.
+ */
+typedef struct __attribute__((packed)) beacon_info_v2 {
+    /** BEACON_INFO_VERSION_2 */
+    uint8_t version;
+    /** The BEACON_FLAG_* bits */
+    uint8_t flags;
+    int8_t calibrated_power;
+    int8_t rssi;
+    uint16_t major;
+    uint16_t minor;
+    uint8_t uuid[UUID_SIZE];
+    /** The time the advertising packet was received */
+    int64_t time;
+} beacon_info_v2;
+
 /**
  * The generic BLE AD structure used in advertising packets
  */
@@ -40,7 +80,110 @@ typedef struct ad_structure {
     uint8_t data[31];
 } ad_structure;
 
+// The scan_control request bits passed to the scan_options.request_callback
+#define SCAN_REQUEST_FLUSH 0x1
+#define SCAN_REQUEST_RECONFIGURE 0x2
+
+/**
+ * The stop signal and request channel of a scan loop. Each scanner owns one so that several scan loops can run in
+ * one process. The scan loop polls the wakefd eventfd along with its sockets, so a stop, flush or reconfigure
+ * request wakes the loop immediately rather than waiting for a frame or the idle timeout.
+ */
+typedef struct scan_control {
+    /** Set to request that the scan loop exits */
+    std::atomic<bool> stop;
+    /** The SCAN_REQUEST_* bits posted since the scan loop last handled requests */
+    std::atomic<uint32_t> requests;
+    /** The eventfd written to wake the scan loop */
+    int wakefd;
+
+    scan_control() : stop(false), requests(0) {
+        wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakefd < 0)
+            LOG_ERROR("Can't create scan control eventfd: %s", strerror(errno));
+    }
+    ~scan_control() {
+        if (wakefd >= 0)
+            close(wakefd);
+    }
+} scan_control;
+
+/**
+ * Wake the scan loop using control
+ */
+static inline void wakeScanLoop(scan_control& control) {
+    uint64_t one = 1;
+    if (control.wakefd >= 0 && write(control.wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        LOG_ERROR("Can't wake scan loop: %s", strerror(errno));
+}
+
+/**
+ * Request that the scan loop using control exits
+ */
+static inline void requestStop(scan_control& control) {
+    control.stop.store(true);
+    wakeScanLoop(control);
+}
+
+/**
+ * Post SCAN_REQUEST_* bits to be handled by the scan_options.request_callback on the scan loop thread
+ */
+static inline void postRequest(scan_control& control, uint32_t request) {
+    control.requests.fetch_or(request);
+    wakeScanLoop(control);
+}
+
+/**
+ * Called by the scan loop when the wakefd is readable to reset it and take the posted request bits
+ */
+static inline uint32_t takeRequests(scan_control& control) {
+    uint64_t count;
+    if (control.wakefd >= 0 && read(control.wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        LOG_ERROR("Can't read scan control eventfd: %s", strerror(errno));
+    return control.requests.exchange(0);
+}
+
+struct capture_writer;
+
+/**
+ * Options controlling how the scan loop captures frames from the HCI socket
+ */
+typedef struct scan_options {
+    /** The maximum number of frames drained from the socket by one recvmmsg() call, 1 = one recvmsg() per frame */
+    uint32_t batch_size = 1;
+    /** The maximum time in milliseconds the first frame of a partial batch waits for the batch to fill, 0 = no wait */
+    uint32_t max_latency_ms = 0;
+    /** The time in milliseconds without a frame after which the idle_callback is invoked */
+    uint32_t idle_timeout_ms = 5000;
+    /**
+     * An optional callback for periodic work when the socket is idle. Returns true to stop scanning. Without one the
+     * scan loop blocks until a frame arrives or its scan_control is signalled.
+     */
+    std::function<bool()> idle_callback;
+    /**
+     * An optional callback returning the time in milliseconds until the idle_callback is next due, used in place of
+     * idle_timeout_ms so that work with its own deadline, such as a partial batch, is not held up for a whole interval
+     */
+    std::function<int()> idle_due_ms;
+    /** An optional callback passed the SCAN_REQUEST_* bits posted to the scan_control. Returns true to stop scanning. */
+    std::function<bool(uint32_t)> request_callback;
+    /** Program the HCI socket filter to pass only HCI event packets with the EVT_LE_META_EVENT code */
+    bool le_meta_only = false;
+    /** Attach a socket filter that drops LE meta events other than advertising reports in the kernel */
+    bool adv_reports_only = false;
+    /** An optional writer the raw frames are teed to before they are parsed, see capturewriter.h */
+    capture_writer *capture = nullptr;
+    /** The stop signal of the scan loop, nullptr to use the process wide legacy signal */
+    scan_control *control = nullptr;
+    /** Optional counters the scan loop updates for each frame, see scanstats.h */
+    scan_stats *stats = nullptr;
+    /** Optional latency histograms the scan loop records each frame into, see latencyhist.h */
+    scan_latency *latency = nullptr;
+} scan_options;
+
 typedef struct ad_data {
+    /** The hci device the advertising packet was received on */
+    int32_t dev_id;
     /** The type of the bdaddr; 0 = Public, 1 = Random, other = Reserved */
     uint8_t	bdaddr_type;
     /** The address of the advertising packet */
@@ -53,6 +196,48 @@ typedef struct ad_data {
     std::vector<ad_structure*> data;
 } ad_data;
 
+/**
+ * A view of an AD structure that references its data in place in the received frame buffer
+ */
+typedef struct ad_structure_view {
+    /** The offset of the AD structure data from the start of the ad_data_view.buffer */
+    uint16_t offset;
+    /** The actual length the data, not including the length and type fields */
+    uint8_t length;
+    uint8_t type;
+} ad_structure_view;
+
+/**
+ * A version of ad_data that holds views into the received frame buffer rather than copies of the ad_structures,
+ * so that parsing an advertising event does no heap allocation. The view and the buffer it references are only
+ * valid for the duration of the callback it is passed to.
+ */
+typedef struct ad_data_view {
+    /** The hci device the advertising packet was received on */
+    int32_t dev_id;
+    /** The type of the bdaddr; 0 = Public, 1 = Random, other = Reserved */
+    uint8_t	bdaddr_type;
+    /** The address of the advertising packet */
+    uint8_t bdaddr[6];
+    /** The count of the data[] elements */
+    uint8_t count;
+    /** The rssi of the advertising packet */
+    int32_t rssi;
+    /** The time the advertising packet was received */
+    int64_t time;
+    /** The frame buffer the data[] offsets are relative to */
+    const uint8_t *buffer;
+    /** The advertising data structure views in the packet */
+    ad_structure_view data[MAX_AD_STRUCTURES];
+} ad_data_view;
+
+/**
+ * Get a pointer to the data of the index'th AD structure of an ad_data_view
+ */
+static inline const uint8_t* ad_view_data(const ad_data_view& event, int index) {
+    return event.buffer + event.data[index].offset;
+}
+
 /**
  * A version of ad_data that inlines the ad_structures in the data array. This is used to have a contiguous in
  * memory structure that is easily passed between c and java via jni and ByteBuffer.
@@ -108,12 +293,95 @@ static inline ad_data_inline* toInline(ad_data& event) {
     return event_inline;
 }
 
+// The maximum size of an ad_data_inline. All of the AD structures of an event come from a single HCI event whose
+// parameters are at most 255 bytes, so that bounds the inlined data[] content.
+#define AD_DATA_INLINE_MAX_SIZE (sizeof(ad_data_inline) + 255)
+
+/**
+ * Calculate the size of the ad_data_inline form of an ad_data_view
+ */
+static inline uint32_t inlineLength(const ad_data_view& event) {
+    uint32_t totalLength = sizeof(ad_data_inline);
+    for (int n = 0; n < event.count; n ++) {
+        // Length does not include the type and length field itself
+        totalLength += event.data[n].length + 2;
+    }
+    return totalLength;
+}
+
+/**
+ * inline function to write the ad_data_inline form of an ad_data_view directly into dst, for example a direct
+ * ByteBuffer shared with java, without an intermediate heap buffer.
+ * @return the number of bytes written, or 0 if the event does not fit within capacity bytes
+ */
+static inline uint32_t writeInline(const ad_data_view& event, uint8_t *dst, uint64_t capacity) {
+    uint32_t totalLength = inlineLength(event);
+    if (totalLength > capacity)
+        return 0;
+
+    ad_data_inline* event_inline = (ad_data_inline*) dst;
+    event_inline->total_length = totalLength;
+    event_inline->bdaddr_type = event.bdaddr_type;
+    memcpy(event_inline->bdaddr, event.bdaddr, sizeof(event.bdaddr));
+    event_inline->count = event.count;
+    event_inline->rssi = event.rssi;
+    event_inline->time = event.time;
+
+    // Write each view as a length, type, data[length] ad_structure
+    uint8_t *adsPtr = dst + sizeof(ad_data_inline);
+    for (int n = 0; n < event.count; n ++) {
+        const ad_structure_view& ads = event.data[n];
+        adsPtr[0] = ads.length;
+        adsPtr[1] = ads.type;
+        memcpy(adsPtr + 2, ad_view_data(event, n), ads.length);
+        adsPtr += ads.length + 2;
+    }
+    return totalLength;
+}
+
+/**
+ * Extract the beacon fields from the data of a manufacturer specific AD structure of at least
+ * MIN_MANUFACTURER_DATA_SIZE bytes into info
+ */
+static inline void extractBeaconInfo(const uint8_t *data, beacon_info *info) {
+    // Get the manufacturer code from the first two octets
+    info->manufacturer = 256 * data[0] + data[1];
+    // Get the beacon code from the next two octets
+    info->code = 256 * data[2] + data[3];
+
+    // Get the proximity uuid as the hex string of its UUID_SIZE bytes
+    const uint8_t *uuid = data + 4;
+    hexEncode(uuid, UUID_SIZE, info->uuid);
+    // Get the beacon major and minor ids
+    const uint8_t *ids = uuid + UUID_SIZE;
+    info->major = 256 * ids[0] + ids[1];
+    info->minor = 256 * ids[2] + ids[3];
+    // Get the transmitted power, which is encoded as the 2's complement of the calibrated Tx Power
+    info->calibrated_power = ids[4] - 256;
+}
+
+/**
+ * Extract the fields of the compact beacon_info_v2 from the data of a manufacturer specific AD structure of at least
+ * MIN_MANUFACTURER_DATA_SIZE bytes into info. The uuid is copied as is rather than formatted, and the rssi and time
+ * are left to the caller.
+ */
+static inline void extractBeaconInfoV2(const uint8_t *data, beacon_info_v2 *info) {
+    info->version = BEACON_INFO_VERSION_2;
+    // The AltBeacon code is 0xBEAC, the iBeacon code 0x0215
+    info->flags = data[2] == 0xbe && data[3] == 0xac ? BEACON_FLAG_ALTBEACON : 0;
+    memcpy(info->uuid, data + 4, UUID_SIZE);
+    const uint8_t *ids = data + 4 + UUID_SIZE;
+    info->major = 256 * ids[0] + ids[1];
+    info->minor = 256 * ids[2] + ids[3];
+    info->calibrated_power = (int8_t) ids[4];
+}
+
 // The legacy callback function invoked for each beacon event seen by hcidumpinternal
 // const char * uuid, int32_t code, int32_t manufacturer, int32_t major, int32_t minor, int32_t power, int32_t rssi, int64_t time
 //typedef const beacon_info *beacon_info_stack_ptr;
 typedef bool (*beacon_event)(beacon_info *);
 
-// Debug mode flag
+// Debug mode flag, enables the LOG_DEBUG records at runtime
 extern bool hcidumpDebugMode;
 
 #ifdef __cplusplus
@@ -125,11 +393,55 @@ int32_t scan_frames(int32_t dev, beacon_event callback);
 #ifdef __cplusplus
 }
 #endif
+int32_t scan_frames(int32_t dev, std::function<bool(beacon_info *)> callback, const scan_options& options);
+// The beacon scanner that reports the compact beacon_info_v2 records
+int32_t scan_frames_v2(int32_t dev, std::function<bool(beacon_info_v2 *)> callback, const scan_options& options);
 
 // The generic function hcidumpinternal exports for viewing complete advertising packet callbacks
 int32_t scan_for_ad_events(int32_t dev, std::function<bool(ad_data&)> callback);
+int32_t scan_for_ad_events(int32_t dev, std::function<bool(ad_data&)> callback, const scan_options& options);
+
+// The generic function hcidumpinternal exports for viewing complete advertising packet callbacks as views into the
+// received frame buffer. This is the allocation free form the other callback types are adapted from.
+int32_t scan_for_ad_events_view(int32_t dev, std::function<bool(ad_data_view&)> callback);
+int32_t scan_for_ad_events_view(int32_t dev, std::function<bool(ad_data_view&)> callback, const scan_options& options);
+
+// Run the scan loop over an already open socket that delivers raw HCI frames, for example one end of a socketpair
+// carrying synthetic frames. The socket is left open.
+int32_t scan_socket_for_ad_events_view(int32_t dev, int sock, std::function<bool(ad_data_view&)> callback,
+                                       const scan_options& options);
+
+// Scan several hci devices from a single thread using one epoll loop over a socket per device. The dev_id of each
+// event identifies the device it was received on.
+int32_t scan_for_ad_events_view(const std::vector<int32_t>& devs, std::function<bool(ad_data_view&)> callback,
+                                const scan_options& options);
+int32_t scan_for_ad_events(const std::vector<int32_t>& devs, std::function<bool(ad_data&)> callback,
+                           const scan_options& options);
+
+// The parse_frame results
+// The frame was an LE advertising report and the event was filled in
+#define PARSE_ADV_REPORT 1
+// The frame was an event the scanner does not use, such as a command complete
+#define PARSE_SKIPPED 0
+// The frame was not an HCI event packet, or was an event or LE subevent the parser does not know
+#define PARSE_UNKNOWN -1
+// The frame was too short for the event it claimed to be
+#define PARSE_ERROR -2
+
+// Parse a single raw HCI frame into event, independently of any scan loop. This is re-entrant, so separate threads
+// may parse frames concurrently.
+// @return one of the PARSE_* results
+struct frame;
+int parse_frame(struct frame *frm, ad_data_view& event);
+
+// Run the scan loop over any frame_source, for example a file_frame_source replaying a capture file
+class frame_source;
+int32_t scan_for_ad_events_view(frame_source& source, std::function<bool(ad_data_view&)> callback,
+                                const scan_options& options);
+int32_t scan_for_ad_events(frame_source& source, std::function<bool(ad_data&)> callback, const scan_options& options);
 
 // The generic function hcidumpinternal exports for viewing complete advertising packet callbacks as inline data
 int32_t scan_for_ad_events_inline(int32_t dev, std::function<bool(ad_data_inline&)> callback);
+int32_t scan_for_ad_events_inline(int32_t dev, std::function<bool(ad_data_inline&)> callback, const scan_options& options);
 
 #endif
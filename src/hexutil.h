@@ -0,0 +1,344 @@
+#ifndef hexutil_H
+#define hexutil_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The hex kernels convert 16 bytes at a time with SSE2 on x86 or NEON on ARM, and fall back to a nibble table lookup
+ * elsewhere. Inputs shorter than a block are padded into a block on the stack, so uuids and bdaddrs take the vector
+ * path too. HEX_KERNEL names the block implementation compiled in.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HEX_KERNEL "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HEX_KERNEL "neon"
+#else
+#define HEX_KERNEL "scalar"
+#endif
+
+// The bytes converted by one hex block kernel call, which reads or writes twice as many chars
+#define HEX_BLOCK_SIZE 16
+// The length of the canonical text of a uuid and of a bdaddr, excluding the null
+#define UUID_STRING_LENGTH 36
+#define BDADDR_STRING_LENGTH 17
+
+// The upper case hex digits indexed by nibble value
+static const char hexDigits[] = "0123456789ABCDEF";
+
+/**
+ * The upper case hex digit of the low nibble of b
+ */
+static inline char toHexChar(int b) {
+    return hexDigits[b & 0x0f];
+}
+
+/**
+ * The value of the hex digit c in either case, -1 if c is not a hex digit
+ */
+static inline int fromHexChar(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/**
+ * Format the HEX_BLOCK_SIZE bytes of data as 2*HEX_BLOCK_SIZE upper case hex digits into out, one byte at a time
+ */
+static inline void hexEncodeBlockScalar(const uint8_t *data, char *out) {
+    for (int n = 0; n < HEX_BLOCK_SIZE; n ++) {
+        out[2*n] = hexDigits[data[n] >> 4];
+        out[2*n+1] = hexDigits[data[n] & 0x0f];
+    }
+}
+
+/**
+ * Parse the 2*HEX_BLOCK_SIZE hex digits of text into HEX_BLOCK_SIZE bytes of out, one char at a time
+ * @return false if a char is not a hex digit
+ */
+static inline bool hexDecodeBlockScalar(const char *text, uint8_t *out) {
+    int invalid = 0;
+    for (int n = 0; n < HEX_BLOCK_SIZE; n ++) {
+        int high = fromHexChar(text[2*n]);
+        int low = fromHexChar(text[2*n+1]);
+        invalid |= high | low;
+        out[n] = (uint8_t) ((high & 0x0f) << 4 | (low & 0x0f));
+    }
+    return invalid >= 0;
+}
+
+#if defined(__SSE2__)
+/**
+ * The hex digits of 16 nibble values, '0' + n plus the gap between '9' and 'A' where n > 9
+ */
+static inline __m128i hexDigitsSSE2(__m128i nibbles) {
+    __m128i letters = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')),
+                        _mm_and_si128(letters, _mm_set1_epi8('A' - '9' - 1)));
+}
+
+/**
+ * The nibble values of 16 hex digits, with the lanes that are not hex digits set in invalid
+ */
+static inline __m128i hexNibblesSSE2(__m128i chars, __m128i& invalid) {
+    __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    // An unsigned x <= max is min(x, max) == x
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+    invalid = _mm_or_si128(invalid, _mm_cmpeq_epi8(_mm_or_si128(isDigit, isLetter), _mm_setzero_si128()));
+    return _mm_or_si128(_mm_and_si128(isDigit, digit),
+                        _mm_and_si128(isLetter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+/**
+ * Combine the high, low nibble pairs of 16 nibble values into 8 bytes in the low byte of each 16 bit lane
+ */
+static inline __m128i hexPairsSSE2(__m128i nibbles) {
+    __m128i high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0xff)), 4);
+    return _mm_or_si128(high, _mm_srli_epi16(nibbles, 8));
+}
+
+static inline void hexEncodeBlock(const uint8_t *data, char *out) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *) data);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i high = hexDigitsSSE2(_mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+    __m128i low = hexDigitsSSE2(_mm_and_si128(bytes, mask));
+    _mm_storeu_si128((__m128i *) out, _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128((__m128i *) (out + HEX_BLOCK_SIZE), _mm_unpackhi_epi8(high, low));
+}
+
+static inline bool hexDecodeBlock(const char *text, uint8_t *out) {
+    __m128i invalid = _mm_setzero_si128();
+    __m128i first = hexNibblesSSE2(_mm_loadu_si128((const __m128i *) text), invalid);
+    __m128i second = hexNibblesSSE2(_mm_loadu_si128((const __m128i *) (text + HEX_BLOCK_SIZE)), invalid);
+    _mm_storeu_si128((__m128i *) out, _mm_packus_epi16(hexPairsSSE2(first), hexPairsSSE2(second)));
+    return _mm_movemask_epi8(invalid) == 0;
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+/**
+ * The hex digits of 16 nibble values, '0' + n plus the gap between '9' and 'A' where n > 9
+ */
+static inline uint8x16_t hexDigitsNEON(uint8x16_t nibbles) {
+    uint8x16_t letters = vcgtq_u8(nibbles, vdupq_n_u8(9));
+    return vaddq_u8(vaddq_u8(nibbles, vdupq_n_u8('0')), vandq_u8(letters, vdupq_n_u8('A' - '9' - 1)));
+}
+
+/**
+ * The nibble values of 16 hex digits, with the lanes that are not hex digits set in invalid
+ */
+static inline uint8x16_t hexNibblesNEON(uint8x16_t chars, uint8x16_t& invalid) {
+    uint8x16_t digit = vsubq_u8(chars, vdupq_n_u8('0'));
+    uint8x16_t letter = vsubq_u8(vorrq_u8(chars, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    uint8x16_t isDigit = vcleq_u8(digit, vdupq_n_u8(9));
+    uint8x16_t isLetter = vcleq_u8(letter, vdupq_n_u8(5));
+    invalid = vorrq_u8(invalid, vmvnq_u8(vorrq_u8(isDigit, isLetter)));
+    return vorrq_u8(vandq_u8(isDigit, digit), vandq_u8(isLetter, vaddq_u8(letter, vdupq_n_u8(10))));
+}
+
+static inline void hexEncodeBlock(const uint8_t *data, char *out) {
+    uint8x16_t bytes = vld1q_u8(data);
+    uint8x16x2_t digits;
+    digits.val[0] = hexDigitsNEON(vshrq_n_u8(bytes, 4));
+    digits.val[1] = hexDigitsNEON(vandq_u8(bytes, vdupq_n_u8(0x0f)));
+    // The interleaving store writes the high and low digit of each byte next to each other
+    vst2q_u8((uint8_t *) out, digits);
+}
+
+static inline bool hexDecodeBlock(const char *text, uint8_t *out) {
+    // The deinterleaving load splits the high and low digits of each byte
+    uint8x16x2_t chars = vld2q_u8((const uint8_t *) text);
+    uint8x16_t invalid = vdupq_n_u8(0);
+    uint8x16_t high = hexNibblesNEON(chars.val[0], invalid);
+    uint8x16_t low = hexNibblesNEON(chars.val[1], invalid);
+    vst1q_u8(out, vorrq_u8(vshlq_n_u8(high, 4), low));
+    uint8x8_t any = vorr_u8(vget_low_u8(invalid), vget_high_u8(invalid));
+    return vget_lane_u64(vreinterpret_u64_u8(any), 0) == 0;
+}
+#else
+static inline void hexEncodeBlock(const uint8_t *data, char *out) {
+    hexEncodeBlockScalar(data, out);
+}
+
+static inline bool hexDecodeBlock(const char *text, uint8_t *out) {
+    return hexDecodeBlockScalar(text, out);
+}
+#endif
+
+/**
+ * Format length bytes of data as 2*length upper case hex digits followed by a null into out
+ */
+static inline void hexEncode(const uint8_t *data, uint32_t length, char *out) {
+    uint32_t n = 0;
+    for (; n + HEX_BLOCK_SIZE <= length; n += HEX_BLOCK_SIZE)
+        hexEncodeBlock(data + n, out + 2*n);
+    if (n < length) {
+        uint8_t block[HEX_BLOCK_SIZE] = {0};
+        char digits[2*HEX_BLOCK_SIZE];
+        memcpy(block, data + n, length - n);
+        hexEncodeBlock(block, digits);
+        memcpy(out + 2*n, digits, 2*(length - n));
+    }
+    out[2*length] = 0;
+}
+
+/**
+ * Parse the 2*length hex digits of text, in either case, into length bytes of out
+ * @return false if a char is not a hex digit, in which case out is undefined
+ */
+static inline bool hexDecode(const char *text, uint32_t length, uint8_t *out) {
+    bool valid = true;
+    uint32_t n = 0;
+    for (; n + HEX_BLOCK_SIZE <= length; n += HEX_BLOCK_SIZE)
+        valid &= hexDecodeBlock(text + 2*n, out + n);
+    if (n < length) {
+        char digits[2*HEX_BLOCK_SIZE];
+        uint8_t block[HEX_BLOCK_SIZE];
+        memset(digits, '0', sizeof(digits));
+        memcpy(digits, text + 2*n, 2*(length - n));
+        valid &= hexDecodeBlock(digits, block);
+        memcpy(out + n, block, length - n);
+    }
+    return valid;
+}
+
+/**
+ * Format length bytes of data as upper case hex digit pairs separated by separator, followed by a null, into out,
+ * which must hold 3*length chars
+ * @return the length of the text
+ */
+static inline uint32_t hexEncodeSeparated(const uint8_t *data, uint32_t length, char separator, char *out) {
+    if (length == 0) {
+        *out = 0;
+        return 0;
+    }
+    char *loc = out;
+    uint32_t n = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    // The three way interleaving store places a separator after each digit pair
+    for (; n + HEX_BLOCK_SIZE <= length; n += HEX_BLOCK_SIZE) {
+        uint8x16_t bytes = vld1q_u8(data + n);
+        uint8x16x3_t triples;
+        triples.val[0] = hexDigitsNEON(vshrq_n_u8(bytes, 4));
+        triples.val[1] = hexDigitsNEON(vandq_u8(bytes, vdupq_n_u8(0x0f)));
+        triples.val[2] = vdupq_n_u8(separator);
+        vst3q_u8((uint8_t *) loc, triples);
+        loc += 3*HEX_BLOCK_SIZE;
+    }
+#endif
+    char digits[2*HEX_BLOCK_SIZE];
+    for (; n < length; n += HEX_BLOCK_SIZE) {
+        uint32_t count = length - n < HEX_BLOCK_SIZE ? length - n : HEX_BLOCK_SIZE;
+        uint8_t block[HEX_BLOCK_SIZE] = {0};
+        memcpy(block, data + n, count);
+        hexEncodeBlock(block, digits);
+        for (uint32_t i = 0; i < count; i ++) {
+            loc[0] = digits[2*i];
+            loc[1] = digits[2*i+1];
+            loc[2] = separator;
+            loc += 3;
+        }
+    }
+    // Replace the separator after the last pair
+    loc[-1] = 0;
+    return loc - out - 1;
+}
+
+// The size of the toHexString buffer needed for length bytes of data
+#define HEX_STRING_SIZE(length) (3 * (length) + 1)
+
+/**
+ * Format data as upper case hex bytes, each followed by a ':', into buffer, which must hold
+ * HEX_STRING_SIZE(length) chars
+ * @return buffer
+ */
+static inline const char* toHexString(const uint8_t *data, uint32_t length, char *buffer) {
+    uint32_t end = hexEncodeSeparated(data, length, ':', buffer);
+    if (length > 0) {
+        buffer[end] = ':';
+        buffer[end + 1] = 0;
+    }
+    return buffer;
+}
+
+/**
+ * Format the 16 bytes of a uuid, in transmitted order, as its canonical 8-4-4-4-12 upper case text followed by a
+ * null into out, which must hold UUID_STRING_LENGTH+1 chars
+ */
+static inline void uuidToString(const uint8_t *uuid, char *out) {
+    char digits[2*HEX_BLOCK_SIZE];
+    hexEncodeBlock(uuid, digits);
+    memcpy(out, digits, 8);
+    out[8] = '-';
+    memcpy(out + 9, digits + 8, 4);
+    out[13] = '-';
+    memcpy(out + 14, digits + 12, 4);
+    out[18] = '-';
+    memcpy(out + 19, digits + 16, 4);
+    out[23] = '-';
+    memcpy(out + 24, digits + 20, 12);
+    out[UUID_STRING_LENGTH] = 0;
+}
+
+/**
+ * Parse the UUID_STRING_LENGTH chars of canonical uuid text, in either case, into the 16 bytes of uuid
+ * @return false if the text is not a canonical uuid
+ */
+static inline bool uuidFromString(const char *text, uint8_t *uuid) {
+    if (text[8] != '-' || text[13] != '-' || text[18] != '-' || text[23] != '-')
+        return false;
+    char digits[2*HEX_BLOCK_SIZE];
+    memcpy(digits, text, 8);
+    memcpy(digits + 8, text + 9, 4);
+    memcpy(digits + 12, text + 14, 4);
+    memcpy(digits + 16, text + 19, 4);
+    memcpy(digits + 20, text + 24, 12);
+    return hexDecodeBlock(digits, uuid);
+}
+
+/**
+ * Format a 6 byte bdaddr, which is stored least significant byte first, as its canonical XX:XX:XX:XX:XX:XX text,
+ * the form of the bluez ba2str, followed by a null into out, which must hold BDADDR_STRING_LENGTH+1 chars
+ */
+static inline void bdaddrToString(const uint8_t *bdaddr, char *out) {
+    uint8_t block[HEX_BLOCK_SIZE] = {0};
+    for (int n = 0; n < 6; n ++)
+        block[n] = bdaddr[5 - n];
+    char digits[2*HEX_BLOCK_SIZE];
+    hexEncodeBlock(block, digits);
+    for (int n = 0; n < 6; n ++) {
+        out[3*n] = digits[2*n];
+        out[3*n+1] = digits[2*n+1];
+        out[3*n+2] = ':';
+    }
+    out[BDADDR_STRING_LENGTH] = 0;
+}
+
+/**
+ * Parse the BDADDR_STRING_LENGTH chars of XX:XX:XX:XX:XX:XX text, in either case, into the 6 bytes of bdaddr,
+ * least significant byte first
+ * @return false if the text is not a bdaddr
+ */
+static inline bool bdaddrFromString(const char *text, uint8_t *bdaddr) {
+    char digits[2*HEX_BLOCK_SIZE];
+    memset(digits, '0', sizeof(digits));
+    for (int n = 0; n < 6; n ++) {
+        if (n < 5 && text[3*n+2] != ':')
+            return false;
+        digits[2*n] = text[3*n];
+        digits[2*n+1] = text[3*n+1];
+    }
+    uint8_t block[HEX_BLOCK_SIZE];
+    if (!hexDecodeBlock(digits, block))
+        return false;
+    for (int n = 0; n < 6; n ++)
+        bdaddr[n] = block[5 - n];
+    return true;
+}
+
+#endif
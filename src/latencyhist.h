@@ -0,0 +1,177 @@
+#ifndef latencyhist_H
+#define latencyhist_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+
+// The latency_export_header.version, incremented when the layout changes
+#define LATENCY_EXPORT_VERSION 1
+// The bits of sub-bucket resolution within each power of two, 16 sub-buckets is a worst case error of 6.25%
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+// The largest power of two of ns recorded, larger values, about 18 minutes and up, are counted in the last bucket
+#define LATENCY_MAX_EXPONENT 40
+// Values below LATENCY_SUB_BUCKETS each have a bucket, above that each power of two has LATENCY_SUB_BUCKETS buckets
+#define LATENCY_BUCKETS ((LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKET_BITS + 2) * LATENCY_SUB_BUCKETS)
+
+// The latency_histograms of a scanner, in the order they are exported
+#define LATENCY_KERNEL_TO_PARSE 0
+#define LATENCY_PARSE 1
+#define LATENCY_CALLBACK 2
+#define LATENCY_UPCALL 3
+#define LATENCY_HISTOGRAMS 4
+
+static const char *latencyHistogramNames[LATENCY_HISTOGRAMS] = {
+    "kernel to parse", "parse", "callback", "java upcall"
+};
+
+/**
+ * An HDR style histogram of ns latencies with log linear buckets, so the relative precision is the same from a few
+ * ns up to minutes in a fixed array. Recording is an index computation and a counter store, with no allocation.
+ * Only one thread records into a histogram, other threads may read the counts at any time, but as the counts are
+ * not updated together a read taken while recording is under way can be a few samples apart between buckets.
+ */
+typedef struct latency_histogram {
+    std::atomic<uint64_t> counts[LATENCY_BUCKETS];
+    /** The largest value recorded */
+    std::atomic<uint64_t> max;
+
+    latency_histogram() : max(0) {
+        for (int n = 0; n < LATENCY_BUCKETS; n ++)
+            counts[n].store(0, std::memory_order_relaxed);
+    }
+} latency_histogram;
+
+/**
+ * The latency stages of a scanner, the kernel timestamp of a frame to the start of its parse, the parse, the native
+ * event callback and the java eventNotification round trip. All are recorded by the scan loop thread.
+ */
+typedef struct scan_latency {
+    latency_histogram histograms[LATENCY_HISTOGRAMS];
+} scan_latency;
+
+/**
+ * The header of the histograms as copied into the java ByteBuffer by getLatencyHistograms. It is followed by
+ * histograms * (buckets + 1) uint64_t, the bucket counts of each histogram followed by its max, in native endian.
+ */
+typedef struct latency_export_header {
+    /** LATENCY_EXPORT_VERSION */
+    uint32_t version;
+    /** LATENCY_HISTOGRAMS */
+    uint32_t histograms;
+    /** LATENCY_BUCKETS */
+    uint32_t buckets;
+    /** LATENCY_SUB_BUCKET_BITS, with which the range of each bucket can be computed, see latencyBucketLow */
+    uint32_t sub_bucket_bits;
+} latency_export_header;
+
+// The size of the getLatencyHistograms export
+#define LATENCY_EXPORT_SIZE \
+    (sizeof(latency_export_header) + LATENCY_HISTOGRAMS * (LATENCY_BUCKETS + 1) * sizeof(uint64_t))
+
+/**
+ * The bucket of a value in ns
+ */
+static inline uint32_t latencyBucket(uint64_t value) {
+    if (value < LATENCY_SUB_BUCKETS)
+        return value;
+    uint32_t exponent = 63 - __builtin_clzll(value);
+    if (exponent > LATENCY_MAX_EXPONENT)
+        return LATENCY_BUCKETS - 1;
+    uint32_t sub = (value >> (exponent - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+    return (exponent - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+/**
+ * The smallest value in ns counted in bucket
+ */
+static inline uint64_t latencyBucketLow(uint32_t bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS)
+        return bucket;
+    uint32_t exponent = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKET_BITS - 1;
+    uint64_t sub = bucket % LATENCY_SUB_BUCKETS;
+    return (1ull << exponent) | (sub << (exponent - LATENCY_SUB_BUCKET_BITS));
+}
+
+/**
+ * Record a value in ns, only called by the thread that owns the histogram
+ */
+static inline void latencyRecord(latency_histogram& histogram, uint64_t value) {
+    std::atomic<uint64_t>& count = histogram.counts[latencyBucket(value)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (value > histogram.max.load(std::memory_order_relaxed))
+        histogram.max.store(value, std::memory_order_relaxed);
+}
+
+/**
+ * The wall clock time in ns, the clock the kernel HCI_CMSG_TSTAMP is taken from
+ */
+static inline int64_t latencyRealtimeNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000ll + now.tv_nsec;
+}
+
+/**
+ * Copy the counts of the histograms to buffer in the getLatencyHistograms layout
+ * @return the bytes written, 0 if capacity is less than LATENCY_EXPORT_SIZE
+ */
+static inline uint64_t latencyExport(const scan_latency& latency, uint8_t *buffer, uint64_t capacity) {
+    if (capacity < LATENCY_EXPORT_SIZE)
+        return 0;
+    latency_export_header *header = (latency_export_header *) buffer;
+    header->version = LATENCY_EXPORT_VERSION;
+    header->histograms = LATENCY_HISTOGRAMS;
+    header->buckets = LATENCY_BUCKETS;
+    header->sub_bucket_bits = LATENCY_SUB_BUCKET_BITS;
+    uint64_t *counts = (uint64_t *) (header + 1);
+    for (int h = 0; h < LATENCY_HISTOGRAMS; h ++) {
+        const latency_histogram& histogram = latency.histograms[h];
+        for (int n = 0; n < LATENCY_BUCKETS; n ++)
+            *counts++ = histogram.counts[n].load(std::memory_order_relaxed);
+        *counts++ = histogram.max.load(std::memory_order_relaxed);
+    }
+    return LATENCY_EXPORT_SIZE;
+}
+
+/**
+ * The value at the given percentile, the low end of the bucket it falls in
+ */
+static inline uint64_t latencyPercentile(const latency_histogram& histogram, double percentile) {
+    uint64_t total = 0;
+    for (int n = 0; n < LATENCY_BUCKETS; n ++)
+        total += histogram.counts[n].load(std::memory_order_relaxed);
+    uint64_t rank = (uint64_t) (total * percentile / 100);
+    uint64_t seen = 0;
+    for (int n = 0; n < LATENCY_BUCKETS; n ++) {
+        seen += histogram.counts[n].load(std::memory_order_relaxed);
+        if (seen > rank)
+            return latencyBucketLow(n);
+    }
+    return histogram.max.load(std::memory_order_relaxed);
+}
+
+/**
+ * Print the sample count and the p50, p90, p99, p99.9 and max of a histogram in us
+ */
+static inline void printLatencyHistogram(const char *name, const latency_histogram& histogram) {
+    uint64_t total = 0;
+    for (int n = 0; n < LATENCY_BUCKETS; n ++)
+        total += histogram.counts[n].load(std::memory_order_relaxed);
+    printf("%-16s count=%lu, p50=%.1fus, p90=%.1fus, p99=%.1fus, p99.9=%.1fus, max=%.1fus\n", name, total,
+           latencyPercentile(histogram, 50) / 1000.0, latencyPercentile(histogram, 90) / 1000.0,
+           latencyPercentile(histogram, 99) / 1000.0, latencyPercentile(histogram, 99.9) / 1000.0,
+           histogram.max.load(std::memory_order_relaxed) / 1000.0);
+}
+
+/**
+ * Print each of the histograms of a scanner
+ */
+static inline void printScanLatency(const scan_latency& latency) {
+    for (int h = 0; h < LATENCY_HISTOGRAMS; h ++)
+        printLatencyHistogram(latencyHistogramNames[h], latency.histograms[h]);
+}
+
+#endif
@@ -33,6 +33,56 @@ extern "C" {
 #undef org_jboss_rhiot_beacon_bluez_HCIDump_time_OFFSET
 #define org_jboss_rhiot_beacon_bluez_HCIDump_time_OFFSET 72L
 
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_SIZEOF
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_SIZEOF 32L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_version_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_version_OFFSET 0L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_flags_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_flags_OFFSET 1L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_calibrated_power_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_calibrated_power_OFFSET 2L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_rssi_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_rssi_OFFSET 3L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_major_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_major_OFFSET 4L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_minor_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_minor_OFFSET 6L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_uuid_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_uuid_OFFSET 8L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_time_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BEACON_V2_time_OFFSET 24L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_SIZEOF
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_SIZEOF 56L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_time_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_time_OFFSET 0L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_version_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_version_OFFSET 8L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_flags_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_flags_OFFSET 9L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_keys_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_keys_OFFSET 10L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_rssi_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_rssi_OFFSET 11L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_bdaddr_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_bdaddr_OFFSET 12L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_battery_mv_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_battery_mv_OFFSET 18L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_temperature_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_temperature_OFFSET 20L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_lux_raw_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_lux_raw_OFFSET 22L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_adv_count_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_adv_count_OFFSET 24L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_sec_count_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_sec_count_OFFSET 28L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_lux_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_lux_OFFSET 32L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_temperature_c_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_temperature_c_OFFSET 36L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_gyro_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_gyro_OFFSET 40L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_accel_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_SENSOR_accel_OFFSET 46L
 #undef org_jboss_rhiot_beacon_bluez_HCIDump_ADI_total_length_OFFSET
 #define org_jboss_rhiot_beacon_bluez_HCIDump_ADI_total_length_OFFSET 0L
 #undef org_jboss_rhiot_beacon_bluez_HCIDump_ADI_bdaddr_type_OFFSET
@@ -47,22 +97,54 @@ extern "C" {
 #define org_jboss_rhiot_beacon_bluez_HCIDump_ADI_time_OFFSET 16L
 #undef org_jboss_rhiot_beacon_bluez_HCIDump_ADI_data_OFFSET
 #define org_jboss_rhiot_beacon_bluez_HCIDump_ADI_data_OFFSET 24L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BATCH_MAX_RECORDS
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BATCH_MAX_RECORDS 64L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BATCH_count_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BATCH_count_OFFSET 0L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BATCH_length_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BATCH_length_OFFSET 4L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_BATCH_offsets_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_BATCH_offsets_OFFSET 8L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_HEADER_SIZE
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_HEADER_SIZE 256L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_magic_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_magic_OFFSET 0L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_capacity_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_capacity_OFFSET 4L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_data_offset_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_data_offset_OFFSET 8L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_drops_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_drops_OFFSET 16L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_head_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_head_OFFSET 64L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_tail_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_tail_OFFSET 128L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_consumer_waiting_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_consumer_waiting_OFFSET 192L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_wake_seq_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_wake_seq_OFFSET 196L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_RECORD_length_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_RECORD_length_OFFSET 0L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_RECORD_type_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_RECORD_type_OFFSET 4L
+#undef org_jboss_rhiot_beacon_bluez_HCIDump_RING_RECORD_data_OFFSET
+#define org_jboss_rhiot_beacon_bluez_HCIDump_RING_RECORD_data_OFFSET 8L
 
 /*
  * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
  * Method:    allocScanner
- * Signature: (Ljava/nio/ByteBuffer;IZ)V
+ * Signature: (Ljava/nio/ByteBuffer;IZ)J
  */
-JNIEXPORT void JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_allocScanner
+JNIEXPORT jlong JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_allocScanner
         (JNIEnv *, jclass, jobject, jint, jboolean);
 
 /*
  * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
  * Method:    freeScanner
- * Signature: ()V
+ * Signature: (J)V
  */
 JNIEXPORT void JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_freeScanner
-        (JNIEnv *, jclass);
+        (JNIEnv *, jclass, jlong);
 
 /*
  * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
@@ -72,6 +154,78 @@ JNIEXPORT void JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_freeScanner
 JNIEXPORT void JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_enableDebugMode
         (JNIEnv *, jclass, jboolean);
 
+/*
+ * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
+ * Method:    enableBatchMode
+ * Signature: (II)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_enableBatchMode
+        (JNIEnv *, jclass, jint, jint);
+
+/*
+ * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
+ * Method:    enableRingMode
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_enableRingMode
+        (JNIEnv *, jclass, jboolean);
+
+/*
+ * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
+ * Method:    enableBeaconRecords
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_enableBeaconRecords
+        (JNIEnv *, jclass, jint);
+
+/*
+ * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
+ * Method:    enableSensorRecords
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_enableSensorRecords
+        (JNIEnv *, jclass, jboolean);
+
+/*
+ * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
+ * Method:    flushEvents
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_flushEvents
+        (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
+ * Method:    enableCapture
+ * Signature: (Ljava/lang/String;JII)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_enableCapture
+        (JNIEnv *, jclass, jstring, jlong, jint, jint);
+
+/*
+ * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
+ * Method:    waitForEvents
+ * Signature: (JJ)Z
+ */
+JNIEXPORT jboolean JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_waitForEvents
+        (JNIEnv *, jclass, jlong, jlong);
+
+/*
+ * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
+ * Method:    getStats
+ * Signature: (JLjava/nio/ByteBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_getStats
+        (JNIEnv *, jclass, jlong, jobject);
+
+/*
+ * Class:     org_jboss_rhiot_beacon_bluez_HCIDump
+ * Method:    getLatencyHistograms
+ * Signature: (JLjava/nio/ByteBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_org_jboss_rhiot_beacon_bluez_HCIDump_getLatencyHistograms
+        (JNIEnv *, jclass, jlong, jobject);
+
 #ifdef __cplusplus
 }
 #endif
@@ -2,149 +2,94 @@
 #include <stdlib.h>
 #include "org_jboss_rhiot_ble_bluez_HCIDump.h"
 #include "hcidumpinternal.h"
-#include <chrono>
-#include <thread>
+#include "scannercontext.h"
 #include <mutex>
-#include <condition_variable>
 
 using namespace std;
 
-extern JavaVM *theVM;
-//
-static jboolean useAdData = true;
-// the beacon_info pointer shared with java as a direct ByteBuffer when using the beacon oriented scanner
-static beacon_info *javaBeaconInfo;
-// The ad_data_inline pointer shared with java as a direct ByteBuffer when using the general scanner
-static ad_data_inline *javaAdData;
-
-static jobject byteBufferObj;
-// a cached object handle to the org.jboss.summit2015.ble.bluez.HCIDump class
-static jclass hcidumpClass;
-// The JNIEnv passed to the initBuffer native method
-static JNIEnv *javaEnv = nullptr;
-static jmethodID eventNotification;
-
-// A mutex to isolate the event thread from calls to freeScanner/allocScanner
-static mutex allocMutex;
-
-// A stop flag from hcidumpinternal.cpp
-extern bool stop_scan_frames;
-extern std::mutex exitLoopMutex;
-extern std::condition_variable exitLoopCV;
+// The delivery settings applied to the next scanner allocated by allocScanner
+static scanner_settings settings;
 
-// The callback for the
-extern "C" bool ble_event_callback_to_java(beacon_info * info);
-extern "C" bool ble_ad_event_callback_to_java(ad_data_inline& info);
+// A mutex to isolate calls to freeScanner/allocScanner
+static mutex allocMutex;
 
-/**
- * Called by the scanner thread entry points to attach the thread to the JavaVM and allocate the
- * direct ByteBuffer to javaBeaconInfo mapping.
+/*
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    allocScanner
+ * Signature: (Ljava/nio/ByteBuffer;IZ)J
  */
-static void attachToJavaVM() {
-    if(javaEnv == nullptr) {
-        // We need to attach this thread the to jvm
-        int status;
-        if ((status = theVM->GetEnv((void**)&javaEnv, JNI_VERSION_1_8)) < 0) {
-            if ((status = theVM->AttachCurrentThreadAsDaemon((void**)&javaEnv, nullptr)) < 0) {
-                return;
-            }
-        }
-        //
-        if(useAdData) {
-            javaAdData = (ad_data_inline *) javaEnv->GetDirectBufferAddress(byteBufferObj);
-            memset(javaAdData, 0, sizeof(ad_data_inline));
-        } else {
-            javaBeaconInfo = (beacon_info *) javaEnv->GetDirectBufferAddress(byteBufferObj);
-            memset(javaBeaconInfo, 0, sizeof(beacon_info));
-        }
-    }
+JNIEXPORT jlong JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_allocScanner
+        (JNIEnv *env, jclass clazz, jobject bb, jint device, jboolean isGeneral) {
+    std::lock_guard<mutex> guard(allocMutex);
+    LOG_INFO("begin Java_org_jboss_rhiot_ble_bluez_HCIDump_allocScanner(%p,%p,%p)", env, clazz, bb);
+    scanner_context *context = allocScannerContext(env, clazz, bb, device, settings);
+    LOG_INFO("end Java_org_jboss_rhiot_ble_bluez_HCIDump_allocScanner, hci%d, context=%p", device, context);
+    return toHandle(context);
 }
 
 /**
- * Simple test event generator function to validate callback into java
+ * Stop and release the scanner. A thread blocked in waitForEvents is woken, and the handle must not be passed to
+ * waitForEvents, getStats, flushEvents or any other method once this returns.
+ *
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    freeScanner
+ * Signature: (J)V
  */
-static void eventGenerator() {
-    attachToJavaVM();
-    beacon_info info;
-    // Initialize common data
-    strcpy(info.uuid, "DAF246CEF20111E4B116123B93F75CBA");
-    info.calibrated_power = -38;
-    info.code = 1;
-    info.isHeartbeat = false;
-    info.count = 0;
-    info.major = 12345;
-    info.minor = 11111;
-    info.power = -48;
-    info.rssi = -50;
-    for(int n = 0; n < 100; n ++) {
-        chrono::milliseconds now = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch());
-        info.count ++;
-        info.time = now.count();
-        ble_event_callback_to_java(&info);
-    }
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_freeScanner
+        (JNIEnv *env, jclass clazz, jlong handle) {
+    std::lock_guard<mutex> guard(allocMutex);
+    LOG_INFO("begin Java_org_jboss_rhiot_ble_bluez_HCIDump_freeScanner(%p,%p)", env, clazz);
+    freeScannerContext(env, fromHandle(handle));
+    LOG_INFO("end Java_org_jboss_rhiot_ble_bluez_HCIDump_freeScanner(%p,%p)", env, clazz);
 }
 
-// Flag to cause wait loop for debugger to attach to the java process
-static bool waiting = false;
-
-/**
- * The thread entry point for running the hcidump scanning loop
- * @param device the numeric value of the host controller interface instance to scan
+/*
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    allocPollScanner
+ * Signature: (II)J
  */
-static void runScanner(int device) {
-    // Connect this thread to the JavaVM instance
-    attachToJavaVM();
-    while(waiting)
-        this_thread::yield();
-    if(useAdData)
-        scan_for_ad_events_inline(device, ble_ad_event_callback_to_java);
-    else
-        scan_frames(device, ble_event_callback_to_java);
+JNIEXPORT jlong JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_allocPollScanner
+        (JNIEnv *env, jclass clazz, jint device, jint queueCapacity) {
+    std::lock_guard<mutex> guard(allocMutex);
+    LOG_INFO("begin Java_org_jboss_rhiot_ble_bluez_HCIDump_allocPollScanner(%d, %d)", device, queueCapacity);
+    return toHandle(allocPollScannerContext(device, queueCapacity, settings));
 }
 
-JNIEXPORT void JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_allocScanner
-        (JNIEnv *env, jclass clazz, jobject bb, jint device, jboolean isGeneral) {
+/*
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    freePollScanner
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_freePollScanner
+        (JNIEnv *env, jclass clazz, jlong handle) {
     std::lock_guard<mutex> guard(allocMutex);
-    printf("begin Java_org_jboss_rhiot_ble_bluez_HCIDump_allocScanner(%x,%x,%x)\n", env, clazz, bb);
-    // Create global references to the ByteBuffer and HCIDump class for use in other native threads
-    byteBufferObj = (jobject) env->NewGlobalRef(bb);
-    hcidumpClass = (jclass) env->NewGlobalRef(clazz);
-    eventNotification = env->GetStaticMethodID(hcidumpClass, "eventNotification", "()Z");
-    if(eventNotification == nullptr) {
-        fprintf(stderr, "Failed to lookup eventNotification()Z on: jclass=%s", clazz);
-        exit(1);
-    }
-    printf("Found eventNotification=%x\n", eventNotification);
-
-    thread::id tid;
-#if 0
-    // Simple test thread
-    thread t(eventGenerator, device);
-#else
-    // Run the scanner
-    stop_scan_frames = false;
-    thread t(runScanner, device);
-#endif
-    tid = t.get_id();
-    t.detach();
-    printf("end Java_org_jboss_rhiot_ble_bluez_HCIDump_allocScanner, tid=%x, hcidumpClassRef=%x, eventNotification=%x\n", tid, hcidumpClass, eventNotification);
+    LOG_INFO("begin Java_org_jboss_rhiot_ble_bluez_HCIDump_freePollScanner");
+    freeScannerContext(env, fromHandle(handle));
 }
 
-JNIEXPORT void JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_freeScanner
-        (JNIEnv *env, jclass clazz) {
-    std::lock_guard<mutex> guard(allocMutex);
-    printf("begin Java_org_jboss_rhiot_ble_bluez_HCIDump_freeScanner(%x,%x)\n", env, clazz);
-    // Notify the scanner loop it should exit and wait for it to signal it has done so
-    std::unique_lock<std::mutex> exitLock(exitLoopMutex);
-    stop_scan_frames = true;
-    exitLoopCV.wait(exitLock);
-    printf("notified that scan loop has exited\n");
-
-    // Clean up JVM data
-    javaEnv->DeleteGlobalRef(hcidumpClass);
-    javaEnv->DeleteGlobalRef(byteBufferObj);
-    javaEnv = nullptr;
-    printf("end Java_org_jboss_rhiot_ble_bluez_HCIDump_freeScanner(%x,%x)\n", env, clazz);
+/**
+ * Wait up to timeoutMS for events from the polling scanner and write up to maxEvents of them into dst using the
+ * event_batch_header layout of the batched delivery mode.
+ *
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    pollEvents
+ * Signature: (JLjava/nio/ByteBuffer;IJ)I
+ * @return the number of events written, -1 if the scanner is not running or dst is too small
+ */
+JNIEXPORT jint JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_pollEvents
+        (JNIEnv *env, jclass clazz, jlong handle, jobject dst, jint maxEvents, jlong timeoutMS) {
+    scanner_context *context = fromHandle(handle);
+    if(context == nullptr)
+        return -1;
+    void *address = env->GetDirectBufferAddress(dst);
+    jlong capacity = env->GetDirectBufferCapacity(dst);
+    event_batch batch;
+    if(address == nullptr || !batchInit(batch, address, capacity, maxEvents, 0, AD_DATA_INLINE_MAX_SIZE)) {
+        LOG_ERROR("pollEvents requires a direct ByteBuffer of at least %ld bytes",
+                  sizeof(event_batch_header) + AD_DATA_INLINE_MAX_SIZE);
+        return -1;
+    }
+    return queuePoll(context->pollQueue, batch, timeoutMS);
 }
 
 /*
@@ -158,45 +103,171 @@ JNIEXPORT void JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_enableDebugMode
     hcidumpDebugMode = flag;
 }
 
+/*
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    enableBatchMode
+ * Signature: (II)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_enableBatchMode
+        (JNIEnv *env, jclass clazz, jint maxEvents, jint windowMS) {
+
+    std::lock_guard<mutex> guard(allocMutex);
+    settings.batchMaxEvents = maxEvents;
+    settings.batchWindowMS = windowMS;
+}
+
+/*
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    enableRingMode
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_enableRingMode
+        (JNIEnv *env, jclass clazz, jboolean flag) {
+
+    std::lock_guard<mutex> guard(allocMutex);
+    settings.ringMode = flag;
+}
+
 /**
-* Callback invoked by the hdidumpinternal.c code when a LE_ADVERTISING_REPORT event is seen on the stack. This
- * passes the event info back to java via the javaAdInfo/javaBeaconInfo pointer and returns the stop flag
- * indicator as returned by the event notification callback return value.
-*/
-static long eventCount = 0;
-extern "C" bool ble_event_callback_to_java(beacon_info * info) {
-    if(hcidumpDebugMode) {
-        printf("ble_event_callback_to_java(%ld: %s, code=%d, time=%lld)\n", eventCount, info->uuid, info->code,
-               info->time);
+ * Tee the raw frames of the scanners allocated after this call to rotating btsnoop files named
+ * prefix-hciN-NNNNNN.btsnoop, or stop capturing if prefix is null or empty
+ *
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    enableCapture
+ * Signature: (Ljava/lang/String;JII)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_enableCapture
+        (JNIEnv *env, jclass clazz, jstring prefix, jlong maxFileBytes, jint maxFileSeconds, jint maxFiles) {
+
+    std::lock_guard<mutex> guard(allocMutex);
+    settings.capture.prefix.clear();
+    if(prefix != nullptr) {
+        const char *chars = env->GetStringUTFChars(prefix, nullptr);
+        settings.capture.prefix = chars;
+        env->ReleaseStringUTFChars(prefix, chars);
     }
-    eventCount ++;
-    // Copy the event data to javaBeaconInfo
-    memcpy(javaBeaconInfo, info, sizeof(*info));
-    // Notify java that the buffer has been updated
-    jboolean stop = javaEnv->CallStaticBooleanMethod(hcidumpClass, eventNotification);
-    return stop == JNI_TRUE;
+    settings.capture.max_file_bytes = maxFileBytes;
+    settings.capture.max_file_seconds = maxFileSeconds;
+    settings.capture.max_files = maxFiles;
 }
 
-static inline const char* toHexString(uint8_t *data, uint8_t length) {
-    static char buffer[64];
-    char *loc = buffer;
-    for(int n = 0; n < length; n ++) {
-        sprintf(loc, "%.2X:", data[n]);
-        loc += 3;
+/**
+ * Deliver beacon records of the given version rather than ad_data_inline records from the scanners allocated after
+ * this call. Version 1 is the beacon_info record, BEACON_INFO_VERSION_2 the compact beacon_info_v2 record with the
+ * binary uuid at BEACON_V2_uuid_OFFSET, and 0 restores the ad_data_inline records.
+ *
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    enableBeaconRecords
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_enableBeaconRecords
+        (JNIEnv *env, jclass clazz, jint version) {
+
+    if(version < 0 || version > BEACON_INFO_VERSION_2) {
+        LOG_ERROR("Unsupported beacon record version(%d)", version);
+        return;
     }
-    *loc = 0;
-    return buffer;
+    std::lock_guard<mutex> guard(allocMutex);
+    settings.useAdData = version == 0;
+    settings.beaconInfoVersion = version;
+}
+
+/**
+ * Deliver sensor_record telemetry records of the Eddystone TLM and RHIoTTag frames from the scanners allocated after
+ * this call, in place of the ad_data_inline or beacon records. Events without telemetry frames are not delivered.
+ * The record fields are at the SENSOR_*_OFFSET offsets.
+ *
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    enableSensorRecords
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_enableSensorRecords
+        (JNIEnv *env, jclass clazz, jboolean enable) {
+
+    std::lock_guard<mutex> guard(allocMutex);
+    settings.sensorRecords = enable;
+}
+
+/**
+ * Ask the scanner to hand any partial batch to java now rather than when its batch window expires
+ *
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    flushEvents
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_flushEvents
+        (JNIEnv *env, jclass clazz, jlong handle) {
+
+    scanner_context *context = fromHandle(handle);
+    if(context != nullptr)
+        flushScannerContext(context);
+}
+
+/**
+ * Block the calling java consumer thread until the scanner publishes records to the ring or timeoutMS elapses, a
+ * negative timeoutMS waits until records arrive or the scanner is freed
+ *
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    waitForEvents
+ * Signature: (JJ)Z
+ * @return true if there are records to consume
+ */
+JNIEXPORT jboolean JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_waitForEvents
+        (JNIEnv *env, jclass clazz, jlong handle, jlong timeoutMS) {
+
+    scanner_context *context = fromHandle(handle);
+    if(context == nullptr || !context->useRing)
+        return false;
+    return ringWait(context->javaRing.header, timeoutMS);
 }
-extern "C" bool ble_ad_event_callback_to_java(ad_data_inline& info) {
-    if(hcidumpDebugMode) {
-        printf("ble_ad_event_callback_to_java(%ld: %s, time=%lld)\n", eventCount, toHexString(info.bdaddr, 6), info.time);
+
+/**
+ * Copy a consistent snapshot of the scanner stats, a scan_stats_snapshot, to the start of the direct ByteBuffer dst
+ *
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    getStats
+ * Signature: (JLjava/nio/ByteBuffer;)I
+ * @return the number of bytes written, -1 if dst is not a direct ByteBuffer large enough for the snapshot
+ */
+JNIEXPORT jint JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_getStats
+        (JNIEnv *env, jclass clazz, jlong handle, jobject dst) {
+
+    scanner_context *context = fromHandle(handle);
+    if(context == nullptr)
+        return -1;
+    void *address = env->GetDirectBufferAddress(dst);
+    jlong capacity = env->GetDirectBufferCapacity(dst);
+    if(address == nullptr || capacity < (jlong) sizeof(scan_stats_snapshot)) {
+        LOG_ERROR("getStats requires a direct ByteBuffer of at least %ld bytes", sizeof(scan_stats_snapshot));
+        return -1;
     }
+    scan_stats_snapshot snapshot;
+    scannerStats(context, snapshot);
+    memcpy(address, &snapshot, sizeof(snapshot));
+    return sizeof(snapshot);
+}
 
-    eventCount ++;
-    // Copy the event data to javaAdData
-    memcpy(javaAdData, &info, info.total_length);
+/**
+ * Copy the latency histograms of the scanner to the start of the direct ByteBuffer dst, a latency_export_header
+ * followed by the bucket counts and max of each histogram
+ *
+ * Class:     org_jboss_rhiot_ble_bluez_HCIDump
+ * Method:    getLatencyHistograms
+ * Signature: (JLjava/nio/ByteBuffer;)I
+ * @return the number of bytes written, -1 if dst is not a direct ByteBuffer large enough for the histograms
+ */
+JNIEXPORT jint JNICALL Java_org_jboss_rhiot_ble_bluez_HCIDump_getLatencyHistograms
+        (JNIEnv *env, jclass clazz, jlong handle, jobject dst) {
 
-    // Notify java that the buffer has been updated
-    jboolean stop = javaEnv->CallStaticBooleanMethod(hcidumpClass, eventNotification);
-    return stop == JNI_TRUE;
+    scanner_context *context = fromHandle(handle);
+    if(context == nullptr)
+        return -1;
+    void *address = env->GetDirectBufferAddress(dst);
+    jlong capacity = env->GetDirectBufferCapacity(dst);
+    if(address == nullptr || capacity < (jlong) LATENCY_EXPORT_SIZE) {
+        LOG_ERROR("getLatencyHistograms requires a direct ByteBuffer of at least %ld bytes",
+                  LATENCY_EXPORT_SIZE);
+        return -1;
+    }
+    return latencyExport(context->latency, (uint8_t *) address, capacity);
 }
@@ -0,0 +1,213 @@
+#include "parallelparser.h"
+#include "framesource.h"
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <queue>
+#include <thread>
+
+extern "C" {
+#ifdef LEGACY_BLUEZ
+// The bluetooth.h header uses an invalid syntax for c++-std11 to map it to __typeof__
+#define typeof __typeof__
+#endif
+#include "parser.h"
+#include <bluetooth.h>
+#include <hci.h>
+}
+
+namespace {
+
+/**
+ * An event parsed from a chunk, referencing its ad_data_inline record in the chunk arena
+ */
+struct chunk_event {
+    int64_t time;
+    /** The offset in 8 byte words of the record in the arena */
+    uint32_t offset;
+};
+
+/**
+ * The events parsed from one chunk of the archive
+ */
+struct chunk_result {
+    /** The ad_data_inline records, each padded to a multiple of 8 bytes so that their time fields stay aligned */
+    std::vector<uint64_t> arena;
+    std::vector<chunk_event> events;
+    uint64_t frames = 0;
+    long skipped = 0;
+};
+
+/**
+ * The queue of chunks dealt to a thread, as the range of chunk indexes packed as begin << 32 | end. The owning
+ * thread takes chunks from the front and other threads steal from the back, both with a compare and swap of the
+ * range. The padding keeps the ranges of different threads on separate cache lines.
+ */
+struct chunk_queue {
+    std::atomic<uint64_t> range;
+    uint64_t pad[7];
+};
+
+static inline uint64_t packRange(uint64_t begin, uint64_t end) {
+    return (begin << 32) | end;
+}
+
+/**
+ * Take the next chunk from the front of the queue
+ * @return the chunk index, or -1 if the queue is empty
+ */
+static int64_t takeFront(chunk_queue& queue) {
+    uint64_t range = queue.range.load();
+    while (true) {
+        uint64_t begin = range >> 32, end = range & 0xffffffff;
+        if (begin >= end)
+            return -1;
+        if (queue.range.compare_exchange_weak(range, packRange(begin + 1, end)))
+            return begin;
+    }
+}
+
+/**
+ * Steal the last chunk from the back of the queue
+ * @return the chunk index, or -1 if the queue is empty
+ */
+static int64_t takeBack(chunk_queue& queue) {
+    uint64_t range = queue.range.load();
+    while (true) {
+        uint64_t begin = range >> 32, end = range & 0xffffffff;
+        if (begin >= end)
+            return -1;
+        if (queue.range.compare_exchange_weak(range, packRange(begin, end - 1)))
+            return end - 1;
+    }
+}
+
+static bool eventBefore(const chunk_event& a, const chunk_event& b) {
+    return a.time < b.time;
+}
+
+/**
+ * Parse the records in [begin, end) of the archive into result
+ */
+static void parseChunk(const mmap_frame_source& archive, size_t begin, size_t end, uint8_t *buf,
+                       chunk_result& result) {
+    mmap_frame_source source(archive, begin, end);
+    struct frame frm;
+    memset(&frm, 0, sizeof(frm));
+    ad_data_view event;
+    while (true) {
+        frm.data = buf;
+        int status = source.read_frame(&frm, HCI_MAX_FRAME_SIZE);
+        if (status == FRAME_SOURCE_NONE)
+            continue;
+        if (status < 0)
+            break;
+        result.frames ++;
+        if (parse_frame(&frm, event) != PARSE_ADV_REPORT)
+            continue;
+
+        size_t offset = result.arena.size();
+        size_t words = (inlineLength(event) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        result.arena.resize(offset + words);
+        writeInline(event, (uint8_t *) &result.arena[offset], words * sizeof(uint64_t));
+        chunk_event ce;
+        ce.time = event.time;
+        ce.offset = (uint32_t) offset;
+        result.events.push_back(ce);
+    }
+    result.skipped = source.getSkipped();
+    // Captures are almost always in time order already, so only sort the chunks that are not
+    if (!std::is_sorted(result.events.begin(), result.events.end(), eventBefore))
+        std::stable_sort(result.events.begin(), result.events.end(), eventBefore);
+}
+
+/**
+ * The parser thread loop, which parses the chunks of its own queue and then steals from the other queues until
+ * they are all empty. No chunks are added once the threads start, so a thread exits once it finds every queue empty.
+ */
+static void parseChunks(const mmap_frame_source& archive, const std::vector<size_t>& chunks,
+                        std::vector<chunk_queue>& queues, uint32_t self, std::vector<chunk_result>& results,
+                        std::atomic<uint32_t>& steals) {
+    std::vector<uint8_t> buf(HCI_MAX_FRAME_SIZE);
+    uint32_t threads = queues.size();
+    while (true) {
+        int64_t chunk = takeFront(queues[self]);
+        for (uint32_t n = 1; chunk < 0 && n < threads; n ++) {
+            chunk = takeBack(queues[(self + n) % threads]);
+            if (chunk >= 0)
+                steals ++;
+        }
+        if (chunk < 0)
+            break;
+        parseChunk(archive, chunks[chunk], chunks[chunk + 1], buf.data(), results[chunk]);
+    }
+}
+
+}
+
+int32_t parse_archive_parallel(const char *path, std::function<bool(ad_data_inline&)> callback,
+                               const parallel_parse_options& options, parallel_parse_stats *stats) {
+    mmap_frame_source archive;
+    if (archive.open(path) != 0)
+        return -1;
+
+    uint32_t threads = options.threads;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> chunks = archive.split(options.chunk_bytes > 0 ? options.chunk_bytes : 1);
+    uint32_t nchunks = chunks.size() - 1;
+    threads = std::min(threads, std::max(nchunks, 1u));
+
+    // Deal the chunks out in contiguous runs so each thread reads through its part of the archive in order
+    std::vector<chunk_queue> queues(threads);
+    for (uint32_t n = 0; n < threads; n ++) {
+        uint64_t begin = (uint64_t) nchunks * n / threads;
+        uint64_t end = (uint64_t) nchunks * (n + 1) / threads;
+        queues[n].range.store(packRange(begin, end));
+    }
+
+    std::vector<chunk_result> results(nchunks);
+    std::atomic<uint32_t> steals(0);
+    std::vector<std::thread> pool;
+    for (uint32_t n = 1; n < threads; n ++)
+        pool.push_back(std::thread(parseChunks, std::cref(archive), std::cref(chunks), std::ref(queues), n,
+                                   std::ref(results), std::ref(steals)));
+    parseChunks(archive, chunks, queues, 0, results, steals);
+    for (std::thread& thread : pool)
+        thread.join();
+
+    parallel_parse_stats totals;
+    memset(&totals, 0, sizeof(totals));
+    totals.chunks = nchunks;
+    totals.threads = threads;
+    totals.steals = steals;
+    for (const chunk_result& result : results) {
+        totals.frames += result.frames;
+        totals.events += result.events.size();
+        totals.skipped += result.skipped;
+    }
+    if (stats)
+        *stats = totals;
+    LOG_INFO("parsed %lu frames, %lu events from %u chunks on %u threads, steals=%u", totals.frames, totals.events,
+             nchunks, threads, totals.steals);
+
+    // Merge the time ordered events of each chunk, the chunk index breaks ties so equal times keep archive order
+    typedef std::pair<int64_t, uint32_t> merge_head;
+    std::priority_queue<merge_head, std::vector<merge_head>, std::greater<merge_head>> heads;
+    std::vector<size_t> cursors(nchunks, 0);
+    for (uint32_t n = 0; n < nchunks; n ++) {
+        if (!results[n].events.empty())
+            heads.push(merge_head(results[n].events[0].time, n));
+    }
+    while (!heads.empty()) {
+        uint32_t n = heads.top().second;
+        heads.pop();
+        chunk_result& result = results[n];
+        ad_data_inline *event = (ad_data_inline *) &result.arena[result.events[cursors[n]].offset];
+        if (callback(*event))
+            break;
+        if (++cursors[n] < result.events.size())
+            heads.push(merge_head(result.events[cursors[n]].time, n));
+    }
+    return 0;
+}
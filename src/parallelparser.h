@@ -0,0 +1,52 @@
+#ifndef parallelparser_H
+#define parallelparser_H
+
+#include <stdint.h>
+#include <functional>
+#include "hcidumpinternal.h"
+
+/**
+ * Options for parsing a capture archive on several threads
+ */
+typedef struct parallel_parse_options {
+    /** The number of parser threads, 0 = one per hardware thread */
+    uint32_t threads = 0;
+    /** The approximate size in bytes of the record aligned chunks the archive is split into and parsed as a unit */
+    uint32_t chunk_bytes = 4 * 1024 * 1024;
+} parallel_parse_options;
+
+/**
+ * The counters of a parse_archive_parallel run
+ */
+typedef struct parallel_parse_stats {
+    /** The number of frames read and parsed */
+    uint64_t frames;
+    /** The number of advertising events parsed from the frames */
+    uint64_t events;
+    /** The number of records skipped because they were truncated or too large */
+    uint64_t skipped;
+    /** The number of chunks the archive was split into */
+    uint32_t chunks;
+    /** The number of threads the chunks were parsed on */
+    uint32_t threads;
+    /** The number of chunks a thread took from the queue of another thread */
+    uint32_t steals;
+} parallel_parse_stats;
+
+/**
+ * Parse the advertising events of a btsnoop capture archive on a pool of threads. The memory mapped archive is split
+ * into record aligned chunks that are dealt out to the threads in contiguous runs, and a thread that runs out of
+ * chunks steals from the end of the run of another, so threads stay busy when chunks parse at different rates. Each
+ * chunk collects its events as ad_data_inline records, and once all chunks are parsed the events are merged and
+ * passed to the callback in timestamp order, with events of the same time in archive order. The events of the whole
+ * archive are held in memory until the merge.
+ * @param path the btsnoop capture file
+ * @param callback the callback passed each event, returns true to stop
+ * @param options the threads and chunk size to use
+ * @param stats optional counters of the run
+ * @return 0 on success, -1 if the archive could not be mapped
+ */
+int32_t parse_archive_parallel(const char *path, std::function<bool(ad_data_inline&)> callback,
+                               const parallel_parse_options& options, parallel_parse_stats *stats = nullptr);
+
+#endif
@@ -0,0 +1,411 @@
+#include <string.h>
+#include <stdlib.h>
+#include "scannercontext.h"
+#include "telemetry.h"
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+// The JavaVM set by JNI_OnLoad
+extern JavaVM *theVM;
+
+// Flag to cause wait loop for debugger to attach to the java process
+static bool waiting = false;
+
+// The sensor records of a batch are contiguous so they can be converted together, see flushBatchToJava
+static_assert(sizeof(sensor_record) % EVENT_BATCH_RECORD_ALIGN == 0, "sensor_record size is not batch aligned");
+
+/**
+ * Map the direct ByteBuffer and setup the batch or ring delivery mode requested by the scanner settings
+ */
+static void mapJavaBuffer(JNIEnv *env, scanner_context& context) {
+    scanner_settings& settings = context.settings;
+    context.javaBuffer = (uint8_t *) env->GetDirectBufferAddress(context.byteBufferObj);
+    context.javaBufferCapacity = env->GetDirectBufferCapacity(context.byteBufferObj);
+    uint32_t recordSize = AD_DATA_INLINE_MAX_SIZE;
+    if(settings.sensorRecords)
+        recordSize = sizeof(sensor_record);
+    else if(!settings.useAdData && settings.beaconInfoVersion == BEACON_INFO_VERSION_2)
+        recordSize = sizeof(beacon_info_v2);
+    else if(!settings.useAdData)
+        recordSize = sizeof(beacon_info);
+    memset(context.javaBuffer, 0, recordSize == AD_DATA_INLINE_MAX_SIZE ? sizeof(ad_data_inline) : recordSize);
+
+    if(settings.ringMode) {
+        context.useRing = ringInit(context.javaRing, context.javaBuffer, context.javaBufferCapacity, recordSize);
+        if(!context.useRing)
+            LOG_WARN("ByteBuffer capacity(%ld) too small for ring mode, sending single events",
+                     context.javaBufferCapacity);
+    } else if(settings.batchMaxEvents > 1) {
+        context.useBatch = batchInit(context.javaBatch, context.javaBuffer, context.javaBufferCapacity,
+                                     settings.batchMaxEvents, settings.batchWindowMS, recordSize);
+        if(!context.useBatch)
+            LOG_WARN("ByteBuffer capacity(%ld) too small for batch mode, sending single events",
+                     context.javaBufferCapacity);
+    }
+}
+
+/**
+ * Start the btsnoop capture of the scanner raw frames if the settings have a capture prefix. The device is added to
+ * the prefix so scanners of different devices do not write to the same files.
+ */
+static void openCapture(scanner_context& context) {
+    if(context.settings.capture.prefix.empty())
+        return;
+    capture_options options = context.settings.capture;
+    options.prefix += "-hci" + std::to_string(context.device);
+    context.capture = allocCaptureWriter(options);
+}
+
+/**
+ * Called by the scanner thread entry points to attach the thread to the JavaVM
+ */
+static bool attachToJavaVM(scanner_context& context) {
+    // We need to attach this thread the to jvm
+    int status;
+    if ((status = theVM->GetEnv((void**)&context.javaEnv, JNI_VERSION_1_8)) < 0) {
+        if ((status = theVM->AttachCurrentThreadAsDaemon((void**)&context.javaEnv, nullptr)) < 0) {
+            LOG_ERROR("Failed to attach scanner(hci%d) thread to the JavaVM, status=%d", context.device,
+                      status);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Call the eventNotification method of java, counting the call and its time in the scanner stats and latency
+ */
+static jboolean notifyJava(scanner_context& context) {
+    uint64_t start = statsNow();
+    jboolean stop = context.javaEnv->CallStaticBooleanMethod(context.hcidumpClass, context.eventNotification);
+    uint64_t elapsed = statsNow() - start;
+    statsBeginUpdate(context.stats);
+    statsAdd(context.stats.upcalls, 1);
+    statsAdd(context.stats.upcall_ns, elapsed);
+    statsEndUpdate(context.stats);
+    latencyRecord(context.latency.histograms[LATENCY_UPCALL], elapsed);
+    return stop;
+}
+
+/**
+ * Hand the current batch to java with a single eventNotification call and start a new batch. The lux and
+ * temperature of sensor records are converted here for the whole batch at once.
+ */
+static bool flushBatchToJava(scanner_context& context) {
+    event_batch_header *header = context.javaBatch.header;
+    if(context.settings.sensorRecords && header->count > 0)
+        convertSensorRecords((sensor_record *) ((uint8_t *) header + header->offsets[0]), header->count);
+    jboolean stop = notifyJava(context);
+    batchReset(context.javaBatch);
+    return stop == JNI_TRUE;
+}
+
+/**
+ * Get the location of the next record of size bytes in the batch, handing the batch to java first if it is full
+ */
+static uint8_t* reserveBatchRecord(scanner_context& context, uint32_t size, bool& stop) {
+    uint8_t *record = batchReserve(context.javaBatch, size);
+    if(record == nullptr) {
+        stop = flushBatchToJava(context);
+        record = batchReserve(context.javaBatch, size);
+    }
+    return record;
+}
+
+/**
+ * Pass a fixed size beacon record to java via the ring, batch or single record in the direct ByteBuffer
+ * @return the stop flag indicator as returned by the event notification callback return value
+ */
+static bool beaconRecordToJava(scanner_context& context, const void *info, uint32_t size, uint32_t ringType) {
+    context.eventCount ++;
+    if(context.useRing) {
+        // Publish to the ring for java to consume asynchronously, a full ring drops the event
+        uint8_t *record = ringReserve(context.javaRing, ringType, size);
+        if(record != nullptr) {
+            memcpy(record, info, size);
+            ringPublish(context.javaRing);
+        }
+        return false;
+    }
+    if(context.useBatch) {
+        bool stop = false;
+        uint8_t *record = reserveBatchRecord(context, size, stop);
+        memcpy(record, info, size);
+        batchCommit(context.javaBatch, record, size);
+        if(batchReady(context.javaBatch))
+            stop |= flushBatchToJava(context);
+        return stop;
+    }
+    // Copy the event data to the java buffer
+    memcpy(context.javaBuffer, info, size);
+    // Notify java that the buffer has been updated
+    return notifyJava(context) == JNI_TRUE;
+}
+
+/**
+* Callback invoked by the hdidumpinternal.c code when a LE_ADVERTISING_REPORT event is seen on the stack. This
+ * passes the event info back to java via the ring, batch or single record in the direct ByteBuffer and returns
+ * the stop flag indicator as returned by the event notification callback return value.
+*/
+static bool beaconEventToJava(scanner_context& context, beacon_info *info) {
+    if(logEnabled(LOG_LEVEL_DEBUG)) {
+        LOG_DEBUG("beaconEventToJava(hci%d, %ld: %s, code=%d, time=%lld)", context.device, context.eventCount,
+                  info->uuid, info->code, info->time);
+    }
+    return beaconRecordToJava(context, info, sizeof(*info), SPSC_RING_BEACON_INFO);
+}
+
+/**
+ * The beaconEventToJava of the compact beacon_info_v2 records
+ */
+static bool beaconV2EventToJava(scanner_context& context, beacon_info_v2 *info) {
+    if(logEnabled(LOG_LEVEL_DEBUG)) {
+        LOG_DEBUG("beaconV2EventToJava(hci%d, %ld: %s, flags=%d, time=%lld)", context.device, context.eventCount,
+                  logHex(info->uuid, UUID_SIZE), info->flags, info->time);
+    }
+    return beaconRecordToJava(context, info, sizeof(*info), SPSC_RING_BEACON_INFO_V2);
+}
+
+/**
+ * Pass the telemetry of an event to java as a sensor_record. Events without telemetry frames are skipped. Batched
+ * records are converted when the batch is flushed, others one at a time.
+ */
+static bool sensorEventToJava(scanner_context& context, ad_data_view& info) {
+    sensor_record record;
+    if(!decodeSensorRecord(info, record))
+        return false;
+    if(!context.useBatch)
+        convertSensorRecords(&record, 1);
+    if(logEnabled(LOG_LEVEL_DEBUG)) {
+        char addr[BDADDR_STRING_LENGTH + 1];
+        bdaddrToString(record.bdaddr, addr);
+        LOG_DEBUG("sensorEventToJava(hci%d, %ld: %s, flags=%d, time=%lld)", context.device, context.eventCount, addr,
+                  record.flags, record.time);
+    }
+    return beaconRecordToJava(context, &record, sizeof(record), SPSC_RING_SENSOR_RECORD);
+}
+
+static bool adEventToJava(scanner_context& context, ad_data_view& info) {
+    if(logEnabled(LOG_LEVEL_DEBUG)) {
+        char addr[BDADDR_STRING_LENGTH + 1];
+        bdaddrToString(info.bdaddr, addr);
+        LOG_DEBUG("adEventToJava(hci%d, %ld: %s, time=%lld)", context.device, context.eventCount, addr, info.time);
+    }
+
+    context.eventCount ++;
+    if(context.useRing) {
+        // Publish to the ring for java to consume asynchronously, a full ring drops the event
+        uint32_t length = inlineLength(info);
+        uint8_t *record = ringReserve(context.javaRing, SPSC_RING_AD_DATA_INLINE, length);
+        if(record != nullptr) {
+            writeInline(info, record, length);
+            ringPublish(context.javaRing);
+        }
+        return false;
+    }
+    if(context.useBatch) {
+        bool stop = false;
+        uint32_t length = inlineLength(info);
+        uint8_t *record = reserveBatchRecord(context, length, stop);
+        writeInline(info, record, length);
+        batchCommit(context.javaBatch, record, length);
+        if(batchReady(context.javaBatch))
+            stop |= flushBatchToJava(context);
+        return stop;
+    }
+    // Write the event directly into the java buffer in its ad_data_inline form
+    if(writeInline(info, context.javaBuffer, context.javaBufferCapacity) == 0) {
+        LOG_ERROR("ad_data_inline(%d bytes) exceeds ByteBuffer capacity(%ld), dropping event",
+                  inlineLength(info), context.javaBufferCapacity);
+        return false;
+    }
+
+    // Notify java that the buffer has been updated
+    return notifyJava(context) == JNI_TRUE;
+}
+
+/**
+ * Simple test event generator function to validate callback into java
+ */
+static void eventGenerator(scanner_context *context) {
+    if(!attachToJavaVM(*context))
+        return;
+    beacon_info info;
+    // Initialize common data
+    strcpy(info.uuid, "DAF246CEF20111E4B116123B93F75CBA");
+    info.calibrated_power = -38;
+    info.code = 1;
+    info.isHeartbeat = false;
+    info.count = 0;
+    info.major = 12345;
+    info.minor = 11111;
+    info.power = -48;
+    info.rssi = -50;
+    for(int n = 0; n < 100; n ++) {
+        chrono::milliseconds now = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch());
+        info.count ++;
+        info.time = now.count();
+        beaconEventToJava(*context, &info);
+    }
+    theVM->DetachCurrentThread();
+}
+
+/**
+ * The thread entry point for running the hcidump scanning loop of a scanner
+ */
+static void runScanner(scanner_context *context) {
+    // Connect this thread to the JavaVM instance
+    if(!attachToJavaVM(*context))
+        return;
+    while(waiting)
+        this_thread::yield();
+    scan_options options;
+    options.control = &context->control;
+    options.capture = context->capture;
+    options.stats = &context->stats;
+    options.latency = &context->latency;
+    // Only advertising reports are delivered, so leave everything else in the kernel unless capturing
+    options.le_meta_only = context->capture == nullptr;
+    options.adv_reports_only = context->capture == nullptr;
+    if(context->useBatch) {
+        // Hand a partial batch to java once its window expires even if no more events arrive
+        options.idle_timeout_ms = context->settings.batchWindowMS;
+        options.idle_callback = [context] {
+            return batchReady(context->javaBatch) ? flushBatchToJava(*context) : false;
+        };
+        // Wake when the window of the first event of a partial batch expires, rather than a whole window after the
+        // last poll, which could hold the batch for up to twice the window
+        options.idle_due_ms = [context] {
+            return batchDueMS(context->javaBatch, context->settings.batchWindowMS);
+        };
+        // Hand any partial batch to java as soon as a flush is requested
+        options.request_callback = [context](uint32_t requests) {
+            if((requests & SCAN_REQUEST_FLUSH) && context->javaBatch.header->count > 0)
+                return flushBatchToJava(*context);
+            return false;
+        };
+    }
+    if(context->settings.sensorRecords)
+        scan_for_ad_events_view(context->device, [context](ad_data_view& info) {
+            return sensorEventToJava(*context, info);
+        }, options);
+    else if(context->settings.useAdData)
+        scan_for_ad_events_view(context->device, [context](ad_data_view& info) {
+            return adEventToJava(*context, info);
+        }, options);
+    else if(context->settings.beaconInfoVersion == BEACON_INFO_VERSION_2)
+        scan_frames_v2(context->device, [context](beacon_info_v2 *info) {
+            return beaconV2EventToJava(*context, info);
+        }, options);
+    else
+        scan_frames(context->device, [context](beacon_info *info) {
+            return beaconEventToJava(*context, info);
+        }, options);
+    theVM->DetachCurrentThread();
+}
+
+/**
+ * The thread entry point for the polling scanner. This thread is not attached to the JavaVM, it only parses
+ * events into the pollQueue for java threads to drain with pollEvents.
+ */
+static void runPollScanner(scanner_context *context) {
+    scan_options options;
+    options.control = &context->control;
+    options.capture = context->capture;
+    options.stats = &context->stats;
+    options.latency = &context->latency;
+    // Only advertising reports are delivered, so leave everything else in the kernel unless capturing
+    options.le_meta_only = context->capture == nullptr;
+    options.adv_reports_only = context->capture == nullptr;
+    scan_for_ad_events_view(context->device, [context](ad_data_view& event) {
+        context->eventCount ++;
+        queuePush(context->pollQueue, event);
+        return false;
+    }, options);
+}
+
+scanner_context* allocScannerContext(JNIEnv *env, jclass clazz, jobject bb, jint device,
+                                     const scanner_settings& settings) {
+    scanner_context *context = new scanner_context;
+    context->device = device;
+    context->settings = settings;
+    // Create global references to the ByteBuffer and HCIDump class for use in other native threads
+    context->byteBufferObj = (jobject) env->NewGlobalRef(bb);
+    context->hcidumpClass = (jclass) env->NewGlobalRef(clazz);
+    context->eventNotification = env->GetStaticMethodID(context->hcidumpClass, "eventNotification", "()Z");
+    if(context->eventNotification == nullptr) {
+        LOG_ERROR("Failed to lookup eventNotification()Z on: jclass=%p", clazz);
+        exit(1);
+    }
+    LOG_INFO("Found eventNotification=%p", context->eventNotification);
+    mapJavaBuffer(env, *context);
+    openCapture(*context);
+
+#if 0
+    // Simple test thread
+    context->thread = thread(eventGenerator, context);
+#else
+    // Run the scanner
+    context->thread = thread(runScanner, context);
+#endif
+    return context;
+}
+
+scanner_context* allocPollScannerContext(jint device, jint queueCapacity, const scanner_settings& settings) {
+    scanner_context *context = new scanner_context;
+    context->device = device;
+    context->settings = settings;
+    openCapture(*context);
+    queueOpen(context->pollQueue, queueCapacity);
+    context->thread = thread(runPollScanner, context);
+    return context;
+}
+
+void flushScannerContext(scanner_context *context) {
+    postRequest(context->control, SCAN_REQUEST_FLUSH);
+}
+
+void scannerStats(scanner_context *context, scan_stats_snapshot& snapshot) {
+    scanStatsRead(context->stats, snapshot);
+    {
+        std::lock_guard<std::mutex> guard(context->pollQueue.mutex);
+        snapshot.queue_depth = context->pollQueue.count;
+        snapshot.event_drops = context->pollQueue.drops;
+    }
+    if(context->useRing) {
+        // The ring records vary in size, so its depth is the bytes java has yet to consume
+        spsc_ring_header *header = context->javaRing.header;
+        snapshot.queue_depth = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE)
+                               - __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+        snapshot.event_drops = __atomic_load_n(&header->drops, __ATOMIC_RELAXED);
+    }
+    if(context->capture)
+        snapshot.capture_drops = captureDrops(context->capture);
+}
+
+void freeScannerContext(JNIEnv *env, scanner_context *context) {
+    if(context == nullptr)
+        return;
+    // Notify the scanner loop it should exit, which wakes it immediately, and wait for it to do so
+    requestStop(context->control);
+    // Release a java consumer blocked in waitForEvents, which may be waiting without a timeout
+    if(context->useRing)
+        ringWake(context->javaRing.header);
+    if(context->thread.joinable())
+        context->thread.join();
+    LOG_INFO("scanner(hci%d) loop has exited, eventCount=%ld, drops=%ld", context->device, context->eventCount,
+             context->pollQueue.drops);
+
+    // Release any java threads waiting in pollEvents
+    queueClose(context->pollQueue);
+    if(context->capture != nullptr)
+        freeCaptureWriter(context->capture);
+    // Clean up JVM data
+    if(context->hcidumpClass != nullptr)
+        env->DeleteGlobalRef(context->hcidumpClass);
+    if(context->byteBufferObj != nullptr)
+        env->DeleteGlobalRef(context->byteBufferObj);
+    delete context;
+}
@@ -0,0 +1,113 @@
+#ifndef scannercontext_H
+#define scannercontext_H
+
+#include <jni.h>
+#include <stdint.h>
+#include <thread>
+#include "hcidumpinternal.h"
+#include "eventbatch.h"
+#include "eventqueue.h"
+#include "spscring.h"
+#include "capturewriter.h"
+
+/**
+ * The event delivery settings a JNI class applies to the next scanner it allocates
+ */
+typedef struct scanner_settings {
+    /** Deliver ad_data_inline records rather than beacon_info records */
+    bool useAdData = true;
+    /** The beacon_info record version delivered when useAdData is false, 1 or BEACON_INFO_VERSION_2 */
+    jint beaconInfoVersion = 1;
+    /** Deliver sensor_record telemetry records, taking precedence over useAdData, see enableSensorRecords */
+    bool sensorRecords = false;
+    /** Events are batched when batchMaxEvents > 1, see enableBatchMode */
+    jint batchMaxEvents = 1;
+    jint batchWindowMS = 100;
+    /** Events are published to an spsc ring when set, see enableRingMode */
+    jboolean ringMode = false;
+    /** Raw frames are teed to btsnoop files when capture.prefix is set, see enableCapture */
+    capture_options capture;
+} scanner_settings;
+
+/**
+ * The state of a single scanner instance. allocScanner returns a pointer to one of these to java as an opaque
+ * native handle, so one JavaVM can run a scanner per hci device, each with its own buffer, thread, stop signal
+ * and stats.
+ */
+typedef struct scanner_context {
+    /** The numeric value of the host controller interface instance being scanned */
+    int32_t device = 0;
+    /** The settings in effect when the scanner was allocated */
+    scanner_settings settings;
+    /** Global references to the direct ByteBuffer and HCIDump class for use in the scanner thread */
+    jobject byteBufferObj = nullptr;
+    jclass hcidumpClass = nullptr;
+    jmethodID eventNotification = nullptr;
+    /** The JNIEnv of the scanner thread once it has attached to the JavaVM */
+    JNIEnv *javaEnv = nullptr;
+    /** The address and capacity in bytes of the direct ByteBuffer shared with java */
+    uint8_t *javaBuffer = nullptr;
+    jlong javaBufferCapacity = 0;
+    /** The batch of events being built in the direct ByteBuffer in batch mode */
+    bool useBatch = false;
+    event_batch javaBatch;
+    /** The ring the scanner publishes events to in ring mode */
+    bool useRing = false;
+    spsc_ring_producer javaRing;
+    /** The queue a polling scanner feeds and pollEvents drains */
+    event_queue pollQueue;
+    /** The btsnoop writer raw frames are teed to, nullptr when capture is not enabled */
+    capture_writer *capture = nullptr;
+    /** The stop signal of the scan loop */
+    scan_control control;
+    /** The scanner thread */
+    std::thread thread;
+    /** The count of events seen by this scanner */
+    long eventCount = 0;
+    /** The hot path counters of the scanner thread */
+    scan_stats stats;
+    /** The latency histograms of the scanner thread */
+    scan_latency latency;
+} scanner_context;
+
+/**
+ * Allocate a scanner for device that delivers events to java through the direct ByteBuffer bb and the static
+ * eventNotification()Z method of clazz, and start its scanner thread.
+ */
+scanner_context* allocScannerContext(JNIEnv *env, jclass clazz, jobject bb, jint device,
+                                     const scanner_settings& settings);
+
+/**
+ * Allocate a scanner for device whose scanner thread is not attached to the JavaVM, and only parses events into
+ * a queue of queueCapacity events for java threads to drain with pollEvents. Only the capture settings apply.
+ */
+scanner_context* allocPollScannerContext(jint device, jint queueCapacity, const scanner_settings& settings);
+
+/**
+ * Ask the scanner thread to hand any partial batch to java without waiting for the batch window to expire
+ */
+void flushScannerContext(scanner_context *context);
+
+/**
+ * Copy a consistent snapshot of the scanner stats and its queue state, callable from any thread
+ */
+void scannerStats(scanner_context *context, scan_stats_snapshot& snapshot);
+
+/**
+ * Stop the scanner thread, wait for it to exit and release the scanner. A java consumer blocked in waitForEvents on
+ * the ring is woken, but java must not call waitForEvents, getStats or flushEvents with the handle once it is freed.
+ */
+void freeScannerContext(JNIEnv *env, scanner_context *context);
+
+/**
+ * Convert between the scanner_context and the native handle java holds. The JNI entry points fail or do nothing on
+ * the 0 handle of a scanner java never allocated.
+ */
+static inline jlong toHandle(scanner_context *context) {
+    return (jlong) (intptr_t) context;
+}
+static inline scanner_context* fromHandle(jlong handle) {
+    return (scanner_context *) (intptr_t) handle;
+}
+
+#endif
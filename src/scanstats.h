@@ -0,0 +1,131 @@
+#ifndef scanstats_H
+#define scanstats_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+// The scan_stats_snapshot.version, incremented when fields are added
+#define SCAN_STATS_VERSION 1
+
+/**
+ * The hot path counters of a scan loop. They are only written by the scan loop thread, so an update is a relaxed
+ * load and store rather than a locked read-modify-write, and other threads read them through scanStatsRead.
+ *
+ * The sequence is a seqlock, odd while the scan loop thread is in an update, so that a reader sees the counters
+ * of an update together, e.g. a frame together with its bytes. Updates never span a callback into java, so a
+ * reader only ever retries over a few stores.
+ *
+ * The counters share one cache line block written by one thread, and are padded off the neighbouring fields of
+ * the owning struct so readers polling the stats do not false share with them.
+ */
+typedef struct scan_stats {
+    uint8_t pad0[64];
+    std::atomic<uint32_t> sequence;
+    /** The count of frames read from the socket or frame source */
+    std::atomic<uint64_t> frames;
+    /** The bytes in those frames */
+    std::atomic<uint64_t> bytes;
+    /** The count of frames that parsed as LE advertising reports and were passed to the callback */
+    std::atomic<uint64_t> adv_reports;
+    /** The count of AD structures in those reports */
+    std::atomic<uint64_t> ad_structures;
+    /** The count of frames too short for the event they claimed to be */
+    std::atomic<uint64_t> parse_errors;
+    /** The count of frames that were not HCI events, or were events or LE subevents the parser does not know */
+    std::atomic<uint64_t> unknown_events;
+    /** The total time spent in the event callback */
+    std::atomic<uint64_t> callback_ns;
+    /** The count of eventNotification calls into java */
+    std::atomic<uint64_t> upcalls;
+    /** The total time spent in those calls, a part of the callback_ns */
+    std::atomic<uint64_t> upcall_ns;
+    uint8_t pad1[64];
+
+    scan_stats() : sequence(0), frames(0), bytes(0), adv_reports(0), ad_structures(0), parse_errors(0),
+                   unknown_events(0), callback_ns(0), upcalls(0), upcall_ns(0) {}
+} scan_stats;
+
+/**
+ * A copy of the scan_stats of a scanner along with its queue state, as copied into the java ByteBuffer by
+ * getStats. The layout is native endian with all fields naturally aligned.
+ */
+typedef struct scan_stats_snapshot {
+    /** SCAN_STATS_VERSION */
+    uint32_t version;
+    /** sizeof(scan_stats_snapshot) */
+    uint32_t size;
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t adv_reports;
+    uint64_t ad_structures;
+    uint64_t parse_errors;
+    uint64_t unknown_events;
+    uint64_t callback_ns;
+    uint64_t upcalls;
+    uint64_t upcall_ns;
+    /** The count of events waiting in the poll queue, or in ring mode the bytes of records waiting in the ring */
+    uint64_t queue_depth;
+    /** The count of events dropped because the poll queue or ring was full */
+    uint64_t event_drops;
+    /** The count of frames the capture writer dropped */
+    uint64_t capture_drops;
+} scan_stats_snapshot;
+
+/**
+ * Begin an update of the stats on the scan loop thread
+ */
+static inline void statsBeginUpdate(scan_stats& stats) {
+    stats.sequence.store(stats.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+/**
+ * End an update of the stats on the scan loop thread, publishing its counters to readers
+ */
+static inline void statsEndUpdate(scan_stats& stats) {
+    stats.sequence.store(stats.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/**
+ * Add value to a counter, only called by the scan loop thread between statsBeginUpdate and statsEndUpdate
+ */
+static inline void statsAdd(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+ * The monotonic clock the stats time the callbacks with
+ */
+static inline uint64_t statsNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Copy the counters of stats to snapshot from any thread, retrying while the scan loop thread is in an update.
+ * The queue fields are left to the caller.
+ */
+static inline void scanStatsRead(const scan_stats& stats, scan_stats_snapshot& snapshot) {
+    uint32_t sequence;
+    do {
+        sequence = stats.sequence.load(std::memory_order_acquire);
+        snapshot.frames = stats.frames.load(std::memory_order_relaxed);
+        snapshot.bytes = stats.bytes.load(std::memory_order_relaxed);
+        snapshot.adv_reports = stats.adv_reports.load(std::memory_order_relaxed);
+        snapshot.ad_structures = stats.ad_structures.load(std::memory_order_relaxed);
+        snapshot.parse_errors = stats.parse_errors.load(std::memory_order_relaxed);
+        snapshot.unknown_events = stats.unknown_events.load(std::memory_order_relaxed);
+        snapshot.callback_ns = stats.callback_ns.load(std::memory_order_relaxed);
+        snapshot.upcalls = stats.upcalls.load(std::memory_order_relaxed);
+        snapshot.upcall_ns = stats.upcall_ns.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((sequence & 1) != 0 || sequence != stats.sequence.load(std::memory_order_relaxed));
+    snapshot.version = SCAN_STATS_VERSION;
+    snapshot.size = sizeof(snapshot);
+    snapshot.queue_depth = 0;
+    snapshot.event_drops = 0;
+    snapshot.capture_drops = 0;
+}
+
+#endif
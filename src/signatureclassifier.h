@@ -0,0 +1,283 @@
+#ifndef signatureclassifier_H
+#define signatureclassifier_H
+
+#include <stdint.h>
+#include <string.h>
+#include "beacondecoder.h"
+
+/*
+ * A classifier of AD structures against a table of payload signatures. A signature is a masked match of the AD type
+ * and the first SIGNATURE_PREFIX_SIZE data bytes, plus a minimum data length. The table is stored a column per byte
+ * with one signature per vector lane, so a structure is matched against every signature of a block of
+ * SIGNATURE_LANES with the same SIGNATURE_BYTES broadcast, mask and compare steps, and the cost of classifying a
+ * frame depends on its count of AD structures, not on the count of registered formats. SIGNATURE_KERNEL names the
+ * implementation compiled in, SSE2 on x86, NEON on ARM, or a scalar loop over the lanes elsewhere.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SIGNATURE_KERNEL "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIGNATURE_KERNEL "neon"
+#else
+#define SIGNATURE_KERNEL "scalar"
+#endif
+
+// The count of AD structure data bytes a signature matches, enough for an id and a two byte subtype
+#define SIGNATURE_PREFIX_SIZE 4
+// The bytes a signature matches, the AD type followed by the data prefix
+#define SIGNATURE_BYTES (1 + SIGNATURE_PREFIX_SIZE)
+// The packed key of a structure holds the SIGNATURE_BYTES from its low byte up, followed by the data length
+#define SIGNATURE_KEY_LENGTH SIGNATURE_BYTES
+#define SIGNATURE_KEY_BYTE(key, b) ((uint8_t) ((key) >> 8*(b)))
+// The signatures matched by one kernel call
+#define SIGNATURE_LANES 16
+#define SIGNATURE_BLOCKS 2
+#define MAX_SIGNATURES (SIGNATURE_LANES * SIGNATURE_BLOCKS)
+// The format bitmask bits are 1 << format, so formats must be below this
+#define MAX_SIGNATURE_FORMATS 32
+
+/**
+ * A block of SIGNATURE_LANES signatures stored by column. A structure matches lane i when for every byte b
+ * (byte[b] & mask[b][i]) == value[b][i], and its data length is at least min_length[i].
+ */
+typedef struct signature_block {
+    uint8_t value[SIGNATURE_BYTES][SIGNATURE_LANES];
+    uint8_t mask[SIGNATURE_BYTES][SIGNATURE_LANES];
+    uint8_t min_length[SIGNATURE_LANES];
+} __attribute__((aligned(16))) signature_block;
+
+/**
+ * The signature table, the lanes past count never match
+ */
+typedef struct signature_table {
+    signature_block blocks[SIGNATURE_BLOCKS];
+    /** The bitmap of the AD types of the signatures, so the structures of other types skip the kernel */
+    uint32_t ad_types[256 / 32];
+    /** The format of each signature */
+    uint8_t format[MAX_SIGNATURES];
+    /** The count of signatures */
+    uint32_t count;
+} signature_table;
+
+/**
+ * Empty the table. The unused lanes expect an AD type of 0xff under a mask of 0, which no byte matches, as any byte
+ * masked with 0 is 0.
+ */
+static inline void initSignatureTable(signature_table& table) {
+    memset(&table, 0, sizeof(table));
+    for (int n = 0; n < SIGNATURE_BLOCKS; n ++)
+        memset(table.blocks[n].value[0], 0xff, SIGNATURE_LANES);
+}
+
+/**
+ * Add a signature matching the AD type and the prefixLength bytes of prefix under prefixMask, which may be null to
+ * match every bit. The minimum length is raised to the prefix length, so a match never depends on the padding of a
+ * short structure.
+ * @return false if the table is full or the format or prefix length is out of range
+ */
+static inline bool addSignature(signature_table& table, uint8_t adType, const uint8_t *prefix,
+                                const uint8_t *prefixMask, uint32_t prefixLength, uint8_t minLength, uint8_t format) {
+    if (table.count >= MAX_SIGNATURES || format >= MAX_SIGNATURE_FORMATS || prefixLength > SIGNATURE_PREFIX_SIZE)
+        return false;
+    signature_block& block = table.blocks[table.count / SIGNATURE_LANES];
+    uint32_t lane = table.count % SIGNATURE_LANES;
+    block.value[0][lane] = adType;
+    block.mask[0][lane] = 0xff;
+    for (uint32_t n = 0; n < SIGNATURE_PREFIX_SIZE; n ++) {
+        uint8_t mask = n >= prefixLength ? 0 : prefixMask != nullptr ? prefixMask[n] : 0xff;
+        block.mask[n + 1][lane] = mask;
+        block.value[n + 1][lane] = n < prefixLength ? prefix[n] & mask : 0;
+    }
+    block.min_length[lane] = minLength > prefixLength ? minLength : prefixLength;
+    table.ad_types[adType / 32] |= 1u << adType % 32;
+    table.format[table.count++] = format;
+    return true;
+}
+
+/**
+ * Add the signatures of the beaconDecoderKeys registry in its match order
+ */
+static inline void addBeaconSignatures(signature_table& table) {
+    for (uint32_t n = 0; n < BEACON_DECODER_KEYS; n ++) {
+        const beacon_decoder_key& key = beaconDecoderKeys[n];
+        uint8_t prefix[SIGNATURE_PREFIX_SIZE] = {(uint8_t) key.id, (uint8_t) (key.id >> 8), 0, 0};
+        uint8_t mask[SIGNATURE_PREFIX_SIZE] = {0xff, 0xff, 0xff, 0xff};
+        if (key.id == BEACON_ANY_ID)
+            mask[0] = mask[1] = 0;
+        if (key.sub_length == 1) {
+            prefix[2] = (uint8_t) key.sub;
+        } else {
+            prefix[2] = (uint8_t) (key.sub >> 8);
+            prefix[3] = (uint8_t) key.sub;
+        }
+        addSignature(table, key.ad_type, prefix, mask, 2 + key.sub_length, key.min_length, key.format);
+    }
+}
+
+/**
+ * The table of the beacon registry signatures, built on first use
+ */
+static inline const signature_table& beaconSignatureTable() {
+    static const signature_table table = [] {
+        signature_table beacons;
+        initSignatureTable(beacons);
+        addBeaconSignatures(beacons);
+        return beacons;
+    }();
+    return table;
+}
+
+/**
+ * Pack the AD type, the leading data bytes, zero padded past the data length, and the length of a structure into a
+ * key. The key is built in a register rather than in memory, so the kernel's vector load of it is not stalled
+ * waiting on byte stores.
+ */
+static inline uint64_t packSignatureKey(uint8_t adType, const uint8_t *data, uint8_t length) {
+    uint32_t prefix = 0;
+    if (length >= SIGNATURE_PREFIX_SIZE)
+        prefix = (uint32_t) data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24;
+    else
+        for (int n = 0; n < length; n ++)
+            prefix |= (uint32_t) data[n] << 8*n;
+    return adType | (uint64_t) prefix << 8 | (uint64_t) length << 8*SIGNATURE_KEY_LENGTH;
+}
+
+/**
+ * Match the packed key of a structure against the lanes of a block one lane at a time
+ * @return the bitmask of the matching lanes
+ */
+static inline uint32_t matchSignatureBlockScalar(const signature_block& block, uint64_t key) {
+    uint32_t matches = 0;
+    for (int lane = 0; lane < SIGNATURE_LANES; lane ++) {
+        bool match = SIGNATURE_KEY_BYTE(key, SIGNATURE_KEY_LENGTH) >= block.min_length[lane];
+        for (int b = 0; match && b < SIGNATURE_BYTES; b ++)
+            match = (SIGNATURE_KEY_BYTE(key, b) & block.mask[b][lane]) == block.value[b][lane];
+        matches |= (uint32_t) match << lane;
+    }
+    return matches;
+}
+
+#if defined(__SSE2__)
+/**
+ * Compare a broadcast key byte under the mask of a column against its values
+ */
+#define SIGNATURE_COLUMN_SSE2(block, keyBytes, b) _mm_cmpeq_epi8(_mm_and_si128(keyBytes, \
+    _mm_load_si128((const __m128i *) (block).mask[b])), _mm_load_si128((const __m128i *) (block).value[b]))
+
+static inline uint32_t matchSignatureBlock(const signature_block& block, uint64_t key) {
+    // Broadcast each key byte to a vector, doubling the bytes to words then dwords and shuffling a dword to all lanes
+    __m128i bytes = _mm_set_epi64x(0, (long long) key);
+    __m128i words = _mm_unpacklo_epi8(bytes, bytes);
+    __m128i low = _mm_unpacklo_epi16(words, words);
+    __m128i high = _mm_unpackhi_epi16(words, words);
+    __m128i lengths = _mm_shuffle_epi32(high, 0x55);
+    // An unsigned length >= min_length as max(length, min_length) == length
+    __m128i acc = _mm_cmpeq_epi8(_mm_max_epu8(lengths, _mm_load_si128((const __m128i *) block.min_length)), lengths);
+    acc = _mm_and_si128(acc, SIGNATURE_COLUMN_SSE2(block, _mm_shuffle_epi32(low, 0x00), 0));
+    acc = _mm_and_si128(acc, SIGNATURE_COLUMN_SSE2(block, _mm_shuffle_epi32(low, 0x55), 1));
+    acc = _mm_and_si128(acc, SIGNATURE_COLUMN_SSE2(block, _mm_shuffle_epi32(low, 0xaa), 2));
+    acc = _mm_and_si128(acc, SIGNATURE_COLUMN_SSE2(block, _mm_shuffle_epi32(low, 0xff), 3));
+    acc = _mm_and_si128(acc, SIGNATURE_COLUMN_SSE2(block, _mm_shuffle_epi32(high, 0x00), 4));
+    return (uint32_t) _mm_movemask_epi8(acc);
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+static inline uint32_t matchSignatureBlock(const signature_block& block, uint64_t key) {
+    static const uint8_t laneBits[SIGNATURE_LANES] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t acc = vcgeq_u8(vdupq_n_u8(SIGNATURE_KEY_BYTE(key, SIGNATURE_KEY_LENGTH)), vld1q_u8(block.min_length));
+    for (int b = 0; b < SIGNATURE_BYTES; b ++) {
+        uint8x16_t masked = vandq_u8(vdupq_n_u8(SIGNATURE_KEY_BYTE(key, b)), vld1q_u8(block.mask[b]));
+        acc = vandq_u8(acc, vceqq_u8(masked, vld1q_u8(block.value[b])));
+    }
+    // NEON has no movemask, so the lane bits are summed pairwise into the low byte of each half
+    uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vandq_u8(acc, vld1q_u8(laneBits)))));
+    return (uint32_t) (vgetq_lane_u64(sums, 0) | vgetq_lane_u64(sums, 1) << 8);
+}
+#else
+static inline uint32_t matchSignatureBlock(const signature_block& block, uint64_t key) {
+    return matchSignatureBlockScalar(block, key);
+}
+#endif
+
+/**
+ * Match an AD structure against every signature of the table
+ * @return the bitmask of the matching signatures, bit n for table.format[n]
+ */
+static inline uint32_t matchSignatures(const signature_table& table, uint8_t adType, const uint8_t *data,
+                                       uint8_t length) {
+    if ((table.ad_types[adType / 32] >> adType % 32 & 1) == 0)
+        return 0;
+    uint64_t key = packSignatureKey(adType, data, length);
+    uint32_t matches = 0;
+    for (uint32_t n = 0; n * SIGNATURE_LANES < table.count; n ++)
+        matches |= matchSignatureBlock(table.blocks[n], key) << (n * SIGNATURE_LANES);
+    return matches;
+}
+
+/**
+ * The bitmask of the formats, 1 << format, of a signature bitmask
+ */
+static inline uint32_t signatureFormats(const signature_table& table, uint32_t matches) {
+    uint32_t formats = 0;
+    for (; matches != 0; matches &= matches - 1)
+        formats |= 1u << table.format[__builtin_ctz(matches)];
+    return formats;
+}
+
+/**
+ * The format of the first signature of a signature bitmask in table order, as matched by findBeaconDecoder for the
+ * beacon table, or BEACON_FORMAT_NONE if there is none
+ */
+static inline uint8_t firstSignatureFormat(const signature_table& table, uint32_t matches) {
+    return matches == 0 ? BEACON_FORMAT_NONE : table.format[__builtin_ctz(matches)];
+}
+
+/**
+ * Classify every AD structure of an event, formats[n] is given the bitmask of the formats the nth structure matches
+ * and matches[n], if not null, the bitmask of its matching signatures
+ * @return the bitmask of the formats matched by any structure
+ */
+static inline uint32_t classifyAdStructures(const signature_table& table, const ad_data_view& event,
+                                            uint32_t *formats, uint32_t *matches = nullptr) {
+    uint32_t any = 0;
+    for (int n = 0; n < event.count; n ++) {
+        uint32_t signatures = matchSignatures(table, event.data[n].type, ad_view_data(event, n), event.data[n].length);
+        formats[n] = signatureFormats(table, signatures);
+        if (matches != nullptr)
+            matches[n] = signatures;
+        any |= formats[n];
+    }
+    return any;
+}
+
+/**
+ * Classify the AD structures of an event against the beacon signature table and decode those of a registry format,
+ * an event without any is rejected after the one classification pass. The beacon records are given the rssi and
+ * time of the event.
+ * @return the count of records written to records, at most capacity
+ */
+static inline uint32_t decodeBeacons(const ad_data_view& event, beacon_record *records, uint32_t capacity) {
+    const signature_table& beacons = beaconSignatureTable();
+    uint32_t formats[MAX_AD_STRUCTURES];
+    uint32_t matches[MAX_AD_STRUCTURES];
+    if (classifyAdStructures(beacons, event, formats, matches) == 0)
+        return 0;
+    uint32_t count = 0;
+    for (int n = 0; n < event.count && count < capacity; n ++) {
+        uint8_t format = firstSignatureFormat(beacons, matches[n]);
+        if (format == BEACON_FORMAT_NONE)
+            continue;
+        beacon_record& record = records[count];
+        record.ad_index = n;
+        if (!decodeAdStructure(format, ad_view_data(event, n), event.data[n].length, record))
+            continue;
+        count ++;
+        if (format == BEACON_FORMAT_IBEACON || format == BEACON_FORMAT_ALTBEACON) {
+            record.beacon.rssi = (int8_t) event.rssi;
+            record.beacon.time = event.time;
+        }
+    }
+    return count;
+}
+
+#endif
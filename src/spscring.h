@@ -0,0 +1,234 @@
+#ifndef spscring_H
+#define spscring_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// The value of spsc_ring_header.magic once the native side has initialized the ring
+#define SPSC_RING_MAGIC 0x52494E47
+// The size of the ring header, the record area starts at this offset in the buffer
+#define SPSC_RING_HEADER_SIZE 256
+// The size of the spsc_ring_record prefix and the alignment of each record
+#define SPSC_RING_RECORD_ALIGN 8
+
+// The spsc_ring_record.type values
+#define SPSC_RING_PADDING 0
+#define SPSC_RING_AD_DATA_INLINE 1
+#define SPSC_RING_BEACON_INFO 2
+#define SPSC_RING_BTSNOOP_PKT 3
+#define SPSC_RING_BEACON_INFO_V2 4
+#define SPSC_RING_SENSOR_RECORD 5
+
+/**
+ * The header of a single producer/single consumer ring of records laid out in a direct ByteBuffer shared with
+ * java. The head and tail are free running byte positions, a record starts at position & (capacity-1).
+ *
+ * The native scanner thread is the producer. It writes records at head and then advances head with release
+ * semantics. Java is the consumer. It reads head with acquire semantics, walks the records from tail up to head,
+ * and then advances tail with release semantics. Neither side takes a lock or makes a JNI call in steady state.
+ * A consumer that finds the ring empty can block in ringWait, which sets consumer_waiting and waits on the
+ * wake_seq futex until the producer publishes more records.
+ *
+ * The head, tail and wait fields are on separate cache lines so the producer and consumer do not false share.
+ */
+typedef struct spsc_ring_header {
+    /** SPSC_RING_MAGIC once initialized, java must not read the other fields until it sees this */
+    uint32_t magic;
+    /** The size in bytes of the record area, a power of two */
+    uint32_t capacity;
+    /** The offset of the record area from the start of the header */
+    uint32_t data_offset;
+    uint32_t pad0;
+    /** The count of records dropped because the ring was full */
+    uint64_t drops;
+    uint8_t pad1[40];
+    /** The producer position, only written by the native scanner thread */
+    int64_t head;
+    uint8_t pad2[56];
+    /** The consumer position, only written by java */
+    int64_t tail;
+    uint8_t pad3[56];
+    /** Non-zero while the consumer is blocked waiting for records */
+    int32_t consumer_waiting;
+    /** The futex word the consumer waits on, incremented by the producer to wake it */
+    uint32_t wake_seq;
+    uint8_t pad4[56];
+} spsc_ring_header;
+
+/**
+ * The prefix of each record in the ring. A padding record fills the end of the record area when the next record
+ * does not fit before the wrap point.
+ */
+typedef struct spsc_ring_record {
+    /** The length of the record including this prefix, a multiple of SPSC_RING_RECORD_ALIGN */
+    uint32_t length;
+    /** One of the SPSC_RING_* record types */
+    uint32_t type;
+    uint8_t data[];
+} spsc_ring_record;
+
+/**
+ * The native producer side state of a ring. The tail is cached so the consumer cache line is only read when the
+ * ring looks full.
+ */
+typedef struct spsc_ring_producer {
+    spsc_ring_header *header;
+    uint8_t *data;
+    uint32_t mask;
+    int64_t head;
+    int64_t cached_tail;
+    /** The head position once the reserved record is published */
+    int64_t pending_head;
+} spsc_ring_producer;
+
+static inline long ringFutex(uint32_t *addr, int op, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, addr, op, val, timeout, nullptr, 0);
+}
+
+/**
+ * Initialize a ring over buffer, using the largest power of two record area that fits after the header
+ * @return false if the buffer is too small for a ring holding records of max_record_size
+ */
+static inline bool ringInit(spsc_ring_producer& producer, void *buffer, uint64_t capacity, uint32_t max_record_size) {
+    if (capacity <= SPSC_RING_HEADER_SIZE)
+        return false;
+    uint64_t available = capacity - SPSC_RING_HEADER_SIZE;
+    uint32_t size = 1;
+    while ((uint64_t) size * 2 <= available && size < 0x40000000)
+        size *= 2;
+    if (size < 2 * (max_record_size + sizeof(spsc_ring_record)))
+        return false;
+
+    spsc_ring_header *header = (spsc_ring_header *) buffer;
+    memset(header, 0, SPSC_RING_HEADER_SIZE);
+    header->capacity = size;
+    header->data_offset = SPSC_RING_HEADER_SIZE;
+    producer.header = header;
+    producer.data = ((uint8_t *) buffer) + SPSC_RING_HEADER_SIZE;
+    producer.mask = size - 1;
+    producer.head = 0;
+    producer.cached_tail = 0;
+    producer.pending_head = 0;
+    __atomic_store_n(&header->magic, SPSC_RING_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Reserve space for a record of size bytes of the given type
+ * @return the location to write the record data, nullptr if the ring is full and the record was dropped
+ */
+static inline uint8_t* ringReserve(spsc_ring_producer& producer, uint32_t type, uint32_t size) {
+    uint32_t length = (sizeof(spsc_ring_record) + size + SPSC_RING_RECORD_ALIGN - 1) & ~(SPSC_RING_RECORD_ALIGN - 1);
+    uint32_t capacity = producer.mask + 1;
+    uint32_t pos = (uint32_t) (producer.head & producer.mask);
+    uint32_t contiguous = capacity - pos;
+    uint32_t padding = contiguous < length ? contiguous : 0;
+
+    if (producer.head + padding + length - producer.cached_tail > capacity) {
+        producer.cached_tail = __atomic_load_n(&producer.header->tail, __ATOMIC_ACQUIRE);
+        if (producer.head + padding + length - producer.cached_tail > capacity) {
+            // Only the producer writes drops, but other threads read it, so it is stored atomically so it can't tear
+            __atomic_store_n(&producer.header->drops, producer.header->drops + 1, __ATOMIC_RELAXED);
+            return nullptr;
+        }
+    }
+
+    if (padding) {
+        spsc_ring_record *pad = (spsc_ring_record *) (producer.data + pos);
+        pad->length = padding;
+        pad->type = SPSC_RING_PADDING;
+        pos = 0;
+    }
+    spsc_ring_record *record = (spsc_ring_record *) (producer.data + pos);
+    record->length = length;
+    record->type = type;
+    producer.pending_head = producer.head + padding + length;
+    return record->data;
+}
+
+/**
+ * Make the reserved record visible to the consumer, waking it if it is blocked in ringWait
+ */
+static inline void ringPublish(spsc_ring_producer& producer) {
+    spsc_ring_header *header = producer.header;
+    producer.head = producer.pending_head;
+    // The store of head and the load of consumer_waiting must not be reordered, see ringWait
+    __atomic_store_n(&header->head, producer.head, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->consumer_waiting, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&header->wake_seq, 1, __ATOMIC_SEQ_CST);
+        ringFutex(&header->wake_seq, FUTEX_WAKE_PRIVATE, 1, nullptr);
+    }
+}
+
+/**
+ * Snapshot the wake sequence for ringWait, taken before the consumer checks its own exit conditions so a ringWake
+ * that lands after the checks still ends the wait
+ */
+static inline uint32_t ringWakeSeq(spsc_ring_header *header) {
+    return __atomic_load_n(&header->wake_seq, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Consumer helper that blocks until the ring is non-empty, timeoutMS elapses or the wake sequence moves past seq
+ * @return true if records are available
+ */
+static inline bool ringWait(spsc_ring_header *header, int64_t timeoutMS, uint32_t seq) {
+    __atomic_store_n(&header->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    bool available = __atomic_load_n(&header->head, __ATOMIC_SEQ_CST) != __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+    if (!available) {
+        struct timespec timeout;
+        timeout.tv_sec = timeoutMS / 1000;
+        timeout.tv_nsec = (timeoutMS % 1000) * 1000000;
+        ringFutex(&header->wake_seq, FUTEX_WAIT_PRIVATE, seq, timeoutMS < 0 ? nullptr : &timeout);
+        available = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+    }
+    __atomic_store_n(&header->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+    return available;
+}
+
+/**
+ * Consumer helper that blocks until the ring is non-empty or timeoutMS elapses
+ * @return true if records are available
+ */
+static inline bool ringWait(spsc_ring_header *header, int64_t timeoutMS) {
+    return ringWait(header, timeoutMS, ringWakeSeq(header));
+}
+
+/**
+ * Wake a consumer blocked in ringWait without publishing a record, for example to have it check for shutdown
+ */
+static inline void ringWake(spsc_ring_header *header) {
+    __atomic_add_fetch(&header->wake_seq, 1, __ATOMIC_SEQ_CST);
+    ringFutex(&header->wake_seq, FUTEX_WAKE_PRIVATE, 1, nullptr);
+}
+
+/**
+ * Consumer helper for native readers of the ring, the java consumer follows the same protocol
+ * @return the next non-padding record, nullptr if the ring is empty
+ */
+static inline const spsc_ring_record* ringNext(spsc_ring_header *header) {
+    uint8_t *data = ((uint8_t *) header) + header->data_offset;
+    int64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    int64_t tail = header->tail;
+    while (tail != head) {
+        spsc_ring_record *record = (spsc_ring_record *) (data + (tail & (header->capacity - 1)));
+        if (record->type != SPSC_RING_PADDING)
+            return record;
+        tail += record->length;
+        __atomic_store_n(&header->tail, tail, __ATOMIC_RELEASE);
+    }
+    return nullptr;
+}
+
+/**
+ * Consumer helper to release the record returned by ringNext back to the producer
+ */
+static inline void ringRelease(spsc_ring_header *header, const spsc_ring_record *record) {
+    __atomic_store_n(&header->tail, header->tail + record->length, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef telemetry_H
+#define telemetry_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "signatureclassifier.h"
+
+/*
+ * The decoding of the RHIoTTag and Eddystone TLM telemetry frames into a fixed layout sensor_record java reads in
+ * place. decodeSensorRecord only copies the raw fields, the OPT3001 lux and 8.8 fixed point temperature conversions
+ * are left to convertSensorRecords, which runs them over a batch of records with SSE2 on x86, NEON on ARM or a
+ * scalar table lookup elsewhere. TELEMETRY_KERNEL names the implementation compiled in.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TELEMETRY_KERNEL "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TELEMETRY_KERNEL "neon"
+#else
+#define TELEMETRY_KERNEL "scalar"
+#endif
+
+#define SENSOR_RECORD_VERSION 1
+// The sensor_record.flags of the frames the record was filled in from
+#define SENSOR_FLAG_TLM 0x1
+#define SENSOR_FLAG_MISC 0x2
+// The sensor_record.keys bits
+#define SENSOR_KEY_LEFT 0x1
+#define SENSOR_KEY_RIGHT 0x2
+#define SENSOR_KEY_REED 0x4
+// The Eddystone TLM temperature of a beacon without a temperature sensor
+#define TLM_TEMPERATURE_NOT_SUPPORTED ((int16_t) 0x8000)
+// The records converted by one pass of the batch kernels in convertSensorRecords
+#define SENSOR_CONVERT_BATCH 64
+
+/**
+ * The telemetry of an advertising event, laid out so every field is naturally aligned. The offsets are mirrored by
+ * the SENSOR_*_OFFSET JNI constants.
+ */
+typedef struct __attribute__((packed)) sensor_record {
+    /** The time of the event in milliseconds since the epoch */
+    int64_t time;
+    /** SENSOR_RECORD_VERSION */
+    uint8_t version;
+    /** The SENSOR_FLAG_* of the frames present */
+    uint8_t flags;
+    /** The SENSOR_KEY_* state */
+    uint8_t keys;
+    int8_t rssi;
+    uint8_t bdaddr[6];
+    /** The battery voltage in mV, 0 if not supported */
+    uint16_t battery_mv;
+    /** The temperature in C as signed 8.8 fixed point, TLM_TEMPERATURE_NOT_SUPPORTED if not supported */
+    int16_t temperature;
+    /** The raw OPT3001 light sensor reading, the exponent in the high 4 bits and the mantissa in the low 12 */
+    uint16_t lux_raw;
+    /** The count of advertisements since power up */
+    uint32_t adv_count;
+    /** The time since power up in 0.1s */
+    uint32_t sec_count;
+    /** The lux_raw reading in lux, set by convertSensorRecords */
+    float lux;
+    /** The temperature in C, NaN if not supported, set by convertSensorRecords */
+    float temperature_c;
+    /** The raw gyroscope and accelerometer X, Y and Z readings of the misc frame */
+    int16_t gyro[3];
+    int16_t accel[3];
+    uint8_t reserved[4];
+} sensor_record;
+
+// The OPT3001 lux per mantissa unit of each exponent, 0.01 * 2^exponent
+static const float opt3001LuxScale[16] = {
+    0.01f * 1, 0.01f * 2, 0.01f * 4, 0.01f * 8, 0.01f * 16, 0.01f * 32, 0.01f * 64, 0.01f * 128, 0.01f * 256,
+    0.01f * 512, 0.01f * 1024, 0.01f * 2048, 0.01f * 4096, 0.01f * 8192, 0.01f * 16384, 0.01f * 32768
+};
+
+/**
+ * The lux of a raw OPT3001 reading
+ */
+static inline float opt3001ToLux(uint16_t raw) {
+    return (raw & 0x0fff) * opt3001LuxScale[raw >> 12];
+}
+
+/**
+ * The value of a signed 8.8 fixed point temperature, NaN for TLM_TEMPERATURE_NOT_SUPPORTED
+ */
+static inline float fixed88ToFloat(int16_t value) {
+    return value == TLM_TEMPERATURE_NOT_SUPPORTED ? NAN : value * (1.0f / 256);
+}
+
+/*
+ * The batch kernels convert 8 samples at a time. The vector lux kernel builds 2^exponent directly as the float
+ * exponent bits, and since scaling by a power of two is exact its results match opt3001ToLux bit for bit.
+ */
+#if defined(__SSE2__)
+static inline __m128 opt3001ToLuxSSE2(__m128i mantissa, __m128i exponent) {
+    __m128 pow2 = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(exponent, _mm_set1_epi32(127)), 23));
+    return _mm_mul_ps(_mm_mul_ps(_mm_cvtepi32_ps(mantissa), _mm_set1_ps(0.01f)), pow2);
+}
+
+static inline void opt3001ToLuxBlock(const uint16_t *raw, float *lux) {
+    __m128i values = _mm_loadu_si128((const __m128i *) raw);
+    __m128i mantissa = _mm_and_si128(values, _mm_set1_epi16(0x0fff));
+    __m128i exponent = _mm_srli_epi16(values, 12);
+    __m128i zero = _mm_setzero_si128();
+    _mm_storeu_ps(lux, opt3001ToLuxSSE2(_mm_unpacklo_epi16(mantissa, zero), _mm_unpacklo_epi16(exponent, zero)));
+    _mm_storeu_ps(lux + 4, opt3001ToLuxSSE2(_mm_unpackhi_epi16(mantissa, zero), _mm_unpackhi_epi16(exponent, zero)));
+}
+
+static inline __m128 fixed88ToFloatSSE2(__m128i values) {
+    __m128 result = _mm_mul_ps(_mm_cvtepi32_ps(values), _mm_set1_ps(1.0f / 256));
+    __m128 unsupported = _mm_castsi128_ps(_mm_cmpeq_epi32(values, _mm_set1_epi32(TLM_TEMPERATURE_NOT_SUPPORTED)));
+    return _mm_or_ps(_mm_andnot_ps(unsupported, result), _mm_and_ps(unsupported, _mm_set1_ps(NAN)));
+}
+
+static inline void fixed88ToFloatBlock(const int16_t *values, float *out) {
+    __m128i words = _mm_loadu_si128((const __m128i *) values);
+    // Sign extend by moving each word to the high half of a dword and shifting it back down
+    _mm_storeu_ps(out, fixed88ToFloatSSE2(_mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16)));
+    _mm_storeu_ps(out + 4, fixed88ToFloatSSE2(_mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16)));
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+static inline float32x4_t opt3001ToLuxNEON(uint16x4_t mantissa, uint16x4_t exponent) {
+    uint32x4_t bits = vshlq_n_u32(vaddq_u32(vmovl_u16(exponent), vdupq_n_u32(127)), 23);
+    return vmulq_f32(vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(mantissa)), 0.01f), vreinterpretq_f32_u32(bits));
+}
+
+static inline void opt3001ToLuxBlock(const uint16_t *raw, float *lux) {
+    uint16x8_t values = vld1q_u16(raw);
+    uint16x8_t mantissa = vandq_u16(values, vdupq_n_u16(0x0fff));
+    uint16x8_t exponent = vshrq_n_u16(values, 12);
+    vst1q_f32(lux, opt3001ToLuxNEON(vget_low_u16(mantissa), vget_low_u16(exponent)));
+    vst1q_f32(lux + 4, opt3001ToLuxNEON(vget_high_u16(mantissa), vget_high_u16(exponent)));
+}
+
+static inline float32x4_t fixed88ToFloatNEON(int16x4_t words) {
+    int32x4_t values = vmovl_s16(words);
+    uint32x4_t unsupported = vceqq_s32(values, vdupq_n_s32(TLM_TEMPERATURE_NOT_SUPPORTED));
+    return vbslq_f32(unsupported, vdupq_n_f32(NAN), vmulq_n_f32(vcvtq_f32_s32(values), 1.0f / 256));
+}
+
+static inline void fixed88ToFloatBlock(const int16_t *values, float *out) {
+    int16x8_t words = vld1q_s16(values);
+    vst1q_f32(out, fixed88ToFloatNEON(vget_low_s16(words)));
+    vst1q_f32(out + 4, fixed88ToFloatNEON(vget_high_s16(words)));
+}
+#else
+static inline void opt3001ToLuxBlock(const uint16_t *raw, float *lux) {
+    for (int n = 0; n < 8; n ++)
+        lux[n] = opt3001ToLux(raw[n]);
+}
+
+static inline void fixed88ToFloatBlock(const int16_t *values, float *out) {
+    for (int n = 0; n < 8; n ++)
+        out[n] = fixed88ToFloat(values[n]);
+}
+#endif
+
+/**
+ * Convert count raw OPT3001 readings to lux
+ */
+static inline void opt3001ToLuxBatch(const uint16_t *raw, float *lux, uint32_t count) {
+    uint32_t n = 0;
+    for (; n + 8 <= count; n += 8)
+        opt3001ToLuxBlock(raw + n, lux + n);
+    for (; n < count; n ++)
+        lux[n] = opt3001ToLux(raw[n]);
+}
+
+/**
+ * Convert count signed 8.8 fixed point temperatures to C
+ */
+static inline void fixed88ToFloatBatch(const int16_t *values, float *out, uint32_t count) {
+    uint32_t n = 0;
+    for (; n + 8 <= count; n += 8)
+        fixed88ToFloatBlock(values + n, out + n);
+    for (; n < count; n ++)
+        out[n] = fixed88ToFloat(values[n]);
+}
+
+/**
+ * Set the lux and temperature_c of count records from their raw readings, SENSOR_CONVERT_BATCH records at a time
+ */
+static inline void convertSensorRecords(sensor_record *records, uint32_t count) {
+    uint16_t luxRaw[SENSOR_CONVERT_BATCH];
+    int16_t temperature[SENSOR_CONVERT_BATCH];
+    float lux[SENSOR_CONVERT_BATCH];
+    float temperatureC[SENSOR_CONVERT_BATCH];
+    for (uint32_t start = 0; start < count; start += SENSOR_CONVERT_BATCH) {
+        uint32_t batch = count - start < SENSOR_CONVERT_BATCH ? count - start : SENSOR_CONVERT_BATCH;
+        sensor_record *batchRecords = records + start;
+        for (uint32_t n = 0; n < batch; n ++) {
+            luxRaw[n] = batchRecords[n].lux_raw;
+            temperature[n] = batchRecords[n].temperature;
+        }
+        opt3001ToLuxBatch(luxRaw, lux, batch);
+        fixed88ToFloatBatch(temperature, temperatureC, batch);
+        for (uint32_t n = 0; n < batch; n ++) {
+            batchRecords[n].lux = lux[n];
+            batchRecords[n].temperature_c = temperatureC[n];
+        }
+    }
+}
+
+/**
+ * Fill in record from the Eddystone TLM, RHIoTTag TLM and RHIoTTag misc frames of an event. Encrypted TLM frames,
+ * those with a non-zero version, are skipped. The lux and temperature_c are left 0 for convertSensorRecords.
+ * @return true if the event had any telemetry frame
+ */
+static inline bool decodeSensorRecord(const ad_data_view& event, sensor_record& record) {
+    const uint32_t telemetry = 1u << BEACON_FORMAT_EDDYSTONE_TLM | 1u << BEACON_FORMAT_RHIOTTAG_TLM
+                               | 1u << BEACON_FORMAT_RHIOTTAG_MISC;
+    const signature_table& beacons = beaconSignatureTable();
+    uint32_t formats[MAX_AD_STRUCTURES];
+    uint32_t matches[MAX_AD_STRUCTURES];
+    if ((classifyAdStructures(beacons, event, formats, matches) & telemetry) == 0)
+        return false;
+    memset(&record, 0, sizeof(record));
+    record.version = SENSOR_RECORD_VERSION;
+    record.time = event.time;
+    record.rssi = (int8_t) event.rssi;
+    memcpy(record.bdaddr, event.bdaddr, sizeof(record.bdaddr));
+    record.temperature = TLM_TEMPERATURE_NOT_SUPPORTED;
+    beacon_record frame;
+    for (int n = 0; n < event.count; n ++) {
+        const ad_structure_view& ads = event.data[n];
+        const uint8_t *data = ad_view_data(event, n);
+        uint8_t format = firstSignatureFormat(beacons, matches[n]);
+        if (format != BEACON_FORMAT_EDDYSTONE_TLM && format != BEACON_FORMAT_RHIOTTAG_TLM
+            && format != BEACON_FORMAT_RHIOTTAG_MISC)
+            continue;
+        // An encrypted TLM frame is not decoded
+        if (!decodeAdStructure(format, data, ads.length, frame))
+            continue;
+        if (format == BEACON_FORMAT_RHIOTTAG_MISC) {
+            record.flags |= SENSOR_FLAG_MISC;
+            record.keys = frame.rhiot_misc.keys;
+            record.lux_raw = frame.rhiot_misc.lux_raw;
+            memcpy(record.gyro, frame.rhiot_misc.gyro, sizeof(record.gyro));
+            memcpy(record.accel, frame.rhiot_misc.accel, sizeof(record.accel));
+            continue;
+        }
+        record.flags |= SENSOR_FLAG_TLM;
+        record.battery_mv = frame.tlm.battery_mv;
+        record.temperature = frame.tlm.temperature;
+        record.adv_count = frame.tlm.adv_count;
+        record.sec_count = frame.tlm.sec_count;
+        if (format == BEACON_FORMAT_RHIOTTAG_TLM) {
+            record.keys = frame.rhiot_tlm.keys;
+            record.lux_raw = frame.rhiot_tlm.lux_raw;
+        }
+    }
+    return record.flags != 0;
+}
+
+#endif
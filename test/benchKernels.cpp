@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <src/hcidumpinternal.h>
+#include <src/signatureclassifier.h>
+#include <src/telemetry.h>
+#include "testframes.h"
+
+extern "C" {
+#include <src/parser.h>
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+// Time the kernels in cycles of the time stamp counter
+static inline uint64_t readTimer() {
+    return __rdtsc();
+}
+static const char *TIMER_UNIT = "cycles";
+#else
+// Time the kernels in nanoseconds where there is no cycle counter readable from user space
+static inline uint64_t readTimer() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+static const char *TIMER_UNIT = "ns";
+#endif
+
+/*
+ * The microbenchmarks of the hot helpers of the parse and delivery paths, each run in isolation over a fixed corpus
+ * of realistic payloads. The static parse functions of hcidumpinternal.cpp, evt_le_advertising_report_dump and
+ * ext_inquiry_data_dump, are measured through parse_frame.
+ */
+
+// An Eddystone UID advertising report with the Eddystone service uuid list
+static uint8_t eddystoneFrame[] = {0x04, 0x3e, 0x2b, 0x02, 0x01, 0x03, 0x01, 0x3c, 0x29, 0x8e, 0x51, 0x0f, 0xc4, 0x1f,
+    0x02, 0x01, 0x06, 0x03, 0x03, 0xaa, 0xfe, 0x17, 0x16, 0xaa, 0xfe, 0x00, 0xee, 0xed, 0xd1, 0xeb, 0xea, 0xc0, 0x4e,
+    0x5d, 0xef, 0xa0, 0x17, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0xbe};
+// A RHIoTTag extended Eddystone TLM advertising report with keys and lux
+static uint8_t rhiotTagFrame[] = {0x04, 0x3e, 0x28, 0x02, 0x01, 0x00, 0x00, 0xb0, 0x3c, 0x4a, 0xd0, 0x71, 0xb0, 0x1c,
+    0x02, 0x01, 0x06, 0x03, 0x03, 0xaa, 0xfe, 0x14, 0x16, 0xaa, 0xfe, 0x20, 0x00, 0x0b, 0xb8, 0x17, 0x80, 0x00, 0x00,
+    0x23, 0x28, 0x00, 0x00, 0x1d, 0x4c, 0x05, 0x4a, 0x3f, 0xc9};
+
+typedef struct corpus_frame {
+    const uint8_t *data;
+    uint32_t length;
+} corpus_frame;
+
+static corpus_frame advCorpus[] = {
+    {iBeaconFrame, sizeof(iBeaconFrame)},
+    {eddystoneFrame, sizeof(eddystoneFrame)},
+    {rhiotTagFrame, sizeof(rhiotTagFrame)}
+};
+#define ADV_CORPUS_SIZE (sizeof(advCorpus) / sizeof(advCorpus[0]))
+
+/**
+ * The repetition statistics of a kernel, per op
+ */
+typedef struct kernel_result {
+    std::string name;
+    double min;
+    double median;
+    double max;
+    /** The coefficient of variation of the repetitions in percent */
+    double cv;
+    double bytes;
+} kernel_result;
+
+static uint32_t opsPerRep = 20000;
+static uint32_t warmupReps = 3;
+static uint32_t reps = 15;
+// Consumes the kernel results so the compiler can not drop the kernels
+static volatile uint64_t sink;
+
+/**
+ * Run op(n) for n = 0.. in repetitions of opsPerRep ops, after warmup repetitions that are not measured
+ * @param bytes the bytes of payload processed by each op
+ */
+template <typename Op>
+static kernel_result measure(const char *name, double bytes, Op op) {
+    std::vector<double> samples;
+    for (uint32_t rep = 0; rep < warmupReps + reps; rep ++) {
+        uint64_t start = readTimer();
+        for (uint32_t n = 0; n < opsPerRep; n ++)
+            sink += op(n);
+        uint64_t elapsed = readTimer() - start;
+        if (rep >= warmupReps)
+            samples.push_back((double) elapsed / opsPerRep);
+    }
+    std::sort(samples.begin(), samples.end());
+    double mean = 0, variance = 0;
+    for (double sample : samples)
+        mean += sample / samples.size();
+    for (double sample : samples)
+        variance += (sample - mean) * (sample - mean) / samples.size();
+
+    kernel_result result;
+    result.name = name;
+    result.min = samples.front();
+    result.median = samples[samples.size() / 2];
+    result.max = samples.back();
+    result.cv = mean > 0 ? 100 * sqrt(variance) / mean : 0;
+    result.bytes = bytes;
+    printf("%-28s %10.1f %10.1f %10.1f %6.1f%% %8.1f\n", name, result.min, result.median, result.max, result.cv,
+           bytes);
+    return result;
+}
+
+/**
+ * Parse the frame into event, resetting the frame to the start of data
+ */
+static bool parseCorpusFrame(const corpus_frame& corpus, struct frame& frm, ad_data_view& event) {
+    frm.data = (uint8_t *) corpus.data;
+    frm.data_len = corpus.length;
+    return parse_frame(&frm, event) == PARSE_ADV_REPORT;
+}
+
+static std::vector<kernel_result> runKernels() {
+    std::vector<kernel_result> results;
+    struct frame frm;
+    memset(&frm, 0, sizeof(frm));
+    frm.ts.tv_sec = 1463720753;
+    ad_data_view event;
+
+    double advBytes = 0;
+    for (uint32_t n = 0; n < ADV_CORPUS_SIZE; n ++)
+        advBytes += advCorpus[n].length;
+    results.push_back(measure("parse_frame/adv_report", advBytes / ADV_CORPUS_SIZE, [&](uint32_t n) {
+        parseCorpusFrame(advCorpus[n % ADV_CORPUS_SIZE], frm, event);
+        return event.count;
+    }));
+    corpus_frame skipped = {commandCompleteFrame, sizeof(commandCompleteFrame)};
+    results.push_back(measure("parse_frame/cmd_complete", skipped.length, [&](uint32_t n) {
+        return parseCorpusFrame(skipped, frm, event);
+    }));
+
+    // The views and ad_data forms of the corpus for the inlining kernels
+    ad_data_view views[ADV_CORPUS_SIZE];
+    ad_data events[ADV_CORPUS_SIZE];
+    ad_structure pools[ADV_CORPUS_SIZE][MAX_AD_STRUCTURES];
+    double inlineBytes = 0;
+    for (uint32_t n = 0; n < ADV_CORPUS_SIZE; n ++) {
+        parseCorpusFrame(advCorpus[n], frm, views[n]);
+        inlineBytes += inlineLength(views[n]);
+        events[n].rssi = views[n].rssi;
+        events[n].time = views[n].time;
+        events[n].bdaddr_type = views[n].bdaddr_type;
+        memcpy(events[n].bdaddr, views[n].bdaddr, sizeof(events[n].bdaddr));
+        for (int i = 0; i < views[n].count; i ++) {
+            pools[n][i].type = views[n].data[i].type;
+            pools[n][i].length = views[n].data[i].length;
+            memcpy(pools[n][i].data, ad_view_data(views[n], i), pools[n][i].length);
+            events[n].data.push_back(&pools[n][i]);
+        }
+    }
+    results.push_back(measure("toInline", inlineBytes / ADV_CORPUS_SIZE, [&](uint32_t n) {
+        ad_data_inline *event_inline = toInline(events[n % ADV_CORPUS_SIZE]);
+        uint32_t length = event_inline->total_length;
+        free(event_inline);
+        return length;
+    }));
+    uint8_t buffer[AD_DATA_INLINE_MAX_SIZE];
+    results.push_back(measure("writeInline", inlineBytes / ADV_CORPUS_SIZE, [&](uint32_t n) {
+        return writeInline(views[n % ADV_CORPUS_SIZE], buffer, sizeof(buffer));
+    }));
+
+    // The iBeacon manufacturer data follows the flags AD structure
+    const uint8_t *manufacturerData = ad_view_data(views[0], 1);
+    beacon_info info;
+    results.push_back(measure("extractBeaconInfo", MIN_MANUFACTURER_DATA_SIZE, [&](uint32_t n) {
+        extractBeaconInfo(manufacturerData, &info);
+        return info.minor + info.uuid[n % UUID_SIZE];
+    }));
+
+    beacon_info_v2 info2;
+    results.push_back(measure("extractBeaconInfoV2", MIN_MANUFACTURER_DATA_SIZE, [&](uint32_t n) {
+        extractBeaconInfoV2(manufacturerData, &info2);
+        return info2.minor + info2.uuid[n % UUID_SIZE];
+    }));
+    // The registry classification and decoding of every AD structure of the corpus reports
+    beacon_record records[MAX_AD_STRUCTURES];
+    results.push_back(measure("decodeBeacons", inlineBytes / ADV_CORPUS_SIZE, [&](uint32_t n) {
+        return decodeBeacons(views[n % ADV_CORPUS_SIZE], records, MAX_AD_STRUCTURES) + records[0].format;
+    }));
+    // The per structure registry lookup against the signature classifier, SIGNATURE_KERNEL, with the beacon
+    // signatures and with a full table
+    results.push_back(measure("classifyAdStructure/registry", inlineBytes / ADV_CORPUS_SIZE, [&](uint32_t n) {
+        const ad_data_view& view = views[n % ADV_CORPUS_SIZE];
+        uint32_t formats = 0;
+        for (int i = 0; i < view.count; i ++)
+            formats |= 1u << classifyAdStructure(view.data[i].type, ad_view_data(view, i), view.data[i].length);
+        return formats;
+    }));
+    uint32_t structureFormats[MAX_AD_STRUCTURES];
+    const signature_table& beacons = beaconSignatureTable();
+    results.push_back(measure("classifyAdStructures/beacons", inlineBytes / ADV_CORPUS_SIZE, [&](uint32_t n) {
+        return classifyAdStructures(beacons, views[n % ADV_CORPUS_SIZE], structureFormats);
+    }));
+    signature_table fullTable = beacons;
+    const uint8_t vendorPrefix[] = {0x59, 0x00, 0x02, 0x15};
+    while (fullTable.count < MAX_SIGNATURES)
+        addSignature(fullTable, AD_TYPE_MANUFACTURER_DATA, vendorPrefix, nullptr, sizeof(vendorPrefix), 0,
+                     BEACON_FORMATS);
+    results.push_back(measure("classifyAdStructures/full", inlineBytes / ADV_CORPUS_SIZE, [&](uint32_t n) {
+        return classifyAdStructures(fullTable, views[n % ADV_CORPUS_SIZE], structureFormats);
+    }));
+    // The telemetry decoding of the RHIoTTag report, and the lux conversions per sample, the exp2 form of
+    // testRHIoTTag against the table and the batch kernel, TELEMETRY_KERNEL, over a batch of samples
+    sensor_record sensor;
+    results.push_back(measure("decodeSensorRecord", inlineLength(views[2]), [&](uint32_t n) {
+        return decodeSensorRecord(views[2], sensor) + sensor.lux_raw;
+    }));
+    uint16_t luxRaw[SENSOR_CONVERT_BATCH];
+    float lux[SENSOR_CONVERT_BATCH];
+    for (int n = 0; n < SENSOR_CONVERT_BATCH; n ++)
+        luxRaw[n] = (uint16_t) (n * 1021);
+    results.push_back(measure("exp2/lux", 2, [&](uint32_t n) {
+        uint16_t raw = luxRaw[n % SENSOR_CONVERT_BATCH];
+        return (uint64_t) ((raw & 0x0fff) * (0.01 * exp2(raw >> 12)));
+    }));
+    results.push_back(measure("opt3001ToLux", 2, [&](uint32_t n) {
+        return (uint64_t) opt3001ToLux(luxRaw[n % SENSOR_CONVERT_BATCH]);
+    }));
+    results.push_back(measure("opt3001ToLuxBatch/64", 2 * SENSOR_CONVERT_BATCH, [&](uint32_t n) {
+        opt3001ToLuxBatch(luxRaw, lux, SENSOR_CONVERT_BATCH);
+        return (uint64_t) lux[n % SENSOR_CONVERT_BATCH];
+    }));
+    sensor_record sensors[SENSOR_CONVERT_BATCH];
+    for (int n = 0; n < SENSOR_CONVERT_BATCH; n ++) {
+        decodeSensorRecord(views[2], sensors[n]);
+        sensors[n].lux_raw = luxRaw[n];
+    }
+    results.push_back(measure("convertSensorRecords/64", sizeof(sensors), [&](uint32_t n) {
+        convertSensorRecords(sensors, SENSOR_CONVERT_BATCH);
+        return (uint64_t) sensors[n % SENSOR_CONVERT_BATCH].lux;
+    }));
+    // The lane at a time matching the kernel replaces, over the full table
+    results.push_back(measure("matchScalar/full", inlineBytes / ADV_CORPUS_SIZE, [&](uint32_t n) {
+        const ad_data_view& view = views[n % ADV_CORPUS_SIZE];
+        uint32_t matches = 0;
+        for (int i = 0; i < view.count; i ++) {
+            uint64_t key = packSignatureKey(view.data[i].type, ad_view_data(view, i), view.data[i].length);
+            for (int block = 0; block < SIGNATURE_BLOCKS; block ++)
+                matches |= matchSignatureBlockScalar(fullTable.blocks[block], key);
+        }
+        return matches;
+    }));
+
+    const uint8_t *uuid = manufacturerData + 4;
+    char hex[HEX_STRING_SIZE(31)];
+    results.push_back(measure("toHexChar/uuid", UUID_SIZE, [&](uint32_t n) {
+        for (int i = 0; i < UUID_SIZE; i ++) {
+            hex[2*i] = toHexChar(uuid[i] >> 4);
+            hex[2*i+1] = toHexChar(uuid[i]);
+        }
+        return hex[n % (2*UUID_SIZE)];
+    }));
+    // The hex kernels, HEX_KERNEL, against the scalar and printf forms they replace
+    results.push_back(measure("hexEncodeBlockScalar/uuid", UUID_SIZE, [&](uint32_t n) {
+        hexEncodeBlockScalar(uuid, hex);
+        return hex[n % (2*UUID_SIZE)];
+    }));
+    results.push_back(measure("hexEncode/uuid", UUID_SIZE, [&](uint32_t n) {
+        hexEncode(uuid, UUID_SIZE, hex);
+        return hex[n % (2*UUID_SIZE)];
+    }));
+    results.push_back(measure("uuidToString", UUID_SIZE, [&](uint32_t n) {
+        uuidToString(uuid, hex);
+        return hex[n % UUID_STRING_LENGTH];
+    }));
+    char uuidText[UUID_STRING_LENGTH + 1];
+    uuidToString(uuid, uuidText);
+    uint8_t bytes[UUID_SIZE];
+    results.push_back(measure("uuidFromString", UUID_SIZE, [&](uint32_t n) {
+        return uuidFromString(uuidText, bytes) + bytes[n % UUID_SIZE];
+    }));
+    results.push_back(measure("sprintf/bdaddr", 6, [&](uint32_t n) {
+        const uint8_t *bdaddr = views[n % ADV_CORPUS_SIZE].bdaddr;
+        return sprintf(hex, "%.2X:%.2X:%.2X:%.2X:%.2X:%.2X", bdaddr[5], bdaddr[4], bdaddr[3], bdaddr[2], bdaddr[1],
+                       bdaddr[0]);
+    }));
+    results.push_back(measure("bdaddrToString", 6, [&](uint32_t n) {
+        bdaddrToString(views[n % ADV_CORPUS_SIZE].bdaddr, hex);
+        return hex[n % BDADDR_STRING_LENGTH];
+    }));
+    char bdaddrText[BDADDR_STRING_LENGTH + 1];
+    bdaddrToString(views[0].bdaddr, bdaddrText);
+    results.push_back(measure("bdaddrFromString", 6, [&](uint32_t n) {
+        return bdaddrFromString(bdaddrText, bytes) + bytes[n % 6];
+    }));
+    results.push_back(measure("toHexString/bdaddr", 6, [&](uint32_t n) {
+        return toHexString(views[n % ADV_CORPUS_SIZE].bdaddr, 6, hex)[0];
+    }));
+    results.push_back(measure("toHexString/ad_payload", 31, [&](uint32_t n) {
+        // The Eddystone report carries the full 31 bytes of AD structures
+        return toHexString(eddystoneFrame + 14, 31, hex)[n % 3];
+    }));
+    return results;
+}
+
+/**
+ * Load a baseline of kernel name and median lines
+ */
+static bool loadBaseline(const char *path, std::map<std::string, double>& baseline) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Can't open baseline");
+        return false;
+    }
+    char name[128];
+    double median;
+    while (fscanf(file, "%127s %lf", name, &median) == 2)
+        baseline[name] = median;
+    fclose(file);
+    return true;
+}
+
+static bool saveBaseline(const char *path, const std::vector<kernel_result>& results) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("Can't create baseline");
+        return false;
+    }
+    for (const kernel_result& result : results)
+        fprintf(file, "%s %.2f\n", result.name.c_str(), result.median);
+    fclose(file);
+    return true;
+}
+
+/**
+ * Run the kernel microbenchmarks. -s path saves the medians as a baseline, -b path compares the medians against a
+ * saved baseline and fails on a regression of more than -t percent (default 15), -r sets the repetitions and -n the
+ * ops per repetition.
+ */
+int main(int argc, char **argv) {
+    const char *savePath = nullptr;
+    const char *baselinePath = nullptr;
+    double tolerance = 15;
+    for(int n = 1; n < argc; n ++) {
+        if(strcmp("-s", argv[n]) == 0 && n + 1 < argc)
+            savePath = argv[++n];
+        else if(strcmp("-b", argv[n]) == 0 && n + 1 < argc)
+            baselinePath = argv[++n];
+        else if(strcmp("-t", argv[n]) == 0 && n + 1 < argc)
+            tolerance = ::atof(argv[++n]);
+        else if(strcmp("-r", argv[n]) == 0 && n + 1 < argc)
+            reps = std::max(1, ::atoi(argv[++n]));
+        else if(strcmp("-n", argv[n]) == 0 && n + 1 < argc)
+            opsPerRep = std::max(1, ::atoi(argv[++n]));
+        else {
+            printf("Usage: benchKernels [-s baseline] [-b baseline] [-t tolerance%%] [-r reps] [-n opsPerRep]\n");
+            return 1;
+        }
+    }
+
+    printf("%u warmup and %u measured repetitions of %u ops, %s/op, %s hex, %s signature and %s telemetry kernels\n",
+           warmupReps, reps, opsPerRep, TIMER_UNIT, HEX_KERNEL, SIGNATURE_KERNEL, TELEMETRY_KERNEL);
+    printf("%-28s %10s %10s %10s %7s %8s\n", "kernel", "min", "median", "max", "cv", "bytes/op");
+    std::vector<kernel_result> results = runKernels();
+
+    if (savePath && !saveBaseline(savePath, results))
+        return 1;
+    int regressions = 0;
+    if (baselinePath) {
+        std::map<std::string, double> baseline;
+        if (!loadBaseline(baselinePath, baseline))
+            return 1;
+        for (const kernel_result& result : results) {
+            std::map<std::string, double>::iterator it = baseline.find(result.name);
+            if (it == baseline.end() || it->second <= 0)
+                continue;
+            double change = 100 * (result.median - it->second) / it->second;
+            bool regressed = change > tolerance;
+            printf("%-28s %10.1f vs %10.1f %+6.1f%%%s\n", result.name.c_str(), result.median, it->second, change,
+                   regressed ? " REGRESSION" : "");
+            regressions += regressed;
+        }
+        if (regressions > 0)
+            printf("Failed, %d kernels regressed by more than %.0f%%\n", regressions, tolerance);
+    }
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <src/hcidumpinternal.h>
+
+/*
+ * The throughput benchmark of the scan loop. A sender thread synthesizes LE advertising report HCI frames for a
+ * population of iBeacon, Eddystone UID and RHIoTTag devices and writes them to one end of a socketpair, and the scan
+ * loop reads the other end exactly as it would an HCI socket. No adapter is needed, so performance changes can be
+ * measured anywhere.
+ */
+
+// Count the heap allocations made while the benchmark runs by interposing on the libc allocator
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+}
+static std::atomic<uint64_t> allocations(0);
+
+extern "C" void *malloc(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+extern "C" void *calloc(size_t count, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+extern "C" void *realloc(void *ptr, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+// The time without a frame after which the scan loop is stopped, so lost frames end the benchmark rather than hang it
+#define IDLE_TIMEOUT_MS 5000
+
+// The largest advertising report frame, the 31 bytes of AD structures plus the event and report headers
+#define MAX_REPORT_SIZE (14 + 31 + 1)
+
+enum device_type {
+    IBEACON,
+    EDDYSTONE_UID,
+    RHIOT_TAG,
+    DEVICE_TYPES
+};
+static const char *deviceTypeNames[] = {"iBeacon", "Eddystone", "RHIoTTag"};
+
+/**
+ * The frame template of a synthetic device, the rssi is varied as each frame is sent
+ */
+typedef struct synthetic_device {
+    device_type type;
+    uint8_t frame[MAX_REPORT_SIZE];
+    uint32_t length;
+} synthetic_device;
+
+static uint32_t xorshift(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/**
+ * Build an LE advertising report event carrying the ads AD structures from bdaddr
+ * @return the length of the frame
+ */
+static uint32_t buildReport(uint8_t *frame, const uint8_t *bdaddr, const uint8_t *ads, uint8_t adsLength) {
+    frame[0] = 0x04;                // HCI_EVENT_PKT
+    frame[1] = 0x3e;                // EVT_LE_META_EVENT
+    frame[2] = 12 + adsLength;      // plen
+    frame[3] = 0x02;                // EVT_LE_ADVERTISING_REPORT
+    frame[4] = 1;                   // num_reports
+    frame[5] = 0x03;                // ADV_NONCONN_IND
+    frame[6] = 0x01;                // Random address
+    memcpy(frame + 7, bdaddr, 6);
+    frame[13] = adsLength;
+    memcpy(frame + 14, ads, adsLength);
+    frame[14 + adsLength] = (uint8_t) -60;
+    return 15 + adsLength;
+}
+
+static void makeDevice(synthetic_device& device, device_type type, uint32_t& seed) {
+    uint8_t bdaddr[6];
+    for (int n = 0; n < 6; n ++)
+        bdaddr[n] = xorshift(seed);
+    uint8_t ads[31];
+    uint8_t length = 0;
+    // Flags
+    ads[length++] = 0x02;
+    ads[length++] = 0x01;
+    ads[length++] = 0x06;
+    switch (type) {
+        case IBEACON: {
+            // Apple manufacturer data: code, uuid, major, minor and calibrated power
+            const uint8_t header[] = {0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15};
+            memcpy(ads + length, header, sizeof(header));
+            length += sizeof(header);
+            for (int n = 0; n < 16 + 4; n ++)
+                ads[length++] = xorshift(seed);
+            ads[length++] = 0xc5;
+            break;
+        }
+        case EDDYSTONE_UID: {
+            // The Eddystone service uuid list and a UID frame: power, namespace, instance and reserved bytes
+            const uint8_t header[] = {0x03, 0x03, 0xaa, 0xfe, 0x17, 0x16, 0xaa, 0xfe, 0x00, 0xee};
+            memcpy(ads + length, header, sizeof(header));
+            length += sizeof(header);
+            for (int n = 0; n < 10 + 6; n ++)
+                ads[length++] = xorshift(seed);
+            ads[length++] = 0;
+            ads[length++] = 0;
+            break;
+        }
+        default: {
+            // The RHIoTTag extended TLM frame: version, battery, temperature, counters, keys and lux
+            const uint8_t header[] = {0x03, 0x03, 0xaa, 0xfe, 0x14, 0x16, 0xaa, 0xfe, 0x20, 0x00};
+            memcpy(ads + length, header, sizeof(header));
+            length += sizeof(header);
+            for (int n = 0; n < 2 + 2 + 4 + 4 + 1 + 2; n ++)
+                ads[length++] = xorshift(seed);
+            break;
+        }
+    }
+    device.type = type;
+    device.length = buildReport(device.frame, bdaddr, ads, length);
+}
+
+/**
+ * Send frames from a random device of the population, recording the time each is sent. The scan loop is stopped if a
+ * frame can't be sent, as it would otherwise wait for the missing frames.
+ */
+static void sendFrames(int sock, const std::vector<synthetic_device>& devices, uint32_t frames,
+                       std::vector<std::atomic<int64_t>>& sendTimes, scan_control& control) {
+    uint32_t seed = 0x9e3779b9;
+    uint8_t frame[MAX_REPORT_SIZE];
+    for (uint32_t n = 0; n < frames; n ++) {
+        const synthetic_device& device = devices[xorshift(seed) % devices.size()];
+        memcpy(frame, device.frame, device.length);
+        frame[device.length - 1] = (uint8_t) (-40 - (int) (seed % 50));
+        sendTimes[n].store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+        if (send(sock, frame, device.length, 0) < 0) {
+            perror("Can't send synthetic frame");
+            requestStop(control);
+            return;
+        }
+    }
+}
+
+/**
+ * Run the scan loop over a socketpair fed synthetic advertising traffic and report its throughput, allocations and
+ * callback latency. -n sets the number of devices, -c the number of frames and -b the recvmmsg batch size, and -l
+ * records and prints the scan loop latency histograms.
+ */
+int main(int argc, char **argv) {
+    uint32_t deviceCount = 1000;
+    uint32_t frames = 1000000;
+    uint32_t batchSize = 1;
+    bool recordLatency = false;
+    for(int n = 1; n < argc; n ++) {
+        if(strcmp("-n", argv[n]) == 0 && n + 1 < argc)
+            deviceCount = std::max(1, ::atoi(argv[++n]));
+        else if(strcmp("-c", argv[n]) == 0 && n + 1 < argc)
+            frames = std::max(1, ::atoi(argv[++n]));
+        else if(strcmp("-b", argv[n]) == 0 && n + 1 < argc)
+            batchSize = std::max(1, ::atoi(argv[++n]));
+        else if(strcmp("-l", argv[n]) == 0)
+            recordLatency = true;
+        else {
+            printf("Usage: benchScanner [-n devices] [-c frames] [-b batchSize] [-l]\n");
+            return 1;
+        }
+    }
+
+    std::vector<synthetic_device> devices(deviceCount);
+    uint32_t seed = 12345;
+    for (uint32_t n = 0; n < deviceCount; n ++)
+        makeDevice(devices[n], (device_type) (n % DEVICE_TYPES), seed);
+
+    int socks[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, socks) < 0) {
+        perror("Can't create socketpair");
+        return 1;
+    }
+    std::vector<std::atomic<int64_t>> sendTimes(frames);
+    std::vector<int64_t> latencies(frames);
+    uint32_t types[DEVICE_TYPES] = {0};
+    uint32_t events = 0;
+
+    scan_control control;
+    scan_options options;
+    options.batch_size = batchSize;
+    options.control = &control;
+    scan_latency *latency = recordLatency ? new scan_latency : nullptr;
+    options.latency = latency;
+    options.idle_timeout_ms = IDLE_TIMEOUT_MS;
+    options.idle_callback = [&] {
+        printf("No frames for %dms after %u events, stopping\n", IDLE_TIMEOUT_MS, events);
+        return true;
+    };
+    std::function<bool(ad_data_view&)> callback = [&](ad_data_view& event) {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        // The socketpair delivers the frames in order, so the n'th event is from the n'th frame sent
+        latencies[events] = now - sendTimes[events].load(std::memory_order_relaxed);
+        types[event.count == 2 ? IBEACON : ad_view_data(event, 2)[2] == 0 ? EDDYSTONE_UID : RHIOT_TAG] ++;
+        return ++ events == frames;
+    };
+
+    uint64_t startAllocations = allocations.load();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::thread sender(sendFrames, socks[0], std::cref(devices), frames, std::ref(sendTimes), std::ref(control));
+    scan_socket_for_ad_events_view(0, socks[1], callback, options);
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    uint64_t runAllocations = allocations.load() - startAllocations;
+    sender.join();
+    close(socks[0]);
+    close(socks[1]);
+
+    std::sort(latencies.begin(), latencies.begin() + events);
+    printf("devices=%u, frames=%u, events=%u, batch_size=%u\n", deviceCount, frames, events, batchSize);
+    for (int n = 0; n < DEVICE_TYPES; n ++)
+        printf("  %s events: %u\n", deviceTypeNames[n], types[n]);
+    printf("frames/sec: %.0f\n", frames * 1e9 / elapsed);
+    printf("ns/frame: %.1f\n", (double) elapsed / frames);
+    printf("allocations: %lu, per frame: %.3f\n", runAllocations, (double) runAllocations / frames);
+    if (events > 0)
+        printf("callback latency: p50=%.1fus, p99=%.1fus\n", latencies[events / 2] / 1000.0,
+               latencies[(uint64_t) events * 99 / 100] / 1000.0);
+    if (latency) {
+        printScanLatency(*latency);
+        delete latency;
+    }
+    if (events != frames)
+        printf("Failed, only %u of %u frames were seen\n", events, frames);
+    return 0;
+}
@@ -52,6 +52,34 @@ int main(int argc, char **argv) {
     if(memcmp(adsPtr, &ads2, ads2.length+2) != 0)
         printf("Failed on ads2\n");
 
+    // Write the same event from an ad_data_view directly into a buffer and compare against toInline
+    uint8_t frameBuffer[64];
+    ad_data_view view;
+    view.bdaddr_type = orig.bdaddr_type;
+    memcpy(view.bdaddr, orig.bdaddr, sizeof(view.bdaddr));
+    view.rssi = orig.rssi;
+    view.time = orig.time;
+    view.buffer = frameBuffer;
+    view.count = 0;
+    uint16_t offset = 0;
+    for(int n = 0; n < orig.data.size(); n ++) {
+        ad_structure *ads = orig.data[n];
+        memcpy(frameBuffer + offset, ads->data, ads->length);
+        view.data[n].offset = offset;
+        view.data[n].length = ads->length;
+        view.data[n].type = ads->type;
+        view.count ++;
+        offset += ads->length;
+    }
+    uint8_t direct[AD_DATA_INLINE_MAX_SIZE];
+    uint32_t written = writeInline(view, direct, sizeof(direct));
+    if(written != test->total_length)
+        printf("Failed on writeInline length, %d != %d\n", written, test->total_length);
+    if(memcmp(direct, test, written) != 0)
+        printf("Failed on writeInline content\n");
+    if(writeInline(view, direct, written-1) != 0)
+        printf("Failed on writeInline capacity check\n");
+
     free(test);
 
     return 0;
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <src/asynclog.h>
+
+/**
+ * Read the lines of path with the time and level prefix of each stripped
+ */
+static std::vector<std::string> readMessages(const char *path) {
+    std::vector<std::string> messages;
+    FILE *file = fopen(path, "r");
+    char line[1024];
+    while (file && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = 0;
+        // HH:MM:SS.uuuuuu LEVEL message
+        messages.push_back(strlen(line) > 22 ? line + 22 : line);
+    }
+    if (file)
+        fclose(file);
+    return messages;
+}
+
+static void expect(const std::vector<std::string>& messages, size_t n, const char *expected) {
+    if (n >= messages.size() || messages[n] != expected)
+        printf("Failed on message %ld, expected '%s', found '%s'\n", n, expected,
+               n < messages.size() ? messages[n].c_str() : "");
+}
+
+/**
+ * Test the formatting of the logger thread, the runtime debug switch and writes from several threads. The log is
+ * redirected to a file so it can be read back.
+ */
+int main() {
+    const char *path = "/tmp/testAsyncLog.log";
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    if (freopen(path, "w", stdout) == nullptr) {
+        perror("Can't redirect stdout");
+        return 1;
+    }
+
+    const uint8_t bytes[] = {0x4c, 0x00, 0x02, 0x15};
+    char name[] = "hci0";
+    int64_t time = 1463720753000ll;
+    LOG_INFO("int=%d, negative=%d, unsigned=%u, hex=0x%2.2x, long=%lld", 42, -7, 4000000000u, 0x3e, time);
+    LOG_INFO("string=%s, padded=[%-6s], hex=%s, char=%c", "literal", name, logHex(bytes, sizeof(bytes)), 'x');
+    LOG_INFO("double=%.2f, width=[%5d], percent=100%%, missing=%d", 3.14159, 12);
+    LOG_DEBUG("not written while hcidumpDebugMode is off");
+    hcidumpDebugMode = true;
+    LOG_DEBUG("debug=%s", "on");
+
+    const int threads = 4;
+    const int perThread = 1000;
+    std::vector<std::thread> writers;
+    for (int t = 0; t < threads; t ++)
+        writers.push_back(std::thread([t] {
+            for (int n = 0; n < perThread; n ++) {
+                LOG_INFO("thread=%d, record=%d", t, n);
+                // Stay under the ring capacity so no records are dropped
+                if (n % 256 == 255)
+                    logFlush();
+            }
+        }));
+    for (std::thread& writer : writers)
+        writer.join();
+    logFlush();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    std::vector<std::string> messages = readMessages(path);
+    expect(messages, 0, "int=42, negative=-7, unsigned=4000000000, hex=0x3e, long=1463720753000");
+    expect(messages, 1, "string=literal, padded=[hci0  ], hex=4C 00 02 15, char=x");
+    expect(messages, 2, "double=3.14, width=[   12], percent=100%, missing=%d");
+    expect(messages, 3, "debug=on");
+    // Each thread's records are in the order it wrote them
+    std::vector<int> next(threads, 0);
+    for (size_t n = 4; n < messages.size(); n ++) {
+        int t, record;
+        if (sscanf(messages[n].c_str(), "thread=%d, record=%d", &t, &record) != 2 || t < 0 || t >= threads
+            || record != next[t]++)
+            printf("Failed on thread record '%s'\n", messages[n].c_str());
+    }
+    printf("%ld messages written\n", messages.size());
+    if (messages.size() != 4 + threads * perThread)
+        printf("Failed on message count, expected %d\n", 4 + threads * perThread);
+    remove(path);
+    return 0;
+}
@@ -1,8 +1,20 @@
 
 #include <cstddef>
 #include <stdio.h>
+#include <string.h>
 #include "../src/hcidumpinternal.h"
 
+// The beacon_info_v2 layout java reads through the BEACON_V2_*_OFFSET constants
+static_assert(sizeof(beacon_info_v2) == 32, "beacon_info_v2 is not half a cache line");
+static_assert(offsetof(beacon_info_v2, version) == 0, "beacon_info_v2.version moved");
+static_assert(offsetof(beacon_info_v2, flags) == 1, "beacon_info_v2.flags moved");
+static_assert(offsetof(beacon_info_v2, calibrated_power) == 2, "beacon_info_v2.calibrated_power moved");
+static_assert(offsetof(beacon_info_v2, rssi) == 3, "beacon_info_v2.rssi moved");
+static_assert(offsetof(beacon_info_v2, major) == 4, "beacon_info_v2.major moved");
+static_assert(offsetof(beacon_info_v2, minor) == 6, "beacon_info_v2.minor moved");
+static_assert(offsetof(beacon_info_v2, uuid) == 8, "beacon_info_v2.uuid moved");
+static_assert(offsetof(beacon_info_v2, time) == 24, "beacon_info_v2.time moved");
+
 /**
  * Test the offset of the beacon_info struct fields for use with a direct ByteBuffer via JNI
  */
@@ -18,4 +30,20 @@ int main(int argc, char * * argv) {
     printf("offsetof(beacon_info.calibrated_power) = %d\n", offsetof(beacon_info, calibrated_power));
     printf("offsetof(beacon_info.rssi) = %d\n", offsetof(beacon_info, rssi));
     printf("offsetof(beacon_info.time) = %d\n", offsetof(beacon_info, time));
+
+    // The v2 record of an iBeacon manufacturer data AD structure has the same fields as the v1 record
+    const uint8_t data[] = {0x4c, 0x00, 0x02, 0x15, 0xda, 0xf2, 0x46, 0xce, 0xf2, 0x01, 0x11, 0xe4, 0xb1, 0x16, 0x12,
+                            0x3b, 0x93, 0xf7, 0x5c, 0xba, 0x30, 0x39, 0x2b, 0x67, 0xda};
+    beacon_info info;
+    beacon_info_v2 info2;
+    extractBeaconInfo(data, &info);
+    extractBeaconInfoV2(data, &info2);
+    char uuid[2*UUID_SIZE + 1];
+    for (int n = 0; n < UUID_SIZE; n ++)
+        sprintf(uuid + 2*n, "%02X", info2.uuid[n]);
+    printf("beacon_info_v2:{uuid=%s, major=%d, minor=%d, calibrated_power=%d}\n", uuid, info2.major, info2.minor,
+           info2.calibrated_power);
+    if (info2.version != BEACON_INFO_VERSION_2 || info2.flags != 0 || strcmp(uuid, info.uuid) != 0
+        || info2.major != info.major || info2.minor != info.minor || info2.calibrated_power != info.calibrated_power)
+        printf("Failed on beacon_info_v2 fields\n");
 }
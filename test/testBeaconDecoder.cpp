@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <src/signatureclassifier.h>
+
+extern "C" {
+#include <src/parser.h>
+}
+
+/**
+ * Wrap AD structures in an LE advertising report HCI event frame
+ */
+static std::vector<uint8_t> makeReport(const std::vector<uint8_t>& ads) {
+    std::vector<uint8_t> frame = {0x04, 0x3e, 0, 0x02, 0x01, 0x03, 0x01, 0x85, 0xda, 0xd6, 0x48, 0xb4, 0xb0,
+                                  (uint8_t) ads.size()};
+    frame.insert(frame.end(), ads.begin(), ads.end());
+    // The rssi
+    frame.push_back(0xc5);
+    frame[2] = frame.size() - 3;
+    return frame;
+}
+
+/**
+ * Parse a report and decode its beacons
+ */
+static uint32_t decodeReport(std::vector<uint8_t>& report, ad_data_view& event, beacon_record *records) {
+    struct frame frm;
+    memset(&frm, 0, sizeof(frm));
+    frm.ts.tv_sec = 1463720753;
+    frm.data = report.data();
+    frm.data_len = report.size();
+    if (parse_frame(&frm, event) != PARSE_ADV_REPORT) {
+        printf("Failed to parse report\n");
+        return 0;
+    }
+    return decodeBeacons(event, records, MAX_AD_STRUCTURES);
+}
+
+static void expectFormats(const char *name, const beacon_record *records, uint32_t count,
+                          const std::vector<uint8_t>& formats) {
+    bool matches = count == formats.size();
+    for (uint32_t n = 0; matches && n < count; n ++)
+        matches = records[n].format == formats[n];
+    if (!matches)
+        printf("Failed on %s formats, count=%u, format[0]=%d\n", name, count, count > 0 ? records[0].format : -1);
+}
+
+/**
+ * Test the classification and decoding of each format of the decoder registry
+ */
+int main() {
+    ad_data_view event;
+    beacon_record records[MAX_AD_STRUCTURES];
+    const uint8_t uuid[] = {0xda, 0xf2, 0x46, 0xce, 0xf2, 0x01, 0x11, 0xe4, 0xb1, 0x16, 0x12, 0x3b, 0x93, 0xf7, 0x5c,
+                            0xba};
+
+    // Flags followed by iBeacon manufacturer data
+    std::vector<uint8_t> ads = {0x02, 0x01, 0x04, 0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15};
+    ads.insert(ads.end(), uuid, uuid + 16);
+    ads.insert(ads.end(), {0x30, 0x39, 0x2b, 0x67, 0xc5});
+    std::vector<uint8_t> report = makeReport(ads);
+    uint32_t count = decodeReport(report, event, records);
+    expectFormats("iBeacon", records, count, {BEACON_FORMAT_IBEACON});
+    const beacon_info_v2& beacon = records[0].beacon;
+    if (records[0].ad_index != 1 || memcmp(beacon.uuid, uuid, 16) != 0 || beacon.major != 12345
+        || beacon.minor != 11111 || beacon.calibrated_power != -59 || beacon.flags != 0 || beacon.rssi != -59
+        || beacon.time != event.time)
+        printf("Failed on iBeacon fields\n");
+
+    // AltBeacon manufacturer data of another company, with the reference rssi and reserved byte
+    ads = {0x1b, 0xff, 0x18, 0x01, 0xbe, 0xac};
+    ads.insert(ads.end(), uuid, uuid + 16);
+    ads.insert(ads.end(), {0x00, 0x01, 0x00, 0x02, 0xc0, 0x00});
+    report = makeReport(ads);
+    count = decodeReport(report, event, records);
+    expectFormats("AltBeacon", records, count, {BEACON_FORMAT_ALTBEACON});
+    if (records[0].beacon.flags != BEACON_FLAG_ALTBEACON || records[0].beacon.major != 1
+        || records[0].beacon.minor != 2 || records[0].beacon.calibrated_power != -64)
+        printf("Failed on AltBeacon fields\n");
+
+    // Manufacturer data that is neither, and an iBeacon that is too short, are not beacons
+    ads = {0x1a, 0xff, 0x59, 0x00, 0x02, 0x15};
+    ads.insert(ads.end(), 21, 0);
+    ads.insert(ads.end(), {0x08, 0xff, 0x4c, 0x00, 0x02, 0x15, 0x01, 0x02, 0x03});
+    report = makeReport(ads);
+    count = decodeReport(report, event, records);
+    expectFormats("unknown manufacturer data", records, count, {});
+
+    // Eddystone UID and EID frames along with the Eddystone service uuid list
+    ads = {0x03, 0x03, 0xaa, 0xfe, 0x15, 0x16, 0xaa, 0xfe, 0x00, 0xee};
+    for (int n = 0; n < 16; n ++)
+        ads.push_back(n);
+    ads.insert(ads.end(), {0x0d, 0x16, 0xaa, 0xfe, 0x30, 0xf0, 1, 2, 3, 4, 5, 6, 7, 8});
+    report = makeReport(ads);
+    count = decodeReport(report, event, records);
+    expectFormats("Eddystone UID/EID", records, count, {BEACON_FORMAT_EDDYSTONE_UID, BEACON_FORMAT_EDDYSTONE_EID});
+    if (records[0].uid.tx_power != -18 || records[0].uid.namespace_id[9] != 9 || records[0].uid.instance_id[0] != 10
+        || records[0].uid.instance_id[5] != 15)
+        printf("Failed on Eddystone UID fields\n");
+    if (records[1].ad_index != 2 || records[1].eid.tx_power != -16 || records[1].eid.eid[7] != 8)
+        printf("Failed on Eddystone EID fields\n");
+
+    // Eddystone URL of https://www.redhat.com/
+    ads = {0x0d, 0x16, 0xaa, 0xfe, 0x10, 0xeb, 0x01, 'r', 'e', 'd', 'h', 'a', 't', 0x00};
+    report = makeReport(ads);
+    count = decodeReport(report, event, records);
+    expectFormats("Eddystone URL", records, count, {BEACON_FORMAT_EDDYSTONE_URL});
+    char url[EDDYSTONE_URL_TEXT_SIZE];
+    if (strcmp(eddystoneUrlExpand(records[0].url, url), "https://www.redhat.com/") != 0)
+        printf("Failed on Eddystone URL, found %s\n", url);
+
+    // Eddystone TLM, and the RHIoTTag TLM with keys and lux appended
+    ads = {0x11, 0x16, 0xaa, 0xfe, 0x20, 0x00, 0x0b, 0xb8, 0x17, 0x80, 0x00, 0x00, 0x23, 0x28, 0x00, 0x00, 0x1d,
+           0x4c};
+    std::vector<uint8_t> rhiotTag = ads;
+    rhiotTag[0] += 3;
+    rhiotTag.insert(rhiotTag.end(), {0x05, 0x4a, 0x3f});
+    ads.insert(ads.end(), rhiotTag.begin(), rhiotTag.end());
+    report = makeReport(ads);
+    count = decodeReport(report, event, records);
+    expectFormats("TLM", records, count, {BEACON_FORMAT_EDDYSTONE_TLM, BEACON_FORMAT_RHIOTTAG_TLM});
+    for (uint32_t n = 0; n < count; n ++) {
+        const eddystone_tlm& tlm = records[n].tlm;
+        if (tlm.version != 0 || tlm.battery_mv != 3000 || tlm.temperature != 0x1780 || tlm.adv_count != 9000
+            || tlm.sec_count != 7500)
+            printf("Failed on TLM fields of record %u\n", n);
+    }
+    if (records[1].rhiot_tlm.keys != 5 || records[1].rhiot_tlm.lux_raw != 0x4a3f)
+        printf("Failed on RHIoTTag TLM fields\n");
+    // An encrypted TLM frame, version 1, is dropped rather than decoded as plain telemetry
+    ads[5] = 0x01;
+    report = makeReport(ads);
+    count = decodeReport(report, event, records);
+    expectFormats("encrypted TLM", records, count, {BEACON_FORMAT_RHIOTTAG_TLM});
+
+    // RHIoTTag misc frame with negative motion readings
+    ads = {0x13, 0x16, 0xaa, 0xfe, 0x21, 0x02, 0x4a, 0x3f, 0x00, 0x10, 0xff, 0xf0, 0x01, 0x00, 0x00, 0x20, 0xff,
+           0xe0, 0x40, 0x00};
+    report = makeReport(ads);
+    count = decodeReport(report, event, records);
+    expectFormats("RHIoTTag misc", records, count, {BEACON_FORMAT_RHIOTTAG_MISC});
+    const rhiottag_misc& misc = records[0].rhiot_misc;
+    if (misc.keys != 2 || misc.lux_raw != 0x4a3f || misc.gyro[0] != 16 || misc.gyro[1] != -16 || misc.gyro[2] != 256
+        || misc.accel[0] != 32 || misc.accel[1] != -32 || misc.accel[2] != 0x4000)
+        printf("Failed on RHIoTTag misc fields\n");
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <cstddef>
+#include <stdio.h>
+#include <string.h>
+#include <src/hcidumpinternal.h>
+#include <src/framesource.h>
+#include <src/capturewriter.h>
+#include <src/captureindex.h>
+#include "testframes.h"
+
+// The offset of the first byte of the bdaddr in the iBeaconFrame
+static const int BDADDR_OFFSET = 7;
+static const int ADDRESSES = 4;
+// The number of consecutive beacons from one address before the next address is seen
+static const int BURST = 3000;
+static const int64_t START_MS = 1463720753000ll;
+
+static int64_t beaconTime(int seq) {
+    // Every 5th beacon is stamped 50ms early so the capture is not strictly in time order
+    return START_MS + seq * 10 - (seq % 5 == 0 ? 50 : 0);
+}
+
+/**
+ * Write a btsnoop capture of count iBeacon frames, each followed by a command complete frame. The beacons cycle
+ * through the addresses in bursts, the low byte of the bdaddr is the address number.
+ */
+static void writeCapture(const char *path, int count) {
+    writeBtsnoop(path, count, [](uint8_t *frame, int seq) {
+        frame[BDADDR_OFFSET] = (seq / BURST) % ADDRESSES;
+    }, beaconTime);
+}
+
+/**
+ * The times of the events matching query found by a full scan of the capture
+ */
+static std::vector<int64_t> fullScan(const char *path, const capture_query& query) {
+    mmap_frame_source source;
+    source.open(path);
+    std::vector<int64_t> times;
+    scan_options options;
+    scan_for_ad_events(source, [&](ad_data& event) {
+        if (event.time >= query.from_time && event.time <= query.to_time
+            && (!query.match_bdaddr || memcmp(event.bdaddr, query.bdaddr, 6) == 0))
+            times.push_back(event.time);
+        return false;
+    }, options);
+    return times;
+}
+
+/**
+ * Run query through the index and check it finds the events of a full scan
+ */
+static void checkQuery(const char *name, const char *path, const capture_index& index, const capture_query& query) {
+    std::vector<std::pair<uint64_t, uint64_t>> ranges = queryCaptureRanges(index, query);
+    uint64_t bytes = 0;
+    for (const std::pair<uint64_t, uint64_t>& range : ranges)
+        bytes += range.second - range.first;
+    std::vector<int64_t> times;
+    if (queryCapture(path, query, [&](ad_data& event) {
+        times.push_back(event.time);
+        return false;
+    }) != 0)
+        printf("Failed on %s query\n", name);
+    std::vector<int64_t> expected = fullScan(path, query);
+    printf("%s: %ld events from %ld ranges, read %lu of %lu bytes\n", name, times.size(), ranges.size(), bytes,
+           index.capture_size);
+    if (times != expected)
+        printf("Failed on %s, events=%ld, expected=%ld\n", name, times.size(), expected.size());
+}
+
+/**
+ * Test building a capture index and querying the capture through it by time and address. With a capture file
+ * argument an index is built for that file.
+ */
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        if (buildCaptureIndex(argv[1]) != 0)
+            return 1;
+        capture_index index;
+        if (loadCaptureIndex(argv[1], index) != 0)
+            return 1;
+        printf("Indexed %lu records in %ld blocks, %ld addresses\n", index.records, index.blocks.size(),
+               index.addresses.size());
+        return 0;
+    }
+
+    const char *path = "/tmp/testCaptureIndex.btsnoop";
+    const int count = 4 * ADDRESSES * BURST;
+    writeCapture(path, count);
+    if (buildCaptureIndex(path, 256) != 0) {
+        printf("Failed on buildCaptureIndex\n");
+        return 1;
+    }
+    capture_index index;
+    if (loadCaptureIndex(path, index) != 0) {
+        printf("Failed on loadCaptureIndex\n");
+        return 1;
+    }
+    printf("Indexed %lu records in %ld blocks, %ld addresses\n", index.records, index.blocks.size(),
+           index.addresses.size());
+    if (index.records != 2 * count || index.blocks.size() != (2 * count + 255) / 256
+        || index.addresses.size() != ADDRESSES)
+        printf("Failed on index contents\n");
+
+    capture_query query;
+    query.from_time = beaconTime(10000);
+    query.to_time = beaconTime(10600);
+    checkQuery("time range", path, index, query);
+
+    query.match_bdaddr = true;
+    memcpy(query.bdaddr, iBeaconFrame + BDADDR_OFFSET, sizeof(query.bdaddr));
+    query.bdaddr[0] = 2;
+    query.from_time = LLONG_MIN;
+    query.to_time = LLONG_MAX;
+    checkQuery("address", path, index, query);
+
+    query.from_time = beaconTime(BURST * 6 - 20);
+    query.to_time = beaconTime(BURST * 6 + 20);
+    checkQuery("address and time", path, index, query);
+
+    query.bdaddr[0] = 0x7f;
+    std::vector<std::pair<uint64_t, uint64_t>> ranges = queryCaptureRanges(index, query);
+    if (!ranges.empty())
+        printf("Failed on unknown address, ranges=%ld\n", ranges.size());
+
+    // An index is stale once its capture changes size
+    FILE *file = fopen(path, "ab");
+    fputc(0, file);
+    fclose(file);
+    capture_index stale;
+    if (loadCaptureIndex(path, stale) == 0)
+        printf("Failed on stale index detection\n");
+    remove(path);
+    remove((std::string(path) + CAPTURE_INDEX_SUFFIX).c_str());
+
+    // The capture writer indexes each file as it is closed
+    capture_options options;
+    options.prefix = "/tmp/testCaptureIndex";
+    options.index_interval = 16;
+    capture_writer *writer = allocCaptureWriter(options);
+    struct timeval ts;
+    ts.tv_sec = START_MS / 1000;
+    for (int n = 0; n < 100; n ++) {
+        ts.tv_usec = n * 1000;
+        captureFrame(writer, iBeaconFrame, sizeof(iBeaconFrame), 1, ts);
+    }
+    freeCaptureWriter(writer);
+    const char *capture = "/tmp/testCaptureIndex-000000.btsnoop";
+    if (loadCaptureIndex(capture, index) != 0 || index.records != 100 || index.blocks.size() != 7)
+        printf("Failed on capture writer index\n");
+    // The index the writer accumulated matches one built by reading the capture back
+    capture_index rebuilt;
+    if (buildCaptureIndex(capture, 16) != 0 || loadCaptureIndex(capture, rebuilt) != 0
+        || rebuilt.records != index.records || rebuilt.blocks.size() != index.blocks.size()
+        || memcmp(rebuilt.blocks.data(), index.blocks.data(), index.blocks.size() * sizeof(capture_index_block)) != 0
+        || rebuilt.addresses.size() != index.addresses.size() || rebuilt.postings != index.postings)
+        printf("Failed on capture writer index versus buildCaptureIndex\n");
+
+    // An index whose counts claim more than the file holds is rejected rather than sized from the header
+    std::string indexPath = std::string(capture) + CAPTURE_INDEX_SUFFIX;
+    file = fopen(indexPath.c_str(), "r+b");
+    uint32_t blocks = 0xffffffff;
+    fseek(file, offsetof(capture_index_hdr, blocks), SEEK_SET);
+    fwrite(&blocks, sizeof(blocks), 1, file);
+    fclose(file);
+    if (loadCaptureIndex(capture, index) == 0)
+        printf("Failed on index with an invalid block count\n");
+    remove(capture);
+    remove(indexPath.c_str());
+
+    // Every report of an event with several reports is posted under its own address
+    uint8_t reports[] = {0x04, 0x3e, 0x1c, 0x02, 0x02,
+                         0x03, 0x01, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x03, 0x02, 0x01, 0x06, 0xc0,
+                         0x03, 0x01, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x03, 0x02, 0x01, 0x06, 0xc1};
+    capture_index_builder builder;
+    resetCaptureIndex(builder, 16);
+    addCaptureIndexRecord(builder, BTSNOOP_HDR_SIZE, START_MS, reports, sizeof(reports));
+    if (builder.postings.size() != 2 || builder.postings.count(0x111111111111ull) != 1
+        || builder.postings.count(0x222222222222ull) != 1)
+        printf("Failed on multiple report postings, addresses=%ld\n", builder.postings.size());
+    return 0;
+}
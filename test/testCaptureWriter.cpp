@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <string.h>
+#include <src/hcidumpinternal.h>
+#include <src/framesource.h>
+#include <src/capturewriter.h>
+#include "testframes.h"
+
+extern "C" {
+#include <src/parser.h>
+}
+
+/**
+ * Read back the capture file with the given sequence number and validate its frames
+ * @return the count of frames in the file
+ */
+static int readCapture(const char *prefix, int sequence, int first) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s-%06d.btsnoop", prefix, sequence);
+    file_frame_source source;
+    if (source.open(path, DUMP_FORMAT_BTSNOOP) != 0) {
+        printf("Failed on open of %s\n", path);
+        return 0;
+    }
+    uint8_t buffer[1028];
+    struct frame frm;
+    int count = 0;
+    frm.data = buffer;
+    while (source.read_frame(&frm, sizeof(buffer)) > 0) {
+        int n = first + count;
+        if (frm.data_len != sizeof(iBeaconFrame) || memcmp(frm.data, iBeaconFrame, sizeof(iBeaconFrame)) != 0
+            || frm.in != 1 || frm.ts.tv_sec != 1463720753 || frm.ts.tv_usec != n)
+            printf("Failed on frame %d of %s\n", count, path);
+        count ++;
+        frm.data = buffer;
+    }
+    remove(path);
+    return count;
+}
+
+/**
+ * Test the capture writer by teeing frames to rotating btsnoop files and reading them back with the file frame
+ * source
+ */
+int main(int argc, char **argv) {
+    const char *prefix = "/tmp/testCaptureWriter";
+    // Each record is the 24 byte btsnoop_pkt header plus the frame, so each file holds 10 frames
+    capture_options options;
+    options.prefix = prefix;
+    options.max_file_bytes = BTSNOOP_HDR_SIZE + 10 * (BTSNOOP_PKT_SIZE + sizeof(iBeaconFrame));
+    capture_writer *writer = allocCaptureWriter(options);
+    if (writer == nullptr) {
+        printf("Failed on allocCaptureWriter\n");
+        return 1;
+    }
+
+    const int count = 35;
+    struct timeval ts;
+    ts.tv_sec = 1463720753;
+    for (int n = 0; n < count; n ++) {
+        ts.tv_usec = n;
+        if (!captureFrame(writer, iBeaconFrame, sizeof(iBeaconFrame), 1, ts))
+            printf("Failed on captureFrame(%d)\n", n);
+    }
+    freeCaptureWriter(writer);
+
+    int total = 0;
+    for (int sequence = 0; sequence < 4; sequence ++) {
+        int frames = readCapture(prefix, sequence, total);
+        printf("file %d: %d frames\n", sequence, frames);
+        if (frames != (sequence < 3 ? 10 : 5))
+            printf("Failed on file %d frame count\n", sequence);
+        total += frames;
+    }
+
+    // A writer restarted on the same prefix continues after the existing capture rather than truncating it
+    options.max_file_bytes = 0;
+    for (int n = 0; n < 2; n ++) {
+        writer = allocCaptureWriter(options);
+        if (writer == nullptr) {
+            printf("Failed on restarted allocCaptureWriter\n");
+            return 1;
+        }
+        ts.tv_usec = n;
+        captureFrame(writer, iBeaconFrame, sizeof(iBeaconFrame), 1, ts);
+        freeCaptureWriter(writer);
+    }
+    if (readCapture(prefix, 0, 0) != 1 || readCapture(prefix, 1, 1) != 1)
+        printf("Failed on restarted writer sequence\n");
+
+    // Flood a small queue, every frame must either be written or counted as a drop
+    options.queue_bytes = 4096;
+    writer = allocCaptureWriter(options);
+    const int flood = 100000;
+    int queued = 0;
+    for (int n = 0; n < flood; n ++) {
+        // Stamped with the count queued so far, so the written frames are numbered without the gaps of the drops
+        ts.tv_usec = queued;
+        queued += captureFrame(writer, iBeaconFrame, sizeof(iBeaconFrame), 1, ts);
+    }
+    uint64_t drops = captureDrops(writer);
+    freeCaptureWriter(writer);
+    int frames = readCapture(prefix, 0, 0);
+    printf("flood: queued=%d, drops=%lu, frames=%d\n", queued, drops, frames);
+    if (frames != queued || queued + drops != flood)
+        printf("Failed on flood accounting\n");
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include <cstddef>
+#include <stdio.h>
+#include "../src/hcidumpinternal.h"
+#include "../src/eventbatch.h"
+
+/**
+ * Test the offset of the event_batch_header struct fields and the record placement for use with a direct
+ * ByteBuffer via JNI
+ */
+int main(int argc, char * * argv) {
+    printf("sizeof(event_batch_header) = %zu\n", sizeof(event_batch_header));
+    printf("offsetof(event_batch_header.count) = %zu\n", offsetof(event_batch_header, count));
+    printf("offsetof(event_batch_header.length) = %zu\n", offsetof(event_batch_header, length));
+    printf("offsetof(event_batch_header.offsets) = %zu\n", offsetof(event_batch_header, offsets));
+
+    // Fill a batch with beacon_info records and validate the offsets
+    uint64_t buffer[1024];
+    event_batch batch;
+    if(!batchInit(batch, buffer, sizeof(buffer), 4, 1000, sizeof(beacon_info)))
+        printf("Failed on batchInit\n");
+    for(int n = 0; n < 4; n ++) {
+        uint8_t *record = batchReserve(batch, sizeof(beacon_info));
+        if(record == nullptr)
+            printf("Failed on batchReserve(%d)\n", n);
+        ((beacon_info *) record)->count = n;
+        batchCommit(batch, record, sizeof(beacon_info));
+    }
+    if(batchReserve(batch, sizeof(beacon_info)) != nullptr)
+        printf("Failed on full batch\n");
+    if(!batchReady(batch))
+        printf("Failed on batchReady\n");
+    for(uint32_t n = 0; n < batch.header->count; n ++) {
+        uint32_t offset = batch.header->offsets[n];
+        beacon_info *info = (beacon_info *) (((uint8_t *) buffer) + offset);
+        printf("record[%u].offset = %u\n", n, offset);
+        if(offset % EVENT_BATCH_RECORD_ALIGN != 0 || info->count != (int32_t) n)
+            printf("Failed on record %u\n", n);
+    }
+    if(batchDueMS(batch, 5000) != 0)
+        printf("Failed on batchDueMS of a full batch\n");
+    batchReset(batch);
+    if(batchReady(batch))
+        printf("Failed on batchReset\n");
+
+    // An empty batch waits the idle time, a partial one no longer than the window from its first record
+    if(batchDueMS(batch, 5000) != 5000)
+        printf("Failed on batchDueMS of an empty batch\n");
+    uint8_t *record = batchReserve(batch, sizeof(beacon_info));
+    batchCommit(batch, record, sizeof(beacon_info));
+    int due = batchDueMS(batch, 5000);
+    if(due <= 0 || due > 1000)
+        printf("Failed on batchDueMS of a partial batch, due=%d\n", due);
+}
@@ -1,21 +1,51 @@
 #include <src/hcidumpinternal.h>
+#include <src/capturewriter.h>
 #include <cstring>
 
 static bool callback(ad_data& info) {
-    printf("ad_data:{time=%ld, rssi=%d, count=%ld}\n", info.time, info.rssi, info.data.size());
+    printf("ad_data:{hci%d, time=%ld, rssi=%d, count=%ld}\n", info.dev_id, info.time, info.rssi, info.data.size());
 }
 
 int main(int argc, char **argv) {
     bool debug = false;
-    int dev = 0;
+    std::vector<int32_t> devs;
+    scan_options options;
     for(int n = 1; n < argc; n ++) {
+        // -i dev, repeat to scan several devices from one epoll loop
         if(strncmp("-i", argv[n], 2) == 0) {
             n ++;
-            dev = ::atoi(argv[n]);
+            devs.push_back(::atoi(argv[n]));
+        }
+        // -b batchSize
+        else if(strncmp("-b", argv[n], 2) == 0) {
+            n ++;
+            options.batch_size = ::atoi(argv[n]);
+        }
+        // -f, filter out everything but LE advertising reports in the kernel
+        else if(strncmp("-f", argv[n], 2) == 0) {
+            options.le_meta_only = true;
+            options.adv_reports_only = true;
+        }
+        // -w prefix, tee the raw frames to rotating btsnoop files
+        else if(strncmp("-w", argv[n], 2) == 0) {
+            n ++;
+            capture_options captureOptions;
+            captureOptions.prefix = argv[n];
+            options.capture = allocCaptureWriter(captureOptions);
+        }
+        // -l maxLatencyMS
+        else if(strncmp("-l", argv[n], 2) == 0) {
+            n ++;
+            options.max_latency_ms = ::atoi(argv[n]);
         }
         if(argv[n][1] == 'd')
             debug = true;
     }
     hcidumpDebugMode = debug;
-    scan_for_ad_events(dev, callback);
+    if(devs.size() > 1)
+        scan_for_ad_events(devs, callback, options);
+    else
+        scan_for_ad_events(devs.empty() ? 0 : devs[0], callback, options);
+    if(options.capture)
+        freeCaptureWriter(options.capture);
 }
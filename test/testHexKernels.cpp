@@ -0,0 +1,95 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <src/hexutil.h>
+
+/**
+ * Test the block hex kernels against the scalar ones and the printf formatting they replace, and the uuid and bdaddr
+ * text round trips
+ */
+int main() {
+    printf("hex kernel: %s\n", HEX_KERNEL);
+    srand(1463720753);
+    uint8_t data[64];
+    char text[2*sizeof(data) + 1];
+    char expected[3*sizeof(data) + 1];
+    uint8_t decoded[sizeof(data)];
+    for (int pass = 0; pass < 1000; pass ++) {
+        uint32_t length = pass % (sizeof(data) + 1);
+        for (uint32_t n = 0; n < length; n ++)
+            data[n] = rand();
+        for (uint32_t n = 0; n < length; n ++)
+            sprintf(expected + 2*n, "%.2X", data[n]);
+        expected[2*length] = 0;
+        hexEncode(data, length, text);
+        if (strcmp(text, expected) != 0)
+            printf("Failed on hexEncode(%u), expected %s, found %s\n", length, expected, text);
+        // Decoding accepts either case
+        for (uint32_t n = 0; n < 2*length; n += 3)
+            text[n] = tolower(text[n]);
+        if (!hexDecode(text, length, decoded) || memcmp(decoded, data, length) != 0)
+            printf("Failed on hexDecode(%u) of %s\n", length, text);
+
+        char *loc = expected;
+        for (uint32_t n = 0; n < length; n ++)
+            loc += sprintf(loc, n == 0 ? "%.2X" : " %.2X", data[n]);
+        char separated[3*sizeof(data) + 1];
+        uint32_t separatedLength = hexEncodeSeparated(data, length, ' ', separated);
+        if (strcmp(separated, expected) != 0 || separatedLength != strlen(expected))
+            printf("Failed on hexEncodeSeparated(%u), expected %s, found %s\n", length, expected, separated);
+    }
+
+    // The block kernel compiled in matches the scalar one
+    char scalarText[2*HEX_BLOCK_SIZE];
+    uint8_t scalarDecoded[HEX_BLOCK_SIZE];
+    hexEncodeBlock(data, text);
+    hexEncodeBlockScalar(data, scalarText);
+    if (memcmp(text, scalarText, sizeof(scalarText)) != 0)
+        printf("Failed on hexEncodeBlock versus hexEncodeBlockScalar\n");
+    hexDecodeBlock(text, decoded);
+    hexDecodeBlockScalar(text, scalarDecoded);
+    if (memcmp(decoded, scalarDecoded, sizeof(scalarDecoded)) != 0)
+        printf("Failed on hexDecodeBlock versus hexDecodeBlockScalar\n");
+
+    // Every char that is not a hex digit is rejected in every position of a block
+    for (int c = 1; c < 256; c ++) {
+        bool digit = strchr("0123456789abcdefABCDEF", c) != nullptr;
+        for (int position = 0; position < 2*HEX_BLOCK_SIZE; position += 7) {
+            memset(text, '0', 2*HEX_BLOCK_SIZE);
+            text[position] = (char) c;
+            if (hexDecodeBlock(text, decoded) != digit || hexDecodeBlockScalar(text, decoded) != digit)
+                printf("Failed on hexDecodeBlock of char 0x%.2x at %d\n", c, position);
+        }
+    }
+
+    const uint8_t uuid[] = {0xda, 0xf2, 0x46, 0xce, 0xf2, 0x01, 0x11, 0xe4, 0xb1, 0x16, 0x12, 0x3b, 0x93, 0xf7, 0x5c,
+                            0xba};
+    char uuidText[UUID_STRING_LENGTH + 1];
+    uuidToString(uuid, uuidText);
+    if (strcmp(uuidText, "DAF246CE-F201-11E4-B116-123B93F75CBA") != 0)
+        printf("Failed on uuidToString, found %s\n", uuidText);
+    uint8_t uuidBytes[16];
+    if (!uuidFromString("daf246ce-f201-11e4-b116-123b93f75cba", uuidBytes) || memcmp(uuid, uuidBytes, 16) != 0)
+        printf("Failed on uuidFromString\n");
+    if (uuidFromString("daf246ce-f201-11e4-b116-123b93f75cbg", uuidBytes)
+        || uuidFromString("daf246cef-201-11e4-b116-123b93f75cba", uuidBytes))
+        printf("Failed on uuidFromString of an invalid uuid\n");
+
+    // The bdaddr is stored least significant byte first, as by the bluez str2ba
+    const uint8_t bdaddr[] = {0xb0, 0x71, 0xd0, 0x4a, 0x3c, 0xb0};
+    char bdaddrText[BDADDR_STRING_LENGTH + 1];
+    bdaddrToString(bdaddr, bdaddrText);
+    if (strcmp(bdaddrText, "B0:3C:4A:D0:71:B0") != 0)
+        printf("Failed on bdaddrToString, found %s\n", bdaddrText);
+    uint8_t bdaddrBytes[6];
+    if (!bdaddrFromString("b0:3c:4a:d0:71:b0", bdaddrBytes) || memcmp(bdaddr, bdaddrBytes, 6) != 0)
+        printf("Failed on bdaddrFromString\n");
+    if (bdaddrFromString("B0:3C:4A:D0:71:BX", bdaddrBytes) || bdaddrFromString("B0:3C:4A-D0:71:B0", bdaddrBytes))
+        printf("Failed on bdaddrFromString of an invalid bdaddr\n");
+
+    char hex[HEX_STRING_SIZE(6)];
+    if (strcmp(toHexString(bdaddr, 6, hex), "B0:71:D0:4A:3C:B0:") != 0)
+        printf("Failed on toHexString, found %s\n", hex);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <src/latencyhist.h>
+
+/**
+ * Test the latency histogram buckets, percentiles and export layout
+ */
+int main() {
+    // Every value falls in a bucket whose low end is within the sub-bucket precision below it
+    uint32_t last = 0;
+    int errors = 0;
+    for (uint64_t value = 0; value < (1ull << 41); value = value < 4096 ? value + 1 : value + value / 1000 + 1) {
+        uint32_t bucket = latencyBucket(value);
+        uint64_t low = latencyBucketLow(bucket);
+        if (bucket < last || bucket >= LATENCY_BUCKETS || low > value
+            || (value - low) * LATENCY_SUB_BUCKETS > value) {
+            if (errors++ < 10)
+                printf("Failed on value=%lu, bucket=%u, low=%lu\n", value, bucket, low);
+        }
+        last = bucket;
+    }
+    if (latencyBucket(~0ull) != LATENCY_BUCKETS - 1)
+        printf("Failed on overflow bucket\n");
+
+    // Percentiles of a uniform 1..100us distribution, with a 1ms outlier
+    scan_latency *latency = new scan_latency;
+    latency_histogram& histogram = latency->histograms[LATENCY_CALLBACK];
+    for (int n = 1; n <= 100000; n ++)
+        latencyRecord(histogram, n);
+    latencyRecord(histogram, 1000000);
+    const double percentiles[] = {50, 90, 99};
+    for (double percentile : percentiles) {
+        uint64_t value = latencyPercentile(histogram, percentile);
+        double expected = percentile * 1000;
+        if (value > expected || value < expected * (1 - 1.0 / LATENCY_SUB_BUCKETS))
+            printf("Failed on p%.0f=%lu, expected=%.0f\n", percentile, value, expected);
+    }
+    if (histogram.max != 1000000)
+        printf("Failed on max=%lu\n", histogram.max.load());
+    printScanLatency(*latency);
+
+    std::vector<uint8_t> buffer(LATENCY_EXPORT_SIZE);
+    if (latencyExport(*latency, buffer.data(), buffer.size() - 1) != 0)
+        printf("Failed on short export buffer\n");
+    if (latencyExport(*latency, buffer.data(), buffer.size()) != LATENCY_EXPORT_SIZE)
+        printf("Failed on export size\n");
+    latency_export_header *header = (latency_export_header *) buffer.data();
+    const uint64_t *counts = (const uint64_t *) (header + 1) + LATENCY_CALLBACK * (LATENCY_BUCKETS + 1);
+    uint64_t total = 0;
+    for (uint32_t n = 0; n < header->buckets; n ++)
+        total += counts[n];
+    if (header->version != LATENCY_EXPORT_VERSION || header->histograms != LATENCY_HISTOGRAMS
+        || total != 100001 || counts[LATENCY_BUCKETS] != 1000000)
+        printf("Failed on export contents, total=%lu\n", total);
+    delete latency;
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <src/hcidumpinternal.h>
+#include <src/framesource.h>
+#include <src/parallelparser.h>
+#include "testframes.h"
+
+// The offsets of the manufacturer data, the beacon minor and the rssi in the iBeaconFrame
+static const int MFG_DATA_OFFSET = 19;
+static const int MINOR_OFFSET = 41;
+static const int RSSI_OFFSET = 44;
+static const int64_t START_MS = 1463720753000ll;
+
+/**
+ * Write a btsnoop UART archive of count iBeacon frames, each followed by a command complete frame. The minor of each
+ * beacon is its sequence number, and every 7th frame is stamped 100ms early so the archive is not in time order.
+ */
+static void writeArchive(const char *path, int count) {
+    writeBtsnoop(path, count, [](uint8_t *frame, int seq) {
+        frame[MINOR_OFFSET] = seq >> 8;
+        frame[MINOR_OFFSET + 1] = seq & 0xff;
+    }, [](int seq) {
+        return START_MS + seq * 10 - (seq % 7 == 0 ? 100 : 0);
+    });
+}
+
+/**
+ * The time and minor of an event, enough to identify it in the archive
+ */
+struct event_key {
+    int64_t time;
+    int minor;
+    bool operator==(const event_key& o) const { return time == o.time && minor == o.minor; }
+};
+
+static int inlineMinor(ad_data_inline& event) {
+    // The manufacturer data follows the 3 byte flags AD structure
+    const uint8_t *ads = (const uint8_t *) event.data;
+    const uint8_t *mfg = ads + ads[0] + 2;
+    return (mfg[2 + MINOR_OFFSET - MFG_DATA_OFFSET] << 8) | mfg[3 + MINOR_OFFSET - MFG_DATA_OFFSET];
+}
+
+/**
+ * Parse the archive sequentially through the memory mapped frame source and stable sort the events by time, which is
+ * the order the parallel parser must produce
+ */
+static std::vector<event_key> sequentialOrder(const char *path) {
+    mmap_frame_source source;
+    source.open(path);
+    std::vector<event_key> events;
+    scan_options options;
+    scan_for_ad_events_view(source, [&](ad_data_view& event) {
+        const uint8_t *mfg = ad_view_data(event, 1);
+        event_key key;
+        key.time = event.time;
+        key.minor = (mfg[MINOR_OFFSET - MFG_DATA_OFFSET] << 8) | mfg[MINOR_OFFSET + 1 - MFG_DATA_OFFSET];
+        events.push_back(key);
+        return false;
+    }, options);
+    std::stable_sort(events.begin(), events.end(), [](const event_key& a, const event_key& b) {
+        return a.time < b.time;
+    });
+    return events;
+}
+
+/**
+ * Test the parallel parser produces the events of the sequential parse in time order for several thread counts and
+ * chunk sizes, and time it on a larger archive. With a capture file argument that file is parsed instead, -t sets the
+ * number of threads.
+ */
+int main(int argc, char **argv) {
+    parallel_parse_options options;
+    const char *path = nullptr;
+    for(int n = 1; n < argc; n ++) {
+        if(strcmp("-t", argv[n]) == 0) {
+            n ++;
+            options.threads = ::atoi(argv[n]);
+        }
+        else
+            path = argv[n];
+    }
+    if(path != nullptr) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        long events = 0;
+        if(parse_archive_parallel(path, [&](ad_data_inline& event) {
+            events ++;
+            return false;
+        }, options) != 0)
+            return 1;
+        printf("Parsed %ld events in %ldms\n", events, (long) std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        return 0;
+    }
+
+    const char *archive = "/tmp/testParallelParser.log";
+    const int count = 5000;
+    writeArchive(archive, count);
+    std::vector<event_key> expected = sequentialOrder(archive);
+    if (expected.size() != count)
+        printf("Failed on sequential parse, events=%ld\n", expected.size());
+
+    for (uint32_t threads : {1u, 2u, 4u, 8u}) {
+        for (uint32_t chunkBytes : {512u, 4096u, 1024u * 1024u}) {
+            options.threads = threads;
+            options.chunk_bytes = chunkBytes;
+            parallel_parse_stats stats;
+            std::vector<event_key> events;
+            bool ok = true;
+            parse_archive_parallel(archive, [&](ad_data_inline& event) {
+                event_key key;
+                key.time = event.time;
+                key.minor = inlineMinor(event);
+                events.push_back(key);
+                if (event.count != 2 || event.rssi != (int8_t) iBeaconFrame[RSSI_OFFSET] || event.bdaddr[0] != 0x85)
+                    ok = false;
+                return false;
+            }, options, &stats);
+            if (!ok || events != expected || stats.frames != 2 * count)
+                printf("Failed on threads=%u, chunk_bytes=%u, events=%ld, frames=%lu\n", threads, chunkBytes,
+                       events.size(), stats.frames);
+        }
+    }
+
+    // Stop after the first event
+    int seen = 0;
+    parse_archive_parallel(archive, [&](ad_data_inline& event) {
+        seen ++;
+        return true;
+    }, options);
+    if (seen != 1)
+        printf("Failed on stop, seen=%d\n", seen);
+
+    // Time a larger archive on an increasing number of threads
+    writeArchive(archive, 500000);
+    uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+    int64_t single = 0;
+    for (uint32_t threads = 1; threads <= cores; threads *= 2) {
+        options.threads = threads;
+        options.chunk_bytes = 1024 * 1024;
+        long events = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        parse_archive_parallel(archive, [&](ad_data_inline& event) {
+            events ++;
+            return false;
+        }, options);
+        int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        if (threads == 1)
+            single = elapsed;
+        printf("threads=%u: %ld events in %ldus, speedup=%.2f\n", threads, events, elapsed,
+               (double) single / elapsed);
+    }
+    remove(archive);
+    return 0;
+}
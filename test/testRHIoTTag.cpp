@@ -141,23 +141,14 @@ static bool callback(ad_data& info) {
     return false;
 }
 
-static inline const char* toHexString(uint8_t *data, uint8_t length) {
-    static char buffer[64];
-    char *loc = buffer;
-    for(int n = 0; n < length; n ++) {
-        sprintf(loc, "%.2X:", data[n]);
-        loc += 3;
-    }
-    *loc = 0;
-    return buffer;
-}
 static bool inline_callback(ad_data_inline& info) {
     printf("ad_data:{time=%ld, rssi=%d, count=%d}\n", info.time, info.rssi, info.count);
     uint8_t *start = (uint8_t *) &info.data;
     for (int i = 0; i < info.count; ++i) {
         ad_structure* adsPtr = (ad_structure *) start;
         ad_structure& ads = *adsPtr;
-        printf("\tAD(%d:%d): %s\n", ads.type, ads.length, toHexString(ads.data, ads.length));
+        char hex[HEX_STRING_SIZE(sizeof(ads.data))];
+        printf("\tAD(%d:%d): %s\n", ads.type, ads.length, toHexString(ads.data, ads.length, hex));
         if(memcmp(ads.data, EDDYSTONE_UUID, 2) == 0 && ads.length > 4) {
             // Move past the frame length
             eddystoneTLM_t *data = (eddystoneTLM_t *) (ads.data+2);
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <src/hcidumpinternal.h>
+#include <src/framesource.h>
+#include "testframes.h"
+
+// The capture time of the first frame, and the gap between frames in milliseconds
+static const int64_t START_SEC = 1463720753;
+static const int FRAME_GAP_MS = 20;
+
+/**
+ * Write count iBeacon frames, each followed by a command complete frame, to path in the given format
+ */
+static void writeCapture(const char *path, dump_format format, uint32_t btsnoopType, int count) {
+    auto frameTime = [](int seq) {
+        return START_SEC * 1000 + seq * FRAME_GAP_MS;
+    };
+    if (format == DUMP_FORMAT_BTSNOOP) {
+        writeBtsnoop(path, count, [](uint8_t *, int) {}, frameTime, btsnoopType);
+        return;
+    }
+    FILE *file = fopen(path, "wb");
+    for (int n = 0; n < 2 * count; n ++) {
+        const uint8_t *frame = n % 2 == 0 ? iBeaconFrame : commandCompleteFrame;
+        uint32_t length = n % 2 == 0 ? sizeof(iBeaconFrame) : sizeof(commandCompleteFrame);
+        struct timeval ts = millisToTimeval(frameTime(n / 2));
+        if (format == DUMP_FORMAT_PKTLOG) {
+            pktlog_hdr ph;
+            ph.len = htobe32(length - 1 + PKTLOG_HDR_SIZE - sizeof(ph.len));
+            ph.ts = htobe64(((uint64_t) ts.tv_sec << 32) | ts.tv_usec);
+            ph.type = 0x01;
+            fwrite(&ph, PKTLOG_HDR_SIZE, 1, file);
+            fwrite(frame + 1, length - 1, 1, file);
+        } else {
+            hcidump_hdr dh;
+            dh.len = htole16(length);
+            dh.in = 1;
+            dh.pad = 0;
+            dh.ts_sec = htole32(ts.tv_sec);
+            dh.ts_usec = htole32(ts.tv_usec);
+            fwrite(&dh, HCIDUMP_HDR_SIZE, 1, file);
+            fwrite(frame, length, 1, file);
+        }
+    }
+    fclose(file);
+}
+
+/**
+ * Replay the capture at path and validate the events parsed from it
+ * @return the time in milliseconds the replay took
+ */
+static int64_t replay(const char *name, const char *path, dump_format expected, int count, replay_pacing pacing,
+                      double speed) {
+    file_frame_source source(pacing, speed, 2);
+    if (source.open(path) != 0 || source.getFormat() != expected)
+        printf("Failed on %s open, format=%d\n", name, source.getFormat());
+
+    int events = 0;
+    bool ok = true;
+    scan_options options;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    scan_for_ad_events(source, [&](ad_data& info) {
+        int64_t expectedTime = START_SEC * 1000 + events * FRAME_GAP_MS;
+        if (info.dev_id != 2 || info.time != expectedTime || info.rssi != -80 || info.data.size() != 2
+            || info.bdaddr[0] != 0x85 || info.data[1]->type != 0xff)
+            ok = false;
+        events ++;
+        return false;
+    }, options);
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    if (events != count || !ok)
+        printf("Failed on %s replay, events=%d, ok=%d\n", name, events, ok);
+    printf("%s: replayed %d events in %ldms\n", name, events, elapsed);
+    return elapsed;
+}
+
+/**
+ * Test replaying captures through the scan loop with each file format and pacing mode. With a capture file argument
+ * that file is replayed instead, -r for real time pacing, -s speed for scaled pacing or -m to memory map a btsnoop file.
+ */
+int main(int argc, char **argv) {
+    replay_pacing pacing = REPLAY_MAX_SPEED;
+    double speed = 1.0;
+    bool mapped = false;
+    const char *path = nullptr;
+    for(int n = 1; n < argc; n ++) {
+        if(strcmp("-r", argv[n]) == 0)
+            pacing = REPLAY_REAL_TIME;
+        else if(strcmp("-s", argv[n]) == 0) {
+            n ++;
+            pacing = REPLAY_SCALED;
+            speed = ::atof(argv[n]);
+        }
+        else if(strcmp("-m", argv[n]) == 0)
+            mapped = true;
+        else if(strcmp("-d", argv[n]) == 0)
+            hcidumpDebugMode = true;
+        else
+            path = argv[n];
+    }
+    if(path != nullptr) {
+        file_frame_source fileSource(pacing, speed);
+        mmap_frame_source mappedSource;
+        if((mapped ? mappedSource.open(path) : fileSource.open(path)) != 0)
+            return 1;
+        scan_options options;
+        long events = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        scan_for_ad_events(mapped ? (frame_source&) mappedSource : fileSource, [&](ad_data& info) {
+            if(hcidumpDebugMode)
+                printf("ad_data:{time=%ld, rssi=%d, count=%ld}\n", info.time, info.rssi, info.data.size());
+            events ++;
+            return false;
+        }, options);
+        printf("Replayed %ld events in %ldms\n", events, (long) std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        return 0;
+    }
+
+    const int count = 50;
+    const char *capture = "/tmp/testReplay.log";
+    writeCapture(capture, DUMP_FORMAT_BTSNOOP, BTSNOOP_TYPE_UART, count);
+    replay("btsnoop(1002)", capture, DUMP_FORMAT_BTSNOOP, count, REPLAY_MAX_SPEED, 1.0);
+    writeCapture(capture, DUMP_FORMAT_BTSNOOP, BTSNOOP_TYPE_HCI, count);
+    replay("btsnoop(1001)", capture, DUMP_FORMAT_BTSNOOP, count, REPLAY_MAX_SPEED, 1.0);
+    writeCapture(capture, DUMP_FORMAT_PKTLOG, 0, count);
+    replay("pktlog", capture, DUMP_FORMAT_PKTLOG, count, REPLAY_MAX_SPEED, 1.0);
+    writeCapture(capture, DUMP_FORMAT_HCIDUMP, 0, count);
+    replay("hcidump", capture, DUMP_FORMAT_HCIDUMP, count, REPLAY_MAX_SPEED, 1.0);
+
+    // Replay the btsnoop captures again through the memory mapped source
+    for (uint32_t type : {BTSNOOP_TYPE_UART, BTSNOOP_TYPE_HCI}) {
+        writeCapture(capture, DUMP_FORMAT_BTSNOOP, type, count);
+        mmap_frame_source source(2);
+        if (source.open(capture) != 0)
+            printf("Failed on mmap(%d) open\n", type);
+        int events = 0;
+        scan_options options;
+        scan_for_ad_events(source, [&](ad_data& info) {
+            if (info.dev_id != 2 || info.time != START_SEC * 1000 + events * FRAME_GAP_MS || info.data.size() != 2)
+                printf("Failed on mmap(%d) event %d\n", type, events);
+            events ++;
+            return false;
+        }, options);
+        printf("mmap(%d): replayed %d events\n", type, events);
+        if (events != count)
+            printf("Failed on mmap(%d) replay, events=%d\n", type, events);
+    }
+    writeCapture(capture, DUMP_FORMAT_HCIDUMP, 0, count);
+
+    // The capture spans (count-1)*FRAME_GAP_MS, so paced replays should take about that long divided by the speed
+    int64_t span = (count - 1) * FRAME_GAP_MS;
+    int64_t elapsed = replay("real time", capture, DUMP_FORMAT_HCIDUMP, count, REPLAY_REAL_TIME, 1.0);
+    if (elapsed < span || elapsed > span + 200)
+        printf("Failed on real time pacing, elapsed=%ld, expected=%ld\n", elapsed, span);
+    elapsed = replay("scaled x4", capture, DUMP_FORMAT_HCIDUMP, count, REPLAY_SCALED, 4.0);
+    if (elapsed < span / 4 || elapsed > span / 4 + 200)
+        printf("Failed on scaled pacing, elapsed=%ld, expected=%ld\n", elapsed, span / 4);
+    remove(capture);
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <cstddef>
+#include <stdio.h>
+#include <thread>
+#include "../src/hcidumpinternal.h"
+#include "../src/spscring.h"
+
+/**
+ * Test the offset of the spsc_ring_header struct fields for use with a direct ByteBuffer via JNI, and run a
+ * producer thread against a consumer to validate the records wrap around the ring in order.
+ */
+int main(int argc, char * * argv) {
+    printf("sizeof(spsc_ring_header) = %zu\n", sizeof(spsc_ring_header));
+    printf("offsetof(spsc_ring_header.magic) = %zu\n", offsetof(spsc_ring_header, magic));
+    printf("offsetof(spsc_ring_header.capacity) = %zu\n", offsetof(spsc_ring_header, capacity));
+    printf("offsetof(spsc_ring_header.data_offset) = %zu\n", offsetof(spsc_ring_header, data_offset));
+    printf("offsetof(spsc_ring_header.drops) = %zu\n", offsetof(spsc_ring_header, drops));
+    printf("offsetof(spsc_ring_header.head) = %zu\n", offsetof(spsc_ring_header, head));
+    printf("offsetof(spsc_ring_header.tail) = %zu\n", offsetof(spsc_ring_header, tail));
+    printf("offsetof(spsc_ring_header.consumer_waiting) = %zu\n", offsetof(spsc_ring_header, consumer_waiting));
+    printf("offsetof(spsc_ring_header.wake_seq) = %zu\n", offsetof(spsc_ring_header, wake_seq));
+    if(sizeof(spsc_ring_header) != SPSC_RING_HEADER_SIZE)
+        printf("Failed on sizeof(spsc_ring_header)\n");
+
+    const int count = 100000;
+    uint64_t buffer[(SPSC_RING_HEADER_SIZE + 4096)/8];
+    spsc_ring_producer producer;
+    if(!ringInit(producer, buffer, sizeof(buffer), sizeof(beacon_info)))
+        printf("Failed on ringInit\n");
+
+    // Each reserve that finds the ring full counts a drop, so the producer counts its retries to check the drops
+    uint64_t retries = 0;
+    std::thread t([&producer, &retries] {
+        beacon_info info;
+        memset(&info, 0, sizeof(info));
+        for(int n = 0; n < count; n ++) {
+            info.count = n;
+            uint8_t *record;
+            // Spin on a full ring
+            while((record = ringReserve(producer, SPSC_RING_BEACON_INFO, sizeof(info))) == nullptr) {
+                retries ++;
+                std::this_thread::yield();
+            }
+            memcpy(record, &info, sizeof(info));
+            ringPublish(producer);
+        }
+    });
+
+    spsc_ring_header *header = (spsc_ring_header *) buffer;
+    int expected = 0;
+    while(expected < count) {
+        const spsc_ring_record *record = ringNext(header);
+        if(record == nullptr) {
+            ringWait(header, 100);
+            continue;
+        }
+        const beacon_info *info = (const beacon_info *) record->data;
+        if(record->type != SPSC_RING_BEACON_INFO || info->count != expected) {
+            printf("Failed on record %d, type=%d, count=%d\n", expected, record->type, info->count);
+            break;
+        }
+        ringRelease(header, record);
+        expected ++;
+    }
+    t.join();
+    printf("consumed %d records, drops=%lu\n", expected, header->drops);
+    if(header->drops != retries)
+        printf("Failed on drops=%lu, expected %lu\n", header->drops, retries);
+
+    // With no consumer, every reserve past the capacity of the ring is dropped
+    if(!ringInit(producer, buffer, sizeof(buffer), sizeof(beacon_info)))
+        printf("Failed on ringInit\n");
+    int published = 0;
+    for(int n = 0; n < 1000; n ++) {
+        if(ringReserve(producer, SPSC_RING_BEACON_INFO, sizeof(beacon_info)) == nullptr)
+            continue;
+        ringPublish(producer);
+        published ++;
+    }
+    if(published == 0 || header->drops != (uint64_t) (1000 - published))
+        printf("Failed on full ring, published=%d, drops=%lu\n", published, header->drops);
+}
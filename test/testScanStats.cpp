@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <thread>
+#include <src/hcidumpinternal.h>
+#include "testframes.h"
+
+// The iBeaconFrame report cut off in its AD structures
+static const uint32_t TRUNCATED_SIZE = 24;
+// An ACL data packet, which is not an HCI event
+static uint8_t aclFrame[] = {0x02, 0x01, 0x20, 0x02, 0x00, 0x01, 0x02};
+
+static void sendFrame(int sock, const uint8_t *frame, uint32_t length) {
+    if (send(sock, frame, length, 0) < 0)
+        perror("Can't send frame");
+}
+
+/**
+ * Test the scan loop stats counters. The parse results of each kind of frame are counted, and a reader thread
+ * checks that every snapshot it takes while the scan loop is updating the counters is consistent.
+ */
+int main() {
+    int socks[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, socks) < 0) {
+        perror("Can't create socketpair");
+        return 1;
+    }
+    const uint32_t count = 200000;
+    scan_stats stats;
+    scan_control control;
+    scan_options options;
+    options.control = &control;
+    options.stats = &stats;
+    uint32_t events = 0;
+
+    // The iBeacon and truncated frames alternate, so the bytes of a consistent snapshot of them follow from its counts
+    std::atomic<bool> done(false);
+    uint64_t snapshots = 0, inconsistent = 0;
+    std::thread reader([&] {
+        scan_stats_snapshot snapshot;
+        while (!done.load()) {
+            scanStatsRead(stats, snapshot);
+            snapshots ++;
+            if (snapshot.frames > count)
+                continue;
+            if (snapshot.bytes != snapshot.adv_reports * sizeof(iBeaconFrame) + snapshot.parse_errors * TRUNCATED_SIZE
+                || snapshot.frames != snapshot.adv_reports + snapshot.parse_errors)
+                inconsistent ++;
+        }
+    });
+    std::thread sender([&] {
+        for (uint32_t n = 0; n < count; n ++)
+            sendFrame(socks[0], iBeaconFrame, n % 2 == 0 ? sizeof(iBeaconFrame) : TRUNCATED_SIZE);
+        sendFrame(socks[0], commandCompleteFrame, sizeof(commandCompleteFrame));
+        sendFrame(socks[0], aclFrame, sizeof(aclFrame));
+        sendFrame(socks[0], iBeaconFrame, sizeof(iBeaconFrame));
+    });
+    scan_socket_for_ad_events_view(0, socks[1], [&](ad_data_view& event) {
+        // Stop on the iBeacon after the skipped and unknown frames
+        return ++ events == count / 2 + 1;
+    }, options);
+    done = true;
+    reader.join();
+    sender.join();
+    close(socks[0]);
+    close(socks[1]);
+
+    scan_stats_snapshot snapshot;
+    scanStatsRead(stats, snapshot);
+    printf("frames=%lu, bytes=%lu, adv_reports=%lu, ad_structures=%lu, parse_errors=%lu, unknown_events=%lu, "
+           "callback_ns=%lu\n", snapshot.frames, snapshot.bytes, snapshot.adv_reports, snapshot.ad_structures,
+           snapshot.parse_errors, snapshot.unknown_events, snapshot.callback_ns);
+    printf("snapshots=%lu, inconsistent=%lu\n", snapshots, inconsistent);
+    if (snapshot.version != SCAN_STATS_VERSION || snapshot.size != sizeof(snapshot))
+        printf("Failed on snapshot version\n");
+    if (snapshot.frames != count + 3 || snapshot.adv_reports != count / 2 + 1 || snapshot.parse_errors != count / 2
+        || snapshot.unknown_events != 1 || snapshot.ad_structures != 2 * (count / 2 + 1))
+        printf("Failed on counts\n");
+    if (snapshot.callback_ns == 0)
+        printf("Failed on callback time\n");
+    if (inconsistent != 0)
+        printf("Failed on %lu inconsistent snapshots\n", inconsistent);
+    return 0;
+}
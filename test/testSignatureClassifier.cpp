@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <src/signatureclassifier.h>
+
+extern "C" {
+#include <src/parser.h>
+}
+
+/**
+ * Test the signature classifier against the findBeaconDecoder registry lookup, the vector kernel against the scalar
+ * one, and the matching of added vendor signatures
+ */
+int main() {
+    printf("signature kernel: %s\n", SIGNATURE_KERNEL);
+    const signature_table& beacons = beaconSignatureTable();
+    if (beacons.count != BEACON_DECODER_KEYS)
+        printf("Failed on beacon table count=%u\n", beacons.count);
+
+    // Random structures biased to the registry ids and subtypes agree with the registry lookup
+    srand(1463720753);
+    const uint8_t types[] = {AD_TYPE_MANUFACTURER_DATA, AD_TYPE_SERVICE_DATA_16, 0x09, 0x03};
+    const uint8_t subtypes[] = {0x00, 0x10, 0x20, 0x21, 0x30, 0x02, 0xbe};
+    uint8_t data[31];
+    for (int pass = 0; pass < 100000; pass ++) {
+        uint8_t adType = types[rand() % sizeof(types)];
+        uint8_t length = rand() % sizeof(data);
+        for (uint32_t n = 0; n < sizeof(data); n ++)
+            data[n] = rand();
+        if (rand() % 2) {
+            data[0] = rand() % 2 ? 0x4c : 0xaa;
+            data[1] = rand() % 2 ? 0x00 : 0xfe;
+        }
+        if (rand() % 2) {
+            data[2] = subtypes[rand() % sizeof(subtypes)];
+            data[3] = rand() % 2 ? 0x15 : 0xac;
+        }
+        uint32_t matches = matchSignatures(beacons, adType, data, length);
+        uint8_t expected = classifyAdStructure(adType, data, length);
+        if (firstSignatureFormat(beacons, matches) != expected)
+            printf("Failed on type=0x%.2x length=%d %.2x %.2x %.2x %.2x, expected format %d, matches 0x%x\n", adType,
+                   length, data[0], data[1], data[2], data[3], expected, matches);
+        uint64_t key = packSignatureKey(adType, data, length);
+        if (matchSignatureBlock(beacons.blocks[0], key) != matchSignatureBlockScalar(beacons.blocks[0], key))
+            printf("Failed on matchSignatureBlock versus matchSignatureBlockScalar\n");
+    }
+
+    // A RHIoTTag TLM frame is also an Eddystone TLM frame
+    const uint8_t tlm[] = {0xaa, 0xfe, 0x20, 0x00, 0x0b, 0xb8, 0x17, 0x80, 0x00, 0x00, 0x23, 0x28, 0x00, 0x00, 0x1d,
+                           0x4c, 0x05, 0x4a, 0x3f};
+    uint32_t formats = signatureFormats(beacons, matchSignatures(beacons, AD_TYPE_SERVICE_DATA_16, tlm, sizeof(tlm)));
+    if (formats != (1u << BEACON_FORMAT_RHIOTTAG_TLM | 1u << BEACON_FORMAT_EDDYSTONE_TLM))
+        printf("Failed on RHIoTTag TLM formats 0x%x\n", formats);
+    formats = signatureFormats(beacons, matchSignatures(beacons, AD_TYPE_SERVICE_DATA_16, tlm, sizeof(tlm) - 3));
+    if (formats != 1u << BEACON_FORMAT_EDDYSTONE_TLM)
+        printf("Failed on Eddystone TLM formats 0x%x\n", formats);
+
+    // Vendor signatures added after the beacon ones, in the second block, with a masked subtype
+    signature_table table;
+    initSignatureTable(table);
+    addBeaconSignatures(table);
+    const uint8_t nordic[] = {0x59, 0x00, 0x40};
+    const uint8_t nordicMask[] = {0xff, 0xff, 0xf0};
+    const uint8_t name[] = {'R', 'H'};
+    int vendor = BEACON_FORMATS;
+    while (table.count < SIGNATURE_LANES)
+        addSignature(table, 0x08, name, nullptr, sizeof(name), 0, vendor);
+    if (!addSignature(table, AD_TYPE_MANUFACTURER_DATA, nordic, nordicMask, sizeof(nordic), 6, vendor + 1))
+        printf("Failed on addSignature\n");
+    const uint8_t nordicData[] = {0x59, 0x00, 0x4d, 0x01, 0x02, 0x03};
+    formats = signatureFormats(table, matchSignatures(table, AD_TYPE_MANUFACTURER_DATA, nordicData,
+                                                      sizeof(nordicData)));
+    if (formats != 1u << (vendor + 1))
+        printf("Failed on vendor formats 0x%x\n", formats);
+    formats = signatureFormats(table, matchSignatures(table, AD_TYPE_MANUFACTURER_DATA, nordicData,
+                                                      sizeof(nordicData) - 1));
+    if (formats != 0)
+        printf("Failed on vendor min_length, formats 0x%x\n", formats);
+    // The name signature, of a shortened local name, is raised to the prefix length
+    if (signatureFormats(table, matchSignatures(table, 0x08, name, 1)) != 0
+        || signatureFormats(table, matchSignatures(table, 0x08, name, 2)) != 1u << vendor)
+        printf("Failed on name signature min_length\n");
+    while (table.count < MAX_SIGNATURES)
+        addSignature(table, 0x08, name, nullptr, sizeof(name), 0, vendor);
+    if (addSignature(table, 0x08, name, nullptr, sizeof(name), 0, vendor)
+        || addSignature(table, 0x08, name, nullptr, SIGNATURE_PREFIX_SIZE + 1, 0, vendor)
+        || addSignature(table, 0x08, name, nullptr, sizeof(name), 0, MAX_SIGNATURE_FORMATS))
+        printf("Failed on addSignature limits\n");
+
+    // Classify the AD structures of an Eddystone report, the flags, service uuid list and UID frame
+    uint8_t report[] = {0x04, 0x3e, 0x2b, 0x02, 0x01, 0x03, 0x01, 0x3c, 0x29, 0x8e, 0x51, 0x0f, 0xc4, 0x1f, 0x02,
+                        0x01, 0x06, 0x03, 0x03, 0xaa, 0xfe, 0x17, 0x16, 0xaa, 0xfe, 0x00, 0xe7, 0x00, 0x01, 0x02,
+                        0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x00, 0x00,
+                        0xb5};
+    struct frame frm;
+    memset(&frm, 0, sizeof(frm));
+    frm.ts.tv_sec = 1463720753;
+    frm.data = report;
+    frm.data_len = sizeof(report);
+    ad_data_view event;
+    if (parse_frame(&frm, event) != PARSE_ADV_REPORT || event.count != 3) {
+        printf("Failed to parse report\n");
+        return 0;
+    }
+    uint32_t structureFormats[MAX_AD_STRUCTURES];
+    uint32_t structureMatches[MAX_AD_STRUCTURES];
+    uint32_t any = classifyAdStructures(beacons, event, structureFormats, structureMatches);
+    if (any != 1u << BEACON_FORMAT_EDDYSTONE_UID || structureFormats[0] != 0 || structureFormats[1] != 0
+        || structureFormats[2] != any
+        || firstSignatureFormat(beacons, structureMatches[2]) != BEACON_FORMAT_EDDYSTONE_UID)
+        printf("Failed on classifyAdStructures, any=0x%x\n", any);
+    return 0;
+}
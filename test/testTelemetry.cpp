@@ -0,0 +1,143 @@
+#include <cstddef>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <src/telemetry.h>
+
+extern "C" {
+#include <src/parser.h>
+}
+
+// The JNI SENSOR_*_OFFSET constants depend on this layout
+static_assert(sizeof(sensor_record) == 56, "sensor_record size changed");
+static_assert(offsetof(sensor_record, time) == 0, "sensor_record.time moved");
+static_assert(offsetof(sensor_record, version) == 8, "sensor_record.version moved");
+static_assert(offsetof(sensor_record, flags) == 9, "sensor_record.flags moved");
+static_assert(offsetof(sensor_record, keys) == 10, "sensor_record.keys moved");
+static_assert(offsetof(sensor_record, rssi) == 11, "sensor_record.rssi moved");
+static_assert(offsetof(sensor_record, bdaddr) == 12, "sensor_record.bdaddr moved");
+static_assert(offsetof(sensor_record, battery_mv) == 18, "sensor_record.battery_mv moved");
+static_assert(offsetof(sensor_record, temperature) == 20, "sensor_record.temperature moved");
+static_assert(offsetof(sensor_record, lux_raw) == 22, "sensor_record.lux_raw moved");
+static_assert(offsetof(sensor_record, adv_count) == 24, "sensor_record.adv_count moved");
+static_assert(offsetof(sensor_record, sec_count) == 28, "sensor_record.sec_count moved");
+static_assert(offsetof(sensor_record, lux) == 32, "sensor_record.lux moved");
+static_assert(offsetof(sensor_record, temperature_c) == 36, "sensor_record.temperature_c moved");
+static_assert(offsetof(sensor_record, gyro) == 40, "sensor_record.gyro moved");
+static_assert(offsetof(sensor_record, accel) == 46, "sensor_record.accel moved");
+
+/**
+ * The exp2 conversion of testRHIoTTag that opt3001ToLux replaces
+ */
+static float sensorOpt3001Convert(uint16_t rawData) {
+    uint16_t m = rawData & 0x0FFF;
+    uint16_t e = (rawData & 0xF000) >> 12;
+    return m * (0.01 * exp2(e));
+}
+
+/**
+ * Parse an LE advertising report of the AD structures ads from bdaddr b0:3c:4a:d0:71:b0
+ */
+static bool parseReport(std::vector<uint8_t>& report, const std::vector<uint8_t>& ads, ad_data_view& event) {
+    report = {0x04, 0x3e, 0, 0x02, 0x01, 0x00, 0x00, 0xb0, 0x71, 0xd0, 0x4a, 0x3c, 0xb0, (uint8_t) ads.size()};
+    report.insert(report.end(), ads.begin(), ads.end());
+    report.push_back(0xb9);
+    report[2] = report.size() - 3;
+    struct frame frm;
+    memset(&frm, 0, sizeof(frm));
+    frm.ts.tv_sec = 1463720753;
+    frm.data = report.data();
+    frm.data_len = report.size();
+    return parse_frame(&frm, event) == PARSE_ADV_REPORT;
+}
+
+/**
+ * Test the batch lux and fixed point kernels against the scalar conversions over every raw value, and the decoding
+ * of the RHIoTTag TLM and misc frames into sensor records
+ */
+int main() {
+    printf("telemetry kernel: %s\n", TELEMETRY_KERNEL);
+    // Every raw value, with a count that leaves a tail for the scalar loop
+    const uint32_t count = 65536 + 5;
+    std::vector<uint16_t> raw(count);
+    for (uint32_t n = 0; n < count; n ++)
+        raw[n] = (uint16_t) n;
+    std::vector<float> out(count);
+    opt3001ToLuxBatch(raw.data(), out.data(), count);
+    for (uint32_t n = 0; n < count; n ++) {
+        if (out[n] != opt3001ToLux(raw[n]))
+            printf("Failed on opt3001ToLuxBatch(0x%.4x), %f != %f\n", raw[n], out[n], opt3001ToLux(raw[n]));
+        // The double precision exp2 form may round differently in the last place
+        float expected = sensorOpt3001Convert(raw[n]);
+        if (fabsf(out[n] - expected) > expected * 1e-6f)
+            printf("Failed on opt3001ToLux(0x%.4x), %f != %f\n", raw[n], out[n], expected);
+    }
+    fixed88ToFloatBatch((const int16_t *) raw.data(), out.data(), count);
+    for (uint32_t n = 0; n < count; n ++) {
+        int16_t value = (int16_t) raw[n];
+        bool match = value == TLM_TEMPERATURE_NOT_SUPPORTED ? isnan(out[n]) : out[n] == value / 256.0;
+        if (!match)
+            printf("Failed on fixed88ToFloatBatch(0x%.4x), found %f\n", raw[n], out[n]);
+    }
+
+    // A RHIoTTag TLM frame of 3000mV, 23.5C, 9000 advertisements, 750s, the left and reed keys and 0x4a3f lux
+    std::vector<uint8_t> tlm = {0x03, 0x03, 0xaa, 0xfe, 0x14, 0x16, 0xaa, 0xfe, 0x20, 0x00, 0x0b, 0xb8, 0x17, 0x80,
+                                0x00, 0x00, 0x23, 0x28, 0x00, 0x00, 0x1d, 0x4c, 0x05, 0x4a, 0x3f};
+    std::vector<uint8_t> report;
+    ad_data_view event;
+    sensor_record records[3];
+    if (!parseReport(report, tlm, event) || !decodeSensorRecord(event, records[0])) {
+        printf("Failed to decode RHIoTTag TLM report\n");
+        return 0;
+    }
+    const uint8_t bdaddr[] = {0xb0, 0x71, 0xd0, 0x4a, 0x3c, 0xb0};
+    sensor_record& record = records[0];
+    if (record.version != SENSOR_RECORD_VERSION || record.flags != SENSOR_FLAG_TLM || record.time != event.time
+        || record.rssi != -71 || memcmp(record.bdaddr, bdaddr, 6) != 0 || record.battery_mv != 3000
+        || record.temperature != 0x1780 || record.adv_count != 9000 || record.sec_count != 7500
+        || record.keys != (SENSOR_KEY_LEFT | SENSOR_KEY_REED) || record.lux_raw != 0x4a3f || record.lux != 0)
+        printf("Failed on RHIoTTag TLM record\n");
+
+    // The misc frame with the motion readings, the lux of which replaces that of the TLM frame
+    std::vector<uint8_t> misc = {0x13, 0x16, 0xaa, 0xfe, 0x21, 0x02, 0x51, 0x00, 0x00, 0x10, 0xff, 0xf0, 0x01, 0x00,
+                                 0x00, 0x20, 0xff, 0xe0, 0x40, 0x00};
+    if (!parseReport(report, misc, event) || !decodeSensorRecord(event, records[1])) {
+        printf("Failed to decode RHIoTTag misc report\n");
+        return 0;
+    }
+    if (records[1].flags != SENSOR_FLAG_MISC || records[1].keys != SENSOR_KEY_RIGHT || records[1].lux_raw != 0x5100
+        || records[1].gyro[0] != 16 || records[1].gyro[1] != -16 || records[1].gyro[2] != 256
+        || records[1].accel[0] != 32 || records[1].accel[1] != -32 || records[1].accel[2] != 0x4000
+        || records[1].temperature != TLM_TEMPERATURE_NOT_SUPPORTED)
+        printf("Failed on RHIoTTag misc record\n");
+
+    // An encrypted TLM frame, version 1, and a report with no telemetry are not sensor records
+    tlm[9] = 0x01;
+    if (!parseReport(report, tlm, event) || decodeSensorRecord(event, records[2]))
+        printf("Failed on encrypted TLM report\n");
+    std::vector<uint8_t> flags = {0x02, 0x01, 0x06};
+    if (!parseReport(report, flags, event) || decodeSensorRecord(event, records[2]))
+        printf("Failed on report without telemetry\n");
+
+    convertSensorRecords(records, 2);
+    if (records[0].lux != opt3001ToLux(0x4a3f) || fabsf(records[0].lux - 419.68f) > 0.01f
+        || records[0].temperature_c != 23.5f)
+        printf("Failed on converted TLM record, lux=%f, temperature=%f\n", records[0].lux, records[0].temperature_c);
+    if (fabsf(records[1].lux - 81.92f) > 0.01f || !isnan(records[1].temperature_c))
+        printf("Failed on converted misc record, lux=%f, temperature=%f\n", records[1].lux, records[1].temperature_c);
+
+    // A batch larger than SENSOR_CONVERT_BATCH
+    std::vector<sensor_record> batch(2*SENSOR_CONVERT_BATCH + 3);
+    for (uint32_t n = 0; n < batch.size(); n ++) {
+        batch[n].lux_raw = (uint16_t) (n * 997);
+        batch[n].temperature = (int16_t) (n * 131 - 2000);
+    }
+    convertSensorRecords(batch.data(), batch.size());
+    for (uint32_t n = 0; n < batch.size(); n ++) {
+        if (batch[n].lux != opt3001ToLux(batch[n].lux_raw)
+            || batch[n].temperature_c != fixed88ToFloat(batch[n].temperature))
+            printf("Failed on convertSensorRecords record %u\n", n);
+    }
+    return 0;
+}
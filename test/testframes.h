@@ -0,0 +1,66 @@
+#ifndef testframes_H
+#define testframes_H
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <src/dumpfile.h>
+
+/*
+ * The HCI frames shared by the capture, replay and parser tests, and the btsnoop writer that archives them
+ */
+
+// An LE advertising report event with flags and iBeacon manufacturer data AD structures
+static const uint8_t iBeaconFrame[] = {0x04, 0x3e, 0x2a, 0x02, 0x01, 0x03, 0x01, 0x85, 0xDA, 0xD6, 0x48, 0xB4, 0xB0,
+    0x1e, 0x02, 0x01, 0x04, 0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15, 0xDA, 0xF2, 0x46, 0xCE, 0xF2, 0x01, 0x11, 0xE4, 0xB1,
+    0x16, 0x12, 0x3B, 0x93, 0xF7, 0x5C, 0xBA, 0x30, 0x39, 0x2b, 0x67, 0xc5, 0xb0};
+// A command complete event that the parser skips
+static const uint8_t commandCompleteFrame[] = {0x04, 0x0e, 0x04, 0x01, 0x0c, 0x20, 0x00};
+
+static inline struct timeval millisToTimeval(int64_t ms) {
+    struct timeval ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_usec = (ms % 1000) * 1000;
+    return ts;
+}
+
+/**
+ * Write a btsnoop archive of count iBeacon frames, each followed by a command complete frame
+ * @param mutate called as mutate(frame, seq) to alter the copy of the iBeaconFrame written as beacon seq
+ * @param timeOf called as timeOf(seq) for the time in milliseconds of beacon seq and the frame following it
+ * @param type the btsnoop datalink type, the unencapsulated HCI type drops the packet type byte of each frame
+ */
+template <typename Mutate, typename TimeOf>
+static void writeBtsnoop(const char *path, int count, Mutate mutate, TimeOf timeOf,
+                         uint32_t type = BTSNOOP_TYPE_UART) {
+    FILE *file = fopen(path, "wb");
+    btsnoop_hdr hdr;
+    memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
+    hdr.version = htobe32(1);
+    hdr.type = htobe32(type);
+    fwrite(&hdr, BTSNOOP_HDR_SIZE, 1, file);
+    uint32_t skip = type == BTSNOOP_TYPE_UART ? 0 : 1;
+    uint8_t beacon[sizeof(iBeaconFrame)];
+    for (int n = 0; n < 2 * count; n ++) {
+        int seq = n / 2;
+        const uint8_t *frame = commandCompleteFrame;
+        uint32_t length = sizeof(commandCompleteFrame);
+        if (n % 2 == 0) {
+            memcpy(beacon, iBeaconFrame, sizeof(iBeaconFrame));
+            mutate(beacon, seq);
+            frame = beacon;
+            length = sizeof(beacon);
+        }
+        struct timeval ts = millisToTimeval(timeOf(seq));
+        btsnoop_pkt pkt;
+        pkt.size = pkt.len = htobe32(length - skip);
+        pkt.flags = htobe32(BTSNOOP_FLAG_RECEIVED | BTSNOOP_FLAG_COMMAND_EVENT);
+        pkt.drops = 0;
+        pkt.ts = htobe64(timevalToBtsnoop(&ts));
+        fwrite(&pkt, BTSNOOP_PKT_SIZE, 1, file);
+        fwrite(frame + skip, length - skip, 1, file);
+    }
+    fclose(file);
+}
+
+#endif